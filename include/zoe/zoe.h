@@ -80,6 +80,7 @@ enum class ZoeResult {
   FETCH_FILE_INFO_FAILED = 31,     ///< Failed to fetch file information
   REDIRECT_URL_DIFFERENT = 32,     ///< Redirected URL differs from original
   NOT_CLEARLY_RESULT = 33,         ///< Result is not clearly defined
+  INSUFFICIENT_DISK_SPACE = 34,    ///< No enough disk space to preallocate the temporary file
 };
 
 /**
@@ -125,6 +126,65 @@ enum class UncompletedSliceSavePolicy {
   SaveExceptFailed = 1    ///< Save uncompleted slices except failed ones
 };
 
+/**
+ * @brief Engine used to wait for network activity
+ */
+enum class EventEngine {
+  Select = 0,   ///< curl_multi_fdset + select(), available on all platforms
+  Epoll = 1,    ///< curl_multi_socket_action + epoll, Linux only
+  External = 2  ///< curl_multi_socket_action driven by the reactor of ZoeExternalLoop
+};
+
+/**
+ * @brief Engine used to read and write the temporary file
+ */
+enum class FileIoEngine {
+  Auto = 0,    ///< pwrite/pread on POSIX, stdio on others
+  Stdio = 1,   ///< FILE* with fseek, available on all platforms
+  IoUring = 2,  ///< Linux io_uring, requests are submitted in batches, falls back to Auto if unsupported
+  Mmap = 3,     ///< Map the temporary file, received data is copied into the mapping, POSIX only
+  Direct = 4    ///< O_DIRECT for the aligned blocks, bypasses the page cache, Linux only
+};
+
+/**
+ * @brief How the disk space of the temporary file is allocated when it is created
+ */
+enum class PreallocatePolicy {
+  Auto = 0,     ///< Reserve the space if the file system supports it, otherwise only set the length
+  Sparse = 1,   ///< Only set the length, blocks are allocated when they are written, POSIX only
+  Reserve = 2   ///< Reserve the space, creating the file fails if the file system does not support it
+};
+
+/**
+ * @brief HTTP version used by the transfers
+ */
+enum class HttpVersionPolicy {
+  Default = 0,             ///< libcurl default, HTTP/2 may be negotiated over TLS
+  Http1 = 1,               ///< Always HTTP/1.1, one connection per slice
+  Http2 = 2,               ///< Negotiate HTTP/2 over TLS, slices are multiplexed over few connections
+  Http2PriorKnowledge = 3  ///< HTTP/2 without negotiation, also for cleartext servers (h2c)
+};
+
+/**
+ * @brief When the downloaded data is forced to the disk
+ */
+enum class DurabilityPolicy {
+  None = 0,        ///< Left to the OS, the index file is written after the data is handed to the OS
+  Checkpoint = 1,  ///< Sync the temporary file to the disk each time the index file is written
+  Periodic = 2     ///< Sync the temporary file to the disk by interval or written bytes
+};
+
+/**
+ * @brief Decisions of the adaptive thread number
+ */
+struct ConcurrencyStats {
+  int32_t connections;       ///< Current target number of connections
+  int32_t best_connections;  ///< Number of connections when the best throughput was measured
+  int64_t throughput;        ///< Throughput of the last sample, in bytes per second
+  int64_t best_throughput;   ///< Best throughput so far, in bytes per second
+  int32_t adjust_times;      ///< Number of times the target has been changed
+};
+
 /**
  * @brief Event class for synchronization
  */
@@ -150,8 +210,153 @@ typedef std::function<void(ZoeResult ret)> ResultFunctor;
 typedef std::function<void(int64_t total, int64_t downloaded)> ProgressFunctor;
 typedef std::function<void(int64_t byte_per_sec)> RealtimeSpeedFunctor;
 typedef std::function<void(const utf8string& verbose)> VerboseOuputFunctor;
+typedef std::function<bool(const char* data, int64_t size)> StreamFunctor;
 typedef std::multimap<utf8string, utf8string> HttpHeaders;
 
+/**
+ * @brief Runs many downloads on a shared pool of event loop threads
+ * @note Create it after Zoe::GlobalInit and destroy it before Zoe::GlobalUnInit
+ * @note Destroying the scheduler cancels the downloads still running on it
+ */
+class ZOE_API ZoeScheduler {
+ public:
+  /**
+   * @brief Create the scheduler and start its event loop threads
+   * @param loop_num Number of event loop threads, 0 or negative to use 1
+   * @param engine Engine used by all of the event loops
+   */
+  ZoeScheduler(int32_t loop_num = 1, EventEngine engine = EventEngine::Select) noexcept;
+  virtual ~ZoeScheduler() noexcept;
+
+  int32_t loopNum() const noexcept;
+  EventEngine eventEngine() const noexcept;
+
+  /**
+   * @brief Set the maximum number of connections of all downloads
+   * @param num Maximum number of connections
+   * @return ZoeResult indicating success or failure
+   * @note Set to 0 or negative to use default (-1, unlimited)
+   * @note Takes effect on new connections
+   */
+  ZoeResult setMaxConnections(int32_t num) noexcept;
+  int32_t maxConnections() const noexcept;
+
+  /**
+   * @brief Set the maximum number of connections to the same host
+   * @param num Maximum number of connections per host
+   * @return ZoeResult indicating success or failure
+   * @note Set to 0 or negative to use default (-1, unlimited)
+   * @note Takes effect on new connections
+   */
+  ZoeResult setMaxConnectionsPerHost(int32_t num) noexcept;
+  int32_t maxConnectionsPerHost() const noexcept;
+
+  /**
+   * @brief Set the maximum download speed of all downloads
+   * @param byte_per_seconds Maximum speed in bytes per second
+   * @return ZoeResult indicating success or failure
+   * @note Set to 0 or negative to use default (-1, unlimited)
+   * @note The bandwidth is divided equally across active connections
+   */
+  ZoeResult setMaxDownloadSpeed(int32_t byte_per_seconds) noexcept;
+  int32_t maxDownloadSpeed() const noexcept;
+
+  /**
+   * @brief Get the number of connections in use
+   * @return Number of active connections of all downloads
+   */
+  int32_t activeConnections() const noexcept;
+
+ protected:
+  friend class Zoe;
+  class SchedulerImpl;
+  SchedulerImpl* impl_;
+
+  ZoeScheduler(const ZoeScheduler&) = delete;
+  ZoeScheduler& operator=(const ZoeScheduler&) = delete;
+};
+
+/**
+ * @brief Lets the caller's own reactor (epoll, asio...) drive many downloads, no thread is created
+ * @note Create it after Zoe::GlobalInit and destroy it before Zoe::GlobalUnInit
+ * @note All methods and functors run on the reactor thread, except the limit setters
+ */
+class ZOE_API ZoeExternalLoop {
+ public:
+  /**
+   * @brief Readiness and interest bits of a socket
+   */
+  enum SocketEvent {
+    SOCKET_EVENT_NONE = 0,   ///< Stop watching the socket
+    SOCKET_EVENT_READ = 1,   ///< Readable
+    SOCKET_EVENT_WRITE = 2,  ///< Writable
+    SOCKET_EVENT_ERROR = 4   ///< Error or hang up, only used as readiness
+  };
+
+  /**
+   * @brief Watch |socket| for |events|, a combination of SOCKET_EVENT_READ and SOCKET_EVENT_WRITE
+   * @note SOCKET_EVENT_NONE means the socket is no longer used, it may be closed already
+   */
+  typedef std::function<void(int64_t socket, int32_t events)> SocketFunctor;
+
+  /**
+   * @brief Call onTimeout after |timeout_ms| milliseconds, replacing the previous timer
+   * @note -1 means no timer is needed, 0 means call it as soon as possible
+   */
+  typedef std::function<void(int32_t timeout_ms)> TimerFunctor;
+
+  ZoeExternalLoop(SocketFunctor socket_functor, TimerFunctor timer_functor) noexcept;
+
+  /**
+   * @note The downloads still running are canceled, it blocks until they are finished
+   */
+  virtual ~ZoeExternalLoop() noexcept;
+
+  /**
+   * @brief Check whether the loop has been created successfully
+   */
+  bool isValid() const noexcept;
+
+  /**
+   * @brief Drive the transfers on a socket that the reactor reported ready
+   * @param socket The socket passed to SocketFunctor
+   * @param readiness Combination of SOCKET_EVENT_READ, SOCKET_EVENT_WRITE and SOCKET_EVENT_ERROR
+   */
+  void perform(int64_t socket, int32_t readiness) noexcept;
+
+  /**
+   * @brief Drive the timeouts and the downloads, called when the timer set by TimerFunctor expires
+   */
+  void onTimeout() noexcept;
+
+  /**
+   * @brief Get the number of downloads running on the loop
+   */
+  int32_t downloadCount() const noexcept;
+
+  /**
+   * @brief Set the maximum number of connections of all downloads
+   * @note Same as ZoeScheduler::setMaxConnections
+   */
+  ZoeResult setMaxConnections(int32_t num) noexcept;
+  int32_t maxConnections() const noexcept;
+
+  /**
+   * @brief Set the maximum download speed of all downloads
+   * @note Same as ZoeScheduler::setMaxDownloadSpeed
+   */
+  ZoeResult setMaxDownloadSpeed(int32_t byte_per_seconds) noexcept;
+  int32_t maxDownloadSpeed() const noexcept;
+
+ protected:
+  friend class Zoe;
+  class ExternalLoopImpl;
+  ExternalLoopImpl* impl_;
+
+  ZoeExternalLoop(const ZoeExternalLoop&) = delete;
+  ZoeExternalLoop& operator=(const ZoeExternalLoop&) = delete;
+};
+
 /**
  * @brief Main class for file download operations
  */
@@ -165,6 +370,28 @@ class ZOE_API Zoe {
   static void GlobalInit();
   static void GlobalUnInit();
 
+  /**
+   * @brief Set the memory limit of the buffers shared by all Zoe instances
+   * @param max_bytes Limit in bytes
+   * @note The disk cache of slices and the data queued for writing are borrowed from a
+   *       process-wide pool, the returned buffers are reused until Zoe::GlobalUnInit.
+   *       If the limit is reached, slices write the received data without caching
+   * @note Default is 268435456 bytes (256MB), set to 0 or negative to use default
+   */
+  static void SetBufferPoolLimit(int64_t max_bytes);
+  static int64_t BufferPoolLimit();
+
+  /**
+   * @brief Set the number of the I/O threads shared by all Zoe instances
+   * @param thread_num Number of threads
+   * @note The threads write the received data to the temporary files, they are started on demand.
+   *       Each download spreads its writes over the threads, see setDiskWriterPolicy
+   * @note Takes effect on the downloads started afterwards, the started threads are kept
+   * @note Default is 4, set to 0 or negative to use default
+   */
+  static void SetDiskWriterThreadNum(int32_t thread_num);
+  static int32_t DiskWriterThreadNum();
+
   void setVerboseOutput(VerboseOuputFunctor verbose_functor) noexcept;
 
   /**
@@ -177,6 +404,26 @@ class ZOE_API Zoe {
   ZoeResult setThreadNum(int32_t thread_num) noexcept;
   int32_t threadNum() const noexcept;
 
+  /**
+   * @brief Enable/disable adjusting the number of threads by the measured throughput
+   * @param enabled Whether to enable adaptive thread number
+   * @param min_num Minimum number of threads
+   * @param max_num Maximum number of threads
+   * @return ZoeResult indicating success or failure
+   * @note The thread number set by setThreadNum is the initial value
+   * @note Set min_num to 0 or negative to use default (1 thread), maximum allowed is 100 threads
+   */
+  ZoeResult setAdaptiveThreadNum(bool enabled, int32_t min_num, int32_t max_num) noexcept;
+  bool adaptiveThreadNumEnabled() const noexcept;
+  int32_t minThreadNum() const noexcept;
+  int32_t maxThreadNum() const noexcept;
+
+  /**
+   * @brief Get the decisions of the adaptive thread number
+   * @return Statistics of the current download
+   */
+  ConcurrencyStats concurrencyStats() const noexcept;
+
   /**
    * @brief Set the network connection timeout
    * @param milliseconds Timeout duration in milliseconds
@@ -236,12 +483,99 @@ class ZOE_API Zoe {
 
   /**
    * @brief Set the disk cache size
-   * @param cache_size Size in bytes
+   * @param cache_size Size in bytes, shared by all slices of the download
    * @return ZoeResult indicating success or failure
    * @note Default is 20971520 bytes (20MB)
+   * @note The cache is also limited by Zoe::SetBufferPoolLimit
+   */
+  ZoeResult setDiskCacheSize(int64_t cache_size) noexcept;
+  int64_t diskCacheSize() const noexcept;
+
+  /**
+   * @brief Set the I/O threads that write the received data to the temporary file
+   * @param thread_num Number of the shared I/O threads used by this download, 0 means writing in
+   *        the network callbacks. It is limited by Zoe::SetDiskWriterThreadNum
+   * @param queue_size Bytes of this download waiting to be written, transfers are paused while it
+   *        is exceeded
+   * @return ZoeResult indicating success or failure
+   * @note Default is 1 thread and 33554432 bytes (32MB)
+   * @note Set queue_size to 0 or negative to use default
+   */
+  ZoeResult setDiskWriterPolicy(int32_t thread_num, int64_t queue_size) noexcept;
+  int32_t diskWriterThreadNum() const noexcept;
+  int64_t diskWriterQueueSize() const noexcept;
+
+  /**
+   * @brief Set the engine used to write the temporary file and read it for hash verifying
+   * @param engine The file I/O engine
+   * @return ZoeResult indicating success or failure
+   * @note Default is FileIoEngine::Auto
+   * @note FileIoEngine::IoUring is detected at runtime, it falls back to FileIoEngine::Auto if
+   *       the kernel does not support it or the library is built without it
+   * @note FileIoEngine::Mmap needs the file size and disables the disk cache, it falls back to
+   *       FileIoEngine::Auto if the file can not be mapped or the disk space can not be reserved
+   * @note FileIoEngine::Direct makes the disk cache of each slice aligned and at least 1MB, the
+   *       unaligned fragments at the slice boundaries are written through the page cache
+   */
+  ZoeResult setFileIoEngine(FileIoEngine engine) noexcept;
+  FileIoEngine fileIoEngine() const noexcept;
+
+  /**
+   * @brief Set how the disk space of the temporary file is allocated
+   * @param policy The preallocate policy
+   * @return ZoeResult indicating success or failure
+   * @note Default is PreallocatePolicy::Auto
+   * @note Reserving the space up front keeps the file from being fragmented by the scattered
+   *       writes of slices. If the disk is full, the download fails with
+   *       ZoeResult::INSUFFICIENT_DISK_SPACE before any data is downloaded
+   * @note Only takes effect if the file size is known
+   */
+  ZoeResult setPreallocatePolicy(PreallocatePolicy policy) noexcept;
+  PreallocatePolicy preallocatePolicy() const noexcept;
+
+  /**
+   * @brief Set the reorder window of Zoe::startStream
+   * @param window_size Bytes that may be received ahead of the delivered data, held in memory
+   * @return ZoeResult indicating success or failure
+   * @note Default is 67108864 bytes (64MB), set to 0 or negative to use default
+   * @note A slice that is beyond the window is paused until the data before it is delivered
+   */
+  ZoeResult setStreamWindowSize(int64_t window_size) noexcept;
+  int64_t streamWindowSize() const noexcept;
+
+  /**
+   * @brief Set the engine used to wait for network activity
+   * @param engine The event engine
+   * @return ZoeResult indicating success or failure
+   * @note Default is EventEngine::Select
+   * @note EventEngine::Epoll falls back to EventEngine::Select on non-Linux platforms
+   * @note EventEngine::External falls back to EventEngine::Select, use setExternalLoop instead
    */
-  ZoeResult setDiskCacheSize(int32_t cache_size) noexcept;
-  int32_t diskCacheSize() const noexcept;
+  ZoeResult setEventEngine(EventEngine engine) noexcept;
+  EventEngine eventEngine() const noexcept;
+
+  /**
+   * @brief Run the download on a shared scheduler instead of a dedicated thread
+   * @param scheduler Pointer to the scheduler, nullptr to use a dedicated thread
+   * @return ZoeResult indicating success or failure
+   * @note Default is nullptr
+   * @note The scheduler must outlive the download
+   * @note The event engine of the scheduler is used, setEventEngine is ignored
+   */
+  ZoeResult setScheduler(ZoeScheduler* scheduler) noexcept;
+  ZoeScheduler* scheduler() const noexcept;
+
+  /**
+   * @brief Run the download on an event loop driven by the caller's reactor
+   * @param loop Pointer to the external loop, nullptr to not use it
+   * @return ZoeResult indicating success or failure
+   * @note Default is nullptr
+   * @note The loop must outlive the download, it takes precedence over setScheduler
+   * @note Call start on the reactor thread and wait for the result by the result functor,
+   *       waiting on the returned future blocks the reactor
+   */
+  ZoeResult setExternalLoop(ZoeExternalLoop* loop) noexcept;
+  ZoeExternalLoop* externalLoop() const noexcept;
 
   /**
    * @brief Set the stop event for download cancellation
@@ -345,6 +679,73 @@ class ZOE_API Zoe {
   ZoeResult setUncompletedSliceSavePolicy(UncompletedSliceSavePolicy policy) noexcept;
   UncompletedSliceSavePolicy uncompletedSliceSavePolicy() const noexcept;
 
+  /**
+   * @brief Enable/disable hedged requests for slow slices
+   * @param enabled Whether to enable hedged requests
+   * @param rate_percent A slice is slow if its rate is lower than this percent of the median rate
+   * @return ZoeResult indicating success or failure
+   * @note Set rate_percent to 0 or negative to use default (25), values above 100 are treated as 100
+   * @note A duplicate request for the remaining range of a slow slice is started on an idle
+   *       connection, the first one that finishes wins
+   */
+  ZoeResult setHedgePolicy(bool enabled, int32_t rate_percent) noexcept;
+  bool hedgeEnabled() const noexcept;
+  int32_t hedgeRatePercent() const noexcept;
+
+  /**
+   * @brief Set the HTTP version used by the transfers
+   * @param policy The policy to use
+   * @return ZoeResult indicating success or failure
+   * @note Default is Default
+   * @note With HTTP/2 the range requests of slices are carried as streams, new slices wait for
+   *       an existing connection to the host instead of opening a new one
+   */
+  ZoeResult setHttpVersionPolicy(HttpVersionPolicy policy) noexcept;
+  HttpVersionPolicy httpVersionPolicy() const noexcept;
+
+  /**
+   * @brief Set how often the progress callback is called
+   * @param interval_ms Minimum interval between two callbacks, in milliseconds
+   * @param min_delta_bytes Minimum downloaded bytes between two callbacks
+   * @return ZoeResult indicating success or failure
+   * @note Set interval_ms to 0 or negative to use default (500), min_delta_bytes defaults to 0
+   * @note The callback is skipped if nothing has been downloaded since the last one, and is
+   *       always called once all data has been downloaded
+   */
+  ZoeResult setProgressReportPolicy(int32_t interval_ms, int64_t min_delta_bytes) noexcept;
+  int32_t progressReportInterval() const noexcept;
+  int64_t progressReportMinDelta() const noexcept;
+
+  /**
+   * @brief Set how often and how smoothly the realtime speed callback reports
+   * @param interval_ms Interval of speed samples, in milliseconds
+   * @param smoothing_percent Weight of the latest sample in the reported speed (EWMA)
+   * @return ZoeResult indicating success or failure
+   * @note Set interval_ms to 0 or negative to use default (1000)
+   * @note Set smoothing_percent to 0 or negative to use default (100, no smoothing),
+   *       values above 100 are treated as 100
+   */
+  ZoeResult setSpeedReportPolicy(int32_t interval_ms, int32_t smoothing_percent) noexcept;
+  int32_t speedReportInterval() const noexcept;
+  int32_t speedSmoothingPercent() const noexcept;
+
+  /**
+   * @brief Set when the downloaded data is forced to the disk
+   * @param policy The policy to use
+   * @param interval_ms Sync interval of Periodic policy, in milliseconds
+   * @param bytes Sync after this number of bytes have been written, for Periodic policy
+   * @return ZoeResult indicating success or failure
+   * @note Default is None
+   * @note Set interval_ms or bytes to 0 or negative to disable that trigger, if both are disabled
+   *       the defaults (5000ms, 64MB) are used
+   * @note The index file only records the data that has been synced, so a resumed download never
+   *       trusts data that may be lost in a power failure
+   */
+  ZoeResult setDurabilityPolicy(DurabilityPolicy policy, int32_t interval_ms, int64_t bytes) noexcept;
+  DurabilityPolicy durabilityPolicy() const noexcept;
+  int32_t durabilitySyncInterval() const noexcept;
+  int64_t durabilitySyncBytes() const noexcept;
+
   /**
    * @brief Start the download operation
    * @param url Source URL
@@ -370,6 +771,29 @@ class ZOE_API Zoe {
       RealtimeSpeedFunctor realtime_speed_functor) noexcept;
 #endif
 
+  /**
+   * @brief Start the download operation, the data is delivered in order instead of saved to a file
+   * @param url Source URL
+   * @param stream_functor Receives the data in file order, return false to cancel the download
+   * @param result_functor Callback for download completion
+   * @param progress_functor Callback for download progress
+   * @param realtime_speed_functor Callback for real-time speed
+   * @return Future containing the download result
+   * @note Slices are still downloaded in parallel, the data received ahead of the delivered
+   *       position is held in memory, see setStreamWindowSize
+   * @note |stream_functor| is called on the event loop thread or the disk writer threads, one
+   *       call at a time
+   * @note There is no temporary file or index file, a stopped download can not be resumed.
+   *       The hash is calculated on the delivered data, so a HASH_VERIFY_NOT_PASS result comes
+   *       after all data has been delivered
+   */
+  std::shared_future<ZoeResult> startStream(
+      const utf8string& url,
+      StreamFunctor stream_functor,
+      ResultFunctor result_functor,
+      ProgressFunctor progress_functor,
+      RealtimeSpeedFunctor realtime_speed_functor) noexcept;
+
   /**
    * @brief Pause the download operation
    */
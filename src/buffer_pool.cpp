@@ -0,0 +1,167 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "buffer_pool.h"
+#include <assert.h>
+#include <stdlib.h>
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+#include <malloc.h>
+#endif
+
+// Covers the block size of direct I/O.
+#define BUFFER_POOL_ALIGNMENT 4096
+// Smaller requests share the smallest class, e.g. the copies of the write callback data.
+#define BUFFER_POOL_MIN_CHUNK_SIZE 16384  // 16KB
+
+namespace zoe {
+static char* AllocChunk(int64_t size) {
+  if ((uint64_t)size > (uint64_t)SIZE_MAX)
+    return nullptr;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  return (char*)_aligned_malloc((size_t)size, BUFFER_POOL_ALIGNMENT);
+#else
+  void* p = nullptr;
+  return (posix_memalign(&p, BUFFER_POOL_ALIGNMENT, (size_t)size) == 0 ? (char*)p : nullptr);
+#endif
+}
+
+static void FreeChunk(char* chunk) {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  _aligned_free(chunk);
+#else
+  free(chunk);
+#endif
+}
+
+BufferPool::BufferPool(int64_t limit)
+    : limit_(limit)
+    , allocated_bytes_(0L)
+    , idle_bytes_(0L) {
+}
+
+BufferPool::~BufferPool() {
+  trim();
+  assert(allocated_bytes_ == 0L);
+}
+
+BufferPool* BufferPool::Global() {
+  static BufferPool pool(ZOE_DEFAULT_BUFFER_POOL_LIMIT);
+  return &pool;
+}
+
+int64_t BufferPool::ChunkSize(int64_t size) {
+  if (size <= BUFFER_POOL_MIN_CHUNK_SIZE)
+    return BUFFER_POOL_MIN_CHUNK_SIZE;
+
+  int64_t base = BUFFER_POOL_MIN_CHUNK_SIZE;
+  while (base * 2 < size)
+    base *= 2;
+
+  const int64_t step = base / 4;
+  return base + (size - base + step - 1) / step * step;
+}
+
+char* BufferPool::acquire(int64_t size) {
+  if (size <= 0)
+    return nullptr;
+
+  const int64_t chunk_size = ChunkSize(size);
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto it = idle_chunks_.find(chunk_size);
+  if (it != idle_chunks_.end() && !it->second.empty()) {
+    char* chunk = it->second.back();
+    it->second.pop_back();
+    idle_bytes_ -= chunk_size;
+    return chunk;
+  }
+
+  if (!makeRoom(chunk_size))
+    return nullptr;
+
+  char* chunk = AllocChunk(chunk_size);
+  if (chunk)
+    allocated_bytes_ += chunk_size;
+  return chunk;
+}
+
+void BufferPool::release(char* buffer, int64_t size) {
+  if (!buffer)
+    return;
+
+  const int64_t chunk_size = ChunkSize(size);
+  std::lock_guard<std::mutex> lg(mutex_);
+  // The limit may be lowered after the chunk was borrowed.
+  if (allocated_bytes_ > limit_) {
+    allocated_bytes_ -= chunk_size;
+    FreeChunk(buffer);
+    return;
+  }
+
+  idle_chunks_[chunk_size].push_back(buffer);
+  idle_bytes_ += chunk_size;
+}
+
+void BufferPool::trim() {
+  std::lock_guard<std::mutex> lg(mutex_);
+  for (auto& it : idle_chunks_) {
+    for (char* chunk : it.second)
+      FreeChunk(chunk);
+    allocated_bytes_ -= it.first * (int64_t)it.second.size();
+  }
+  idle_chunks_.clear();
+  idle_bytes_ = 0L;
+}
+
+void BufferPool::setLimit(int64_t limit) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  limit_ = limit;
+  makeRoom(0L);
+}
+
+int64_t BufferPool::limit() const {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return limit_;
+}
+
+int64_t BufferPool::allocatedBytes() const {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return allocated_bytes_;
+}
+
+int64_t BufferPool::idleBytes() const {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return idle_bytes_;
+}
+
+bool BufferPool::makeRoom(int64_t need) {
+  // From the largest chunks.
+  auto it = idle_chunks_.rbegin();
+  while (allocated_bytes_ + need > limit_ && it != idle_chunks_.rend()) {
+    if (it->second.empty()) {
+      ++it;
+      continue;
+    }
+    FreeChunk(it->second.back());
+    it->second.pop_back();
+    allocated_bytes_ -= it->first;
+    idle_bytes_ -= it->first;
+  }
+
+  return (allocated_bytes_ + need <= limit_);
+}
+}  // namespace zoe
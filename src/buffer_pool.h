@@ -0,0 +1,76 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_BUFFER_POOL_H_
+#define ZOE_BUFFER_POOL_H_
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <mutex>
+
+// Default limit of the process-wide pool.
+#define ZOE_DEFAULT_BUFFER_POOL_LIMIT 268435456  // 256MB
+
+namespace zoe {
+// Fixed-size chunks of memory that are borrowed and returned, instead of malloc and free of large
+// buffers for each slice. A requested size is rounded up to a size class, the classes are a
+// quarter power of two apart, so a chunk wastes less than 25%.
+// The allocated bytes, borrowed and idle, never exceed the limit. The idle chunks are freed to
+// make room for other size classes.
+// Chunks are aligned to BUFFER_POOL_ALIGNMENT, see FileBackend::ioAlignment.
+class BufferPool {
+ public:
+  explicit BufferPool(int64_t limit);
+  virtual ~BufferPool();  // the borrowed chunks must have been returned
+
+  // Shared by all Zoe instances.
+  static BufferPool* Global();
+
+  // Return nullptr if the limit is reached.
+  char* acquire(int64_t size);
+
+  // |size| is the same as the one passed to acquire.
+  void release(char* buffer, int64_t size);
+
+  // Free the idle chunks.
+  void trim();
+
+  // Takes effect on the following acquires, the borrowed chunks are kept.
+  void setLimit(int64_t limit);
+  int64_t limit() const;
+
+  int64_t allocatedBytes() const;
+  int64_t idleBytes() const;
+
+  static int64_t ChunkSize(int64_t size);
+
+ protected:
+  // Free the idle chunks until |need| bytes can be allocated, return false if they are not enough.
+  bool makeRoom(int64_t need);
+
+ protected:
+  mutable std::mutex mutex_;
+  int64_t limit_;
+  int64_t allocated_bytes_;
+  int64_t idle_bytes_;
+  std::map<int64_t, std::vector<char*>> idle_chunks_;  // chunk size -> chunks
+};
+}  // namespace zoe
+#endif  // !ZOE_BUFFER_POOL_H_
@@ -0,0 +1,148 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "concurrency_tuner.h"
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include "options.h"
+#include "verbose.h"
+
+// Interval of throughput sampling, in milliseconds.
+// New connections need some time to ramp up, a shorter interval makes the samples noisy.
+#define TUNE_INTERVAL_MS 2000
+
+// Throughput changes within this percentage are treated as stable.
+#define TUNE_STABLE_PERCENT 5
+
+// Probe a larger number of connections after this many stable samples.
+#define TUNE_PROBE_STABLE_TIMES 3
+
+namespace zoe {
+ConcurrencyTuner::ConcurrencyTuner()
+    : options_(nullptr)
+    , enabled_(false)
+    , min_num_(ZOE_DEFAULT_THREAD_NUM)
+    , max_num_(ZOE_DEFAULT_THREAD_NUM)
+    , direction_(1)
+    , stable_times_(0)
+    , last_throughput_(-1)
+    , last_download_(0) {
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.connections = ZOE_DEFAULT_THREAD_NUM;
+}
+
+ConcurrencyTuner::~ConcurrencyTuner() {}
+
+void ConcurrencyTuner::reset(const Options* options, std::shared_ptr<SliceManager> slice_manager) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  options_ = options;
+  slice_manager_ = slice_manager;
+  enabled_ = options->adaptive_thread_num;
+  min_num_ = enabled_ ? options->min_thread_num : options->thread_num;
+  max_num_ = enabled_ ? options->max_thread_num : options->thread_num;
+  direction_ = 1;
+  stable_times_ = 0;
+  last_throughput_ = -1;
+  last_download_ = slice_manager->downloadedBytes();
+  time_meter_.Restart();
+
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.connections = std::min(std::max(options->thread_num, min_num_), max_num_);
+  stats_.best_connections = stats_.connections;
+}
+
+int32_t ConcurrencyTuner::target() const {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return stats_.connections;
+}
+
+void ConcurrencyTuner::onTick(int32_t active, bool paused) {
+  if (!enabled_)
+    return;
+
+  const long elapsed = time_meter_.Elapsed();
+  if (elapsed < TUNE_INTERVAL_MS)
+    return;
+  time_meter_.Restart();
+
+  std::lock_guard<std::mutex> lg(mutex_);
+  const int64_t downloaded = slice_manager_->downloadedBytes();
+  const int64_t throughput = (downloaded - last_download_) * 1000 / elapsed;
+  last_download_ = downloaded;
+
+  // Only a sample taken with all of the target connections busy reflects the target,
+  // e.g. there may be no enough slices at the end of downloading.
+  if (paused || active < stats_.connections) {
+    last_throughput_ = -1;
+    return;
+  }
+
+  stats_.throughput = throughput;
+  if (throughput > stats_.best_throughput) {
+    stats_.best_throughput = throughput;
+    stats_.best_connections = stats_.connections;
+  }
+
+  if (last_throughput_ < 0) {
+    last_throughput_ = throughput;
+    move(direction_);
+    return;
+  }
+
+  const int64_t tolerance = last_throughput_ * TUNE_STABLE_PERCENT / 100;
+  if (throughput > last_throughput_ + tolerance) {
+    // The last change helped, keep going.
+    stable_times_ = 0;
+    move(direction_);
+  }
+  else if (throughput < last_throughput_ - tolerance) {
+    // The last change hurt, turn back.
+    stable_times_ = 0;
+    direction_ = -direction_;
+    move(direction_);
+  }
+  else if (++stable_times_ >= TUNE_PROBE_STABLE_TIMES) {
+    stable_times_ = 0;
+    direction_ = 1;
+    move(direction_);
+  }
+
+  last_throughput_ = throughput;
+}
+
+ConcurrencyStats ConcurrencyTuner::stats() const {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return stats_;
+}
+
+void ConcurrencyTuner::move(int32_t direction) {
+  // Grow quickly to find the bandwidth, shrink gently.
+  const int32_t step = std::max(1, direction > 0 ? stats_.connections / 2 : stats_.connections / 4);
+  const int32_t target = std::min(std::max(stats_.connections + direction * step, min_num_), max_num_);
+  if (target == stats_.connections)
+    return;
+
+  OutputVerbose(options_->verbose_functor,
+                "Adjust connections: %d -> %d, throughput: %" PRId64 " bytes/s.\n",
+                stats_.connections, target, stats_.throughput);
+
+  stats_.connections = target;
+  stats_.adjust_times++;
+}
+}  // namespace zoe
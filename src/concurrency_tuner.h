@@ -0,0 +1,68 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_CONCURRENCY_TUNER_H_
+#define ZOE_CONCURRENCY_TUNER_H_
+#pragma once
+
+#include <mutex>
+#include "zoe/zoe.h"
+#include "time_meter.hpp"
+#include "slice_manager.h"
+
+namespace zoe {
+typedef struct _Options Options;
+
+// Hill-climbing on the aggregate throughput: keep moving the number of connections in the
+// same direction while the throughput grows, turn back when it drops, and probe upward
+// again after the throughput has been stable for a while.
+class ConcurrencyTuner {
+ public:
+  ConcurrencyTuner();
+  virtual ~ConcurrencyTuner();
+
+  // Start a new download. If adaptive thread number is disabled, the target is fixed to
+  // Options::thread_num.
+  void reset(const Options* options, std::shared_ptr<SliceManager> slice_manager);
+
+  int32_t target() const;
+
+  // Called by the event loop with the number of running slices.
+  void onTick(int32_t active, bool paused);
+
+  ConcurrencyStats stats() const;
+
+ protected:
+  void move(int32_t direction);
+
+ protected:
+  mutable std::mutex mutex_;
+  ConcurrencyStats stats_;
+  const Options* options_;
+  std::shared_ptr<SliceManager> slice_manager_;
+  bool enabled_;
+  int32_t min_num_;
+  int32_t max_num_;
+  int32_t direction_;
+  int32_t stable_times_;
+  int64_t last_throughput_;  // -1 if there is no valid sample
+  int64_t last_download_;
+  TimeMeter time_meter_;
+};
+}  // namespace zoe
+#endif  // !ZOE_CONCURRENCY_TUNER_H_
@@ -0,0 +1,102 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "connection_quota.h"
+#include <assert.h>
+
+namespace zoe {
+ConnectionQuota::ConnectionQuota()
+    : active_connections_(0) {
+  max_connections_.store(-1);
+  max_connections_per_host_.store(-1);
+  max_speed_.store(-1);
+}
+
+ConnectionQuota::~ConnectionQuota() {
+  assert(active_connections_ == 0);
+}
+
+void ConnectionQuota::setMaxConnections(int32_t num) {
+  max_connections_.store(num);
+}
+
+int32_t ConnectionQuota::maxConnections() const {
+  return max_connections_.load();
+}
+
+void ConnectionQuota::setMaxConnectionsPerHost(int32_t num) {
+  max_connections_per_host_.store(num);
+}
+
+int32_t ConnectionQuota::maxConnectionsPerHost() const {
+  return max_connections_per_host_.load();
+}
+
+void ConnectionQuota::setMaxSpeed(int64_t byte_per_seconds) {
+  max_speed_.store(byte_per_seconds);
+}
+
+int64_t ConnectionQuota::maxSpeed() const {
+  return max_speed_.load();
+}
+
+bool ConnectionQuota::tryAcquire(const utf8string& host) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  const int32_t max_conn = max_connections_.load();
+  if (max_conn > 0 && active_connections_ >= max_conn)
+    return false;
+
+  const int32_t max_host_conn = max_connections_per_host_.load();
+  int32_t& host_conn = host_connections_[host];
+  if (max_host_conn > 0 && host_conn >= max_host_conn)
+    return false;
+
+  host_conn++;
+  active_connections_++;
+  return true;
+}
+
+void ConnectionQuota::release(const utf8string& host) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  auto it = host_connections_.find(host);
+  assert(it != host_connections_.end() && it->second > 0);
+  if (it == host_connections_.end() || it->second <= 0)
+    return;
+
+  if (--it->second == 0)
+    host_connections_.erase(it);
+  active_connections_--;
+}
+
+int32_t ConnectionQuota::activeConnections() const {
+  std::lock_guard<std::mutex> lg(mutex_);
+  return active_connections_;
+}
+
+int64_t ConnectionQuota::speedPerConnection() const {
+  const int64_t max_speed = max_speed_.load();
+  if (max_speed <= 0)
+    return -1;
+
+  int32_t active = activeConnections();
+  if (active <= 0)
+    active = 1;
+
+  const int64_t share = max_speed / active;
+  return (share > 0 ? share : 1);
+}
+}  // namespace zoe
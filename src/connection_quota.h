@@ -0,0 +1,63 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef ZOE_CONNECTION_QUOTA_H_
+#define ZOE_CONNECTION_QUOTA_H_
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include "zoe/zoe.h"
+
+namespace zoe {
+// Connection and bandwidth limits shared by all downloads of a scheduler, thread-safe.
+class ConnectionQuota {
+ public:
+  ConnectionQuota();
+  virtual ~ConnectionQuota();
+
+  // -1 means unlimited.
+  void setMaxConnections(int32_t num);
+  int32_t maxConnections() const;
+
+  void setMaxConnectionsPerHost(int32_t num);
+  int32_t maxConnectionsPerHost() const;
+
+  void setMaxSpeed(int64_t byte_per_seconds);
+  int64_t maxSpeed() const;
+
+  // Take a connection of |host|, return false if any limit is reached.
+  bool tryAcquire(const utf8string& host);
+  void release(const utf8string& host);
+
+  int32_t activeConnections() const;
+
+  // Bandwidth share of each active connection in bytes per second, -1 means unlimited.
+  int64_t speedPerConnection() const;
+
+ protected:
+  std::atomic<int32_t> max_connections_;
+  std::atomic<int32_t> max_connections_per_host_;
+  std::atomic<int64_t> max_speed_;
+
+  mutable std::mutex mutex_;
+  int32_t active_connections_;
+  std::map<utf8string, int32_t> host_connections_;
+};
+}  // namespace zoe
+#endif  // !ZOE_CONNECTION_QUOTA_H_
@@ -1,8 +1,37 @@
 #include "crc32.h"
 #include <stdlib.h>
 #include <stdint.h>
-#include "file_util.h"
-#include "options.h"
+#include <string.h>
+#include "hash_reader.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC32_TARGET_PCLMUL
+#else
+#include <cpuid.h>
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__linux__) || defined(__APPLE__))
+#define CRC32_ARM
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if defined(__clang__)
+#define CRC32_TARGET_ARM __attribute__((target("crc")))
+#else
+#define CRC32_TARGET_ARM __attribute__((target("+crc")))
+#endif
+#endif
 
 namespace zoe {
 namespace crc32_internal {
@@ -47,76 +76,289 @@ uint32_t crc32tab[] = {
     0xCDD70693L, 0x54DE5729L, 0x23D967BFL, 0xB3667A2EL, 0xC4614AB8L, 0x5D681B02L, 0x2A6F2B94L,
     0xB40BBE37L, 0xC30C8EA1L, 0x5A05DF1BL, 0x2D02EF8DL};
 
-void crc32Init(uint32_t* pCrc32) {
-  *pCrc32 = 0xFFFFFFFF;
+namespace {
+typedef uint32_t (*UpdateFunc)(uint32_t crc, const unsigned char* p, size_t n);
+
+// tables[k][b] is the CRC of byte b followed by k zero bytes, tables[0] is crc32tab.
+struct SliceTables {
+  uint32_t tables[16][256];
+
+  SliceTables() {
+    for (int i = 0; i < 256; i++)
+      tables[0][i] = crc32tab[i];
+    for (int k = 1; k < 16; k++) {
+      for (int i = 0; i < 256; i++)
+        tables[k][i] = (tables[k - 1][i] >> 8) ^ crc32tab[tables[k - 1][i] & 0xFF];
+    }
+  }
+};
+
+const SliceTables& GetSliceTables() {
+  static const SliceTables slice_tables;
+  return slice_tables;
 }
 
-void crc32Update(uint32_t* pCrc32, unsigned char* pData, uint32_t uSize) {
-  uint32_t i = 0;
+// Byte order independent, compilers turn it into a single load on little endian.
+inline uint32_t Load32(const unsigned char* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-  for (i = 0; i < uSize; i++)
-    *pCrc32 = ((*pCrc32) >> 8) ^ crc32tab[(pData[i]) ^ ((*pCrc32) & 0x000000FF)];
+uint32_t UpdateTable(uint32_t crc, const unsigned char* p, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    crc = (crc >> 8) ^ crc32tab[p[i] ^ (crc & 0x000000FF)];
+  return crc;
 }
 
-// Make the final adjustment
-void crc32Finish(uint32_t* pCrc32) {
-  *pCrc32 = ~(*pCrc32);
+uint32_t UpdateSliceBy8(uint32_t crc, const unsigned char* p, size_t n) {
+  const uint32_t(*t)[256] = GetSliceTables().tables;
+  while (n >= 8) {
+    const uint32_t one = Load32(p) ^ crc;
+    const uint32_t two = Load32(p + 4);
+    crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+          t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    p += 8;
+    n -= 8;
+  }
+  return UpdateTable(crc, p, n);
 }
-}  // namespace crc32_internal
 
-ZoeResult CalculateFileCRC32(const utf8string& file_path, Options* opt, utf8string& str_hash) {
-  FILE* f = FileUtil::Open(file_path, "rb");
-  if (!f)
-    return ZoeResult::CALCULATE_HASH_FAILED;
+uint32_t UpdateSliceBy16(uint32_t crc, const unsigned char* p, size_t n) {
+  const uint32_t(*t)[256] = GetSliceTables().tables;
+  while (n >= 16) {
+    const uint32_t one = Load32(p) ^ crc;
+    const uint32_t two = Load32(p + 4);
+    const uint32_t three = Load32(p + 8);
+    const uint32_t four = Load32(p + 12);
+    crc = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^ t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+          t[11][two & 0xFF] ^ t[10][(two >> 8) & 0xFF] ^ t[9][(two >> 16) & 0xFF] ^ t[8][two >> 24] ^
+          t[7][three & 0xFF] ^ t[6][(three >> 8) & 0xFF] ^ t[5][(three >> 16) & 0xFF] ^ t[4][three >> 24] ^
+          t[3][four & 0xFF] ^ t[2][(four >> 8) & 0xFF] ^ t[1][(four >> 16) & 0xFF] ^ t[0][four >> 24];
+    p += 16;
+    n -= 16;
+  }
+  return UpdateSliceBy8(crc, p, n);
+}
 
-  uint32_t ulCRC32 = 0;
-  crc32_internal::crc32Init(&ulCRC32);
+#if defined(CRC32_X86)
+bool DetectPclmul() {
+  unsigned int ecx = 0;
+#if defined(_MSC_VER)
+  int info[4] = {0};
+  __cpuid(info, 1);
+  ecx = (unsigned int)info[2];
+#else
+  unsigned int eax = 0, ebx = 0, edx = 0;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+#endif
+  const unsigned int pclmul = 1u << 1;
+  const unsigned int sse41 = 1u << 19;
+  return (ecx & pclmul) && (ecx & sse41);
+}
 
-  size_t dwReadBytes = 0;
-  unsigned char szData[1024] = {0};
+bool PclmulSupported() {
+  static const bool supported = DetectPclmul();
+  return supported;
+}
 
-  while ((dwReadBytes = fread(szData, 1, 1024, f)) > 0) {
-    if (opt && (opt->internal_stop_event.isSetted() || (opt->user_stop_event && opt->user_stop_event->isSetted()))) {
-      fclose(f);
-      return ZoeResult::CANCELED;
-    }
-    crc32_internal::crc32Update(&ulCRC32, szData, dwReadBytes);
+// Folds 64 bytes per step by carry-less multiplication, then reduces the 128 bits to the CRC by
+// Barrett reduction. See Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+// Instruction", the constants are for the bit-reflected polynomial 0xEDB88320.
+CRC32_TARGET_PCLMUL uint32_t UpdatePclmul(uint32_t crc, const unsigned char* p, size_t n) {
+  if (n < 64)
+    return UpdateSliceBy16(crc, p, n);
+
+  const size_t tail = n % 16;
+  n -= tail;
+
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+  const __m128i k5k0 = _mm_set_epi64x(0x0000000000LL, 0x0163cd6124LL);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m128i x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+  __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+  __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+  __m128i x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  p += 64;
+  n -= 64;
+
+  while (n >= 64) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(p + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(p + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(p + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(p + 0x30)));
+    p += 64;
+    n -= 64;
   }
-  fclose(f);
 
-  crc32_internal::crc32Finish(&ulCRC32);
+  // Fold the 4 lanes into one, then the remaining 16 byte blocks.
+  const __m128i lanes[3] = {x2, x3, x4};
+  for (int i = 0; i < 3; i++) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+  }
+  while (n >= 16) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)p)), x5);
+    p += 16;
+    n -= 16;
+  }
+
+  // 128 bits to 64 bits.
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits.
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  crc = (uint32_t)_mm_extract_epi32(x1, 1);
 
-  char szCRC[10] = {0};
-  snprintf(szCRC, sizeof(szCRC), "%08x", ulCRC32);
-  str_hash = szCRC;
-  return ZoeResult::SUCCESSED;
+  return UpdateSliceBy16(crc, p, tail);
 }
+#endif
 
-ZoeResult CalculateFileCRC32(FILE* f, Options* opt, utf8string& str_hash) {
-  if (!f)
-    return ZoeResult::CALCULATE_HASH_FAILED;
+#if defined(CRC32_ARM)
+bool ArmCrcSupported() {
+#if defined(__APPLE__)
+  return true;  // all Apple ARM64 CPUs
+#else
+  static const bool supported = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+  return supported;
+#endif
+}
 
-  FileUtil::Seek(f, 0L, SEEK_SET);
+CRC32_TARGET_ARM uint32_t UpdateArmCrc(uint32_t crc, const unsigned char* p, size_t n) {
+  while (n > 0 && ((uintptr_t)p & 7)) {
+    crc = __crc32b(crc, *p++);
+    n--;
+  }
+  while (n >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    crc = __crc32d(crc, v);
+    p += 8;
+    n -= 8;
+  }
+  while (n > 0) {
+    crc = __crc32b(crc, *p++);
+    n--;
+  }
+  return crc;
+}
+#endif
 
-  uint32_t ulCRC32 = 0;
-  crc32_internal::crc32Init(&ulCRC32);
+UpdateFunc KernelFunc(Crc32Kernel kernel) {
+  switch (kernel) {
+    case Crc32Kernel::Table:
+      return UpdateTable;
+    case Crc32Kernel::SliceBy8:
+      return UpdateSliceBy8;
+    case Crc32Kernel::SliceBy16:
+      return UpdateSliceBy16;
+#if defined(CRC32_X86)
+    case Crc32Kernel::Pclmul:
+      return (PclmulSupported() ? UpdatePclmul : nullptr);
+#endif
+#if defined(CRC32_ARM)
+    case Crc32Kernel::ArmCrc:
+      return (ArmCrcSupported() ? UpdateArmCrc : nullptr);
+#endif
+    default:
+      return nullptr;
+  }
+}
 
-  size_t dwReadBytes = 0;
-  unsigned char szData[1024] = {0};
+Crc32Kernel SelectKernel() {
+  if (KernelFunc(Crc32Kernel::Pclmul))
+    return Crc32Kernel::Pclmul;
+  if (KernelFunc(Crc32Kernel::ArmCrc))
+    return Crc32Kernel::ArmCrc;
+  return Crc32Kernel::SliceBy16;
+}
 
-  while ((dwReadBytes = fread(szData, 1, 1024, f)) > 0) {
-    if (opt && (opt->internal_stop_event.isSetted() ||
-                (opt->user_stop_event && opt->user_stop_event->isSetted()))) {
-      return ZoeResult::CANCELED;
-    }
-    crc32_internal::crc32Update(&ulCRC32, szData, dwReadBytes);
+struct SelectedKernel {
+  Crc32Kernel kernel;
+  UpdateFunc func;
+
+  SelectedKernel() : kernel(SelectKernel()), func(KernelFunc(kernel)) {}
+};
+
+const SelectedKernel& GetSelectedKernel() {
+  static const SelectedKernel selected;
+  return selected;
+}
+}  // namespace
+
+void crc32Init(uint32_t* pCrc32) {
+  *pCrc32 = 0xFFFFFFFF;
+}
+
+void crc32Update(uint32_t* pCrc32, unsigned char* pData, uint32_t uSize) {
+  *pCrc32 = GetSelectedKernel().func(*pCrc32, pData, uSize);
+}
+
+bool crc32KernelSupported(Crc32Kernel kernel) {
+  return KernelFunc(kernel) != nullptr;
+}
+
+Crc32Kernel crc32SelectedKernel() {
+  return GetSelectedKernel().kernel;
+}
+
+const char* crc32KernelName(Crc32Kernel kernel) {
+  switch (kernel) {
+    case Crc32Kernel::Table:
+      return "table";
+    case Crc32Kernel::SliceBy8:
+      return "slice-by-8";
+    case Crc32Kernel::SliceBy16:
+      return "slice-by-16";
+    case Crc32Kernel::Pclmul:
+      return "pclmul";
+    case Crc32Kernel::ArmCrc:
+      return "armv8-crc";
+    default:
+      return "unknown";
   }
+}
+
+void crc32UpdateByKernel(Crc32Kernel kernel, uint32_t* pCrc32, const unsigned char* pData, size_t uSize) {
+  const UpdateFunc func = KernelFunc(kernel);
+  if (func)
+    *pCrc32 = func(*pCrc32, pData, uSize);
+}
+
+// Make the final adjustment
+void crc32Finish(uint32_t* pCrc32) {
+  *pCrc32 = ~(*pCrc32);
+}
+}  // namespace crc32_internal
 
-  crc32_internal::crc32Finish(&ulCRC32);
+ZoeResult CalculateFileCRC32(const utf8string& file_path, Options* opt, utf8string& str_hash) {
+  return HashReader::HashFile(file_path, HashType::CRC32, opt, str_hash);
+}
 
-  char szCRC[10] = {0};
-  snprintf(szCRC, sizeof(szCRC), "%08x", ulCRC32);
-  str_hash = szCRC;
-  return ZoeResult::SUCCESSED;
+ZoeResult CalculateFileCRC32(FILE* f, Options* opt, utf8string& str_hash) {
+  return HashReader::HashFile(f, HashType::CRC32, opt, str_hash);
 }
 }  // namespace zoe
\ No newline at end of file
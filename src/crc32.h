@@ -21,9 +21,27 @@
 namespace zoe {
 typedef struct _Options Options;
 namespace crc32_internal {
+// All kernels give the same result, they differ in speed only.
+enum class Crc32Kernel {
+  Table = 0,  // one byte per step
+  SliceBy8,
+  SliceBy16,
+  Pclmul,  // x86 carry-less multiplication folding, needs PCLMULQDQ and SSE4.1
+  ArmCrc,  // ARMv8 CRC32 instructions
+  KernelNum
+};
+
 void crc32Init(uint32_t* pCrc32);
+// Uses the fastest kernel supported by the CPU, it is detected once at the first call.
 void crc32Update(uint32_t* pCrc32, unsigned char* pData, uint32_t uSize);
 void crc32Finish(uint32_t* pCrc32);
+
+bool crc32KernelSupported(Crc32Kernel kernel);
+Crc32Kernel crc32SelectedKernel();
+const char* crc32KernelName(Crc32Kernel kernel);
+
+// Update by the given kernel, which must be supported.
+void crc32UpdateByKernel(Crc32Kernel kernel, uint32_t* pCrc32, const unsigned char* pData, size_t uSize);
 }  // namespace crc32_internal
 
 ZoeResult CalculateFileCRC32(const utf8string& file_path, Options* opt, utf8string& str_hash);
@@ -16,7 +16,10 @@
 ******************************************************************************/
 
 #include "curl_utils.h"
+#include <vector>
+#include <mutex>
 #include "curl/curl.h"
+#include "string_helper.hpp"
 #ifdef WITH_OPENSSL
 #include <openssl/crypto.h>
 #endif
@@ -79,6 +82,50 @@ int THREAD_cleanup(void) {
   return 1;
 }
 #endif
+
+// Idle easy handles kept in the pool at most.
+#define MAX_IDLE_EASY_HANDLES 64
+
+CURLSH* share_handle = NULL;
+std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+
+std::mutex pool_mutex;
+std::vector<CURL*> idle_handles;
+
+void share_lock_function(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+  share_mutexes[data].lock();
+}
+
+void share_unlock_function(CURL* handle, curl_lock_data data, void* userptr) {
+  share_mutexes[data].unlock();
+}
+
+// Connection cache is not shared here, libcurl does not support using a shared connection cache
+// from concurrent threads. Connections are reused by the transfers of the same multi handle.
+void SHARE_setup(void) {
+  share_handle = curl_share_init();
+  if (!share_handle)
+    return;
+  curl_share_setopt(share_handle, CURLSHOPT_LOCKFUNC, share_lock_function);
+  curl_share_setopt(share_handle, CURLSHOPT_UNLOCKFUNC, share_unlock_function);
+  curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+void SHARE_cleanup(void) {
+  std::vector<CURL*> handles;
+  {
+    std::lock_guard<std::mutex> lg(pool_mutex);
+    handles.swap(idle_handles);
+  }
+  for (auto curl : handles)
+    curl_easy_cleanup(curl);
+
+  if (share_handle) {
+    curl_share_cleanup(share_handle);
+    share_handle = NULL;
+  }
+}
 }  // namespace
 
 void GlobalCurlInit() {
@@ -86,12 +133,81 @@ void GlobalCurlInit() {
   THREAD_setup();
 #endif
   curl_global_init(CURL_GLOBAL_ALL);
+  SHARE_setup();
 }
 
 void GlobalCurlUnInit() {
+  SHARE_cleanup();
   curl_global_cleanup();
 #ifdef WITH_OPENSSL
   THREAD_cleanup();
 #endif
 }
+
+CURL* AcquireEasyHandle() {
+  {
+    std::lock_guard<std::mutex> lg(pool_mutex);
+    if (!idle_handles.empty()) {
+      CURL* curl = idle_handles.back();
+      idle_handles.pop_back();
+      return curl;
+    }
+  }
+
+  CURL* curl = curl_easy_init();
+  if (curl && share_handle)
+    curl_easy_setopt(curl, CURLOPT_SHARE, share_handle);
+  return curl;
+}
+
+void ReleaseEasyHandle(CURL* curl) {
+  if (!curl)
+    return;
+
+  // The share handle is kept by curl_easy_reset.
+  curl_easy_reset(curl);
+
+  {
+    std::lock_guard<std::mutex> lg(pool_mutex);
+    if (share_handle && idle_handles.size() < MAX_IDLE_EASY_HANDLES) {
+      idle_handles.push_back(curl);
+      return;
+    }
+  }
+  curl_easy_cleanup(curl);
+}
+
+CURLcode SetHttpVersion(CURL* curl, HttpVersionPolicy policy) {
+  long version = CURL_HTTP_VERSION_NONE;
+  if (policy == HttpVersionPolicy::Http1)
+    version = CURL_HTTP_VERSION_1_1;
+  else if (policy == HttpVersionPolicy::Http2)
+    version = CURL_HTTP_VERSION_2TLS;
+  else if (policy == HttpVersionPolicy::Http2PriorKnowledge)
+    version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+
+  CURLcode code = curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, version);
+  if (code != CURLE_OK)
+    return code;
+
+  const bool multiplex = (policy == HttpVersionPolicy::Http2 || policy == HttpVersionPolicy::Http2PriorKnowledge);
+  return curl_easy_setopt(curl, CURLOPT_PIPEWAIT, multiplex ? 1L : 0L);
+}
+
+std::string GetUrlHost(const std::string& url) {
+  std::string host;
+  CURLU* h = curl_url();
+  if (!h)
+    return host;
+
+  char* part = nullptr;
+  if (curl_url_set(h, CURLUPART_URL, url.c_str(), CURLU_DEFAULT_SCHEME) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_HOST, &part, 0) == CURLUE_OK && part) {
+    host = StringHelper::ToLower(part);
+    curl_free(part);
+  }
+
+  curl_url_cleanup(h);
+  return host;
+}
 }  // namespace zoe
@@ -19,12 +19,33 @@
 #define ZOE_CURL_UTILS_H_
 #pragma once
 
+#include <string>
 #include "curl/curl.h"
+#include "zoe/zoe.h"
 
 namespace zoe {
 void GlobalCurlInit();
 void GlobalCurlUnInit();
 
+// Easy handles are pooled process-wide. Handles got from the pool share the DNS cache and TLS
+// sessions of all downloads, release them back instead of calling curl_easy_cleanup.
+CURL* AcquireEasyHandle();
+void ReleaseEasyHandle(CURL* curl);
+
+// Set the HTTP version of |curl| by |policy|. For HTTP/2, the transfer waits for an existing
+// connection to multiplex on, rather than opening a new one.
+CURLcode SetHttpVersion(CURL* curl, HttpVersionPolicy policy);
+
+// Return lowercase host name of |url|, or empty string if |url| can not be parsed.
+std::string GetUrlHost(const std::string& url);
+
+// Receives the completion of easy handles whose CURLOPT_PRIVATE points to it.
+class TransferObserver {
+ public:
+  virtual ~TransferObserver() {}
+  virtual void onTransferDone(CURL* curl, CURLcode result) = 0;
+};
+
 class ScopedCurl {
  public:
   ScopedCurl() {
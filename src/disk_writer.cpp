@@ -0,0 +1,221 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "disk_writer.h"
+#include <assert.h>
+#include <algorithm>
+#include "buffer_pool.h"
+
+// Queued writes taken by one batch of the backend.
+#define DISK_WRITER_MAX_BATCH 16
+
+namespace zoe {
+DiskWriter::DiskWriter(int32_t thread_num)
+    : thread_num_(std::max(thread_num, 1))
+    , next_worker_(0) {
+}
+
+DiskWriter::~DiskWriter() {
+  for (auto& worker : workers_) {
+    {
+      std::lock_guard<std::mutex> lg(worker->mutex);
+      worker->quit = true;
+    }
+    worker->cond.notify_one();
+  }
+
+  for (auto& worker : workers_) {
+    if (worker->thread.joinable())
+      worker->thread.join();
+  }
+}
+
+DiskWriter* DiskWriter::Global() {
+  // The buffers are returned to the pool by the threads, so the pool is destroyed later.
+  BufferPool::Global();
+  static DiskWriter writer(ZOE_DEFAULT_DISK_WRITER_POOL_THREAD_NUM);
+  return &writer;
+}
+
+void DiskWriter::setThreadNum(int32_t thread_num) {
+  std::lock_guard<std::mutex> lg(workers_mutex_);
+  thread_num_ = std::max(thread_num, 1);
+}
+
+int32_t DiskWriter::threadNum() const {
+  std::lock_guard<std::mutex> lg(workers_mutex_);
+  return thread_num_;
+}
+
+void DiskWriter::waitUntil(const std::function<bool()>& done) {
+  std::unique_lock<std::mutex> ul(done_mutex_);
+  done_cond_.wait(ul, done);
+}
+
+DiskWriter::Worker* DiskWriter::worker(int32_t index) {
+  std::lock_guard<std::mutex> lg(workers_mutex_);
+  while ((int32_t)workers_.size() <= index) {
+    std::unique_ptr<Worker> worker(new Worker());
+    worker->thread = std::thread(&DiskWriter::workerProc, this, worker.get());
+    workers_.push_back(std::move(worker));
+  }
+  return workers_[(size_t)index].get();
+}
+
+int32_t DiskWriter::nextWorkerIndex() {
+  std::lock_guard<std::mutex> lg(workers_mutex_);
+  const int32_t index = next_worker_ % thread_num_;
+  next_worker_ = index + 1;
+  return index;
+}
+
+void DiskWriter::workerProc(Worker* worker) {
+  std::vector<WriteItem> items;
+  std::vector<FileIoRequest> requests;
+  items.reserve(DISK_WRITER_MAX_BATCH);
+  requests.reserve(DISK_WRITER_MAX_BATCH);
+
+  while (true) {
+    items.clear();
+    Lane* lane = nullptr;
+    {
+      std::unique_lock<std::mutex> ul(worker->mutex);
+      worker->cond.wait(ul, [worker]() { return worker->quit || !worker->ready.empty(); });
+      // Drain the queues before quitting.
+      if (worker->ready.empty())
+        break;
+      lane = worker->ready.front();
+      worker->ready.pop_front();
+      while (!lane->items.empty() && items.size() < DISK_WRITER_MAX_BATCH) {
+        items.push_back(lane->items.front());
+        lane->items.pop_front();
+      }
+    }
+
+    // Consecutive writes of the same file are submitted together.
+    requests.resize(items.size());
+    size_t begin = 0;
+    while (begin < items.size()) {
+      size_t end = begin;
+      for (; end < items.size() && items[end].target_file == items[begin].target_file; end++) {
+        FileIoRequest request = {true, items[end].pos, items[end].buffer + items[end].offset, items[end].data_size, -1, 0L};
+        requests[end] = request;
+      }
+
+      if (items[begin].target_file)
+        items[begin].target_file->performBatch(&requests[begin], (int32_t)(end - begin));
+      begin = end;
+    }
+
+    // The observers checksum the written data, so it is not done under done_mutex_.
+    int64_t written_bytes = 0L;
+    for (size_t i = 0; i < items.size(); i++) {
+      items[i].observer->onDiskWritten(items[i].buffer + items[i].offset, items[i].data_size, requests[i].result);
+      BufferPool::Global()->release(items[i].buffer, items[i].buffer_size);
+      written_bytes += items[i].data_size;
+    }
+    items.clear();  // the files may be closed once the queue is drained
+
+    {
+      // Take turns with the other queues of this thread.
+      std::lock_guard<std::mutex> lg(worker->mutex);
+      if (!lane->items.empty())
+        worker->ready.push_back(lane);
+      else
+        lane->scheduled = false;
+    }
+
+    {
+      // The waiters check the results under done_mutex_. The queue may be destroyed once
+      // its bytes are zero, it is not touched afterwards.
+      std::lock_guard<std::mutex> lg(done_mutex_);
+      lane->queue->queued_bytes_ -= written_bytes;
+    }
+    done_cond_.notify_all();
+  }
+}
+
+DiskWriteQueue::DiskWriteQueue(int32_t thread_num, int64_t max_queued_bytes)
+    : writer_(DiskWriter::Global())
+    , max_queued_bytes_(max_queued_bytes) {
+  queued_bytes_.store(0L);
+
+  const int32_t pool_thread_num = writer_->threadNum();
+  const int32_t lane_num = std::min(std::max(thread_num, 1), pool_thread_num);
+  const int32_t first = writer_->nextWorkerIndex();
+  for (int32_t i = 0; i < lane_num; i++) {
+    std::unique_ptr<DiskWriter::Lane> lane(new DiskWriter::Lane());
+    lane->queue = this;
+    lane->worker = writer_->worker((first + i) % pool_thread_num);
+    lanes_.push_back(std::move(lane));
+  }
+}
+
+DiskWriteQueue::~DiskWriteQueue() {
+  waitUntil([this]() { return queued_bytes_.load() == 0; });
+}
+
+void DiskWriteQueue::submit(int32_t key,
+                            std::shared_ptr<TargetFile> target_file,
+                            int64_t pos,
+                            char* buffer,
+                            int64_t buffer_size,
+                            int64_t offset,
+                            int64_t data_size,
+                            DiskWriteObserver* observer) {
+  assert(buffer && observer);
+  DiskWriter::Lane* lane = lanes_[(size_t)(key < 0 ? -key : key) % lanes_.size()].get();
+  DiskWriter::Worker* worker = lane->worker;
+
+  DiskWriter::WriteItem item;
+  item.target_file = target_file;
+  item.pos = pos;
+  item.buffer = buffer;
+  item.buffer_size = buffer_size;
+  item.offset = offset;
+  item.data_size = data_size;
+  item.observer = observer;
+
+  queued_bytes_ += data_size;
+  bool notify = false;
+  {
+    std::lock_guard<std::mutex> lg(worker->mutex);
+    lane->items.push_back(item);
+    if (!lane->scheduled) {
+      lane->scheduled = true;
+      worker->ready.push_back(lane);
+      notify = true;
+    }
+  }
+  if (notify)
+    worker->cond.notify_one();
+}
+
+bool DiskWriteQueue::full() const {
+  const int64_t queued = queued_bytes_.load();
+  return (queued > 0 && queued >= max_queued_bytes_);
+}
+
+int64_t DiskWriteQueue::queuedBytes() const {
+  return queued_bytes_.load();
+}
+
+void DiskWriteQueue::waitUntil(const std::function<bool()>& done) {
+  writer_->waitUntil(done);
+}
+}  // namespace zoe
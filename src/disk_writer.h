@@ -0,0 +1,151 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_DISK_WRITER_H_
+#define ZOE_DISK_WRITER_H_
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include "target_file.h"
+
+// Default thread number of the process-wide writer.
+#define ZOE_DEFAULT_DISK_WRITER_POOL_THREAD_NUM 4
+
+namespace zoe {
+class DiskWriteQueue;
+
+// Receives the result of a queued write on the I/O thread.
+class DiskWriteObserver {
+ public:
+  virtual ~DiskWriteObserver() {}
+  // |data| is the written buffer, it is released after this call.
+  virtual void onDiskWritten(const char* data, int64_t data_size, int64_t written) = 0;
+};
+
+// I/O threads shared by all downloads, they write the received buffers to the temporary files,
+// so a slow disk does not stall the network callbacks of the event loops.
+// The writes are submitted through a DiskWriteQueue per file. A thread takes turns between the
+// queues that have writes for it, a busy file does not starve the others.
+class DiskWriter {
+ public:
+  explicit DiskWriter(int32_t thread_num);
+  virtual ~DiskWriter();  // the queues must have been destroyed
+
+  // Shared by all Zoe instances.
+  static DiskWriter* Global();
+
+  // The threads are started on demand. A smaller number takes effect on the queues created
+  // afterwards, the started threads are kept.
+  void setThreadNum(int32_t thread_num);
+  int32_t threadNum() const;
+
+  // Block until |done| returns true, |done| is checked after each batch of writes.
+  void waitUntil(const std::function<bool()>& done);
+
+ protected:
+  friend class DiskWriteQueue;
+
+  struct WriteItem {
+    std::shared_ptr<TargetFile> target_file;
+    int64_t pos;
+    char* buffer;
+    int64_t buffer_size;
+    int64_t offset;
+    int64_t data_size;
+    DiskWriteObserver* observer;
+  };
+
+  struct Worker;
+
+  // Writes of one queue done by one thread, in the submitted order.
+  struct Lane {
+    DiskWriteQueue* queue = nullptr;
+    Worker* worker = nullptr;
+    std::deque<WriteItem> items;  // guarded by the mutex of |worker|
+    bool scheduled = false;       // in Worker::ready or being written
+  };
+
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Lane*> ready;
+    bool quit = false;
+  };
+
+  // Start the threads up to |index| if needed.
+  Worker* worker(int32_t index);
+  // The first thread used by the next queue, the queues are spread over the threads.
+  int32_t nextWorkerIndex();
+
+  void workerProc(Worker* worker);
+
+ protected:
+  mutable std::mutex workers_mutex_;
+  int32_t thread_num_;
+  int32_t next_worker_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex done_mutex_;
+  std::condition_variable done_cond_;
+};
+
+// The writes of one download, done by the threads of DiskWriter::Global().
+// Writes with the same key are done by the same thread in the submitted order.
+class DiskWriteQueue {
+ public:
+  // Spread over |thread_num| threads at most. |max_queued_bytes| is a soft limit, see full().
+  DiskWriteQueue(int32_t thread_num, int64_t max_queued_bytes);
+  virtual ~DiskWriteQueue();  // waits for the queued writes
+
+  // Take the ownership of |buffer| that borrowed from BufferPool::Global() by |buffer_size|,
+  // write |data_size| bytes from |buffer| + |offset| at |pos| of |target_file|.
+  // |observer| must be alive until it is notified.
+  void submit(int32_t key,
+              std::shared_ptr<TargetFile> target_file,
+              int64_t pos,
+              char* buffer,
+              int64_t buffer_size,
+              int64_t offset,
+              int64_t data_size,
+              DiskWriteObserver* observer);
+
+  // The producers should stop submitting, a buffer is always accepted if the queue is empty.
+  bool full() const;
+  int64_t queuedBytes() const;
+
+  // See DiskWriter::waitUntil.
+  void waitUntil(const std::function<bool()>& done);
+
+ protected:
+  friend class DiskWriter;
+
+  DiskWriter* writer_;
+  int64_t max_queued_bytes_;
+  std::atomic<int64_t> queued_bytes_;  // decreased under DiskWriter::done_mutex_
+  std::vector<std::unique_ptr<DiskWriter::Lane>> lanes_;
+};
+}  // namespace zoe
+#endif  // !ZOE_DISK_WRITER_H_
@@ -45,15 +45,30 @@ EntryHandler::EntryHandler()
     : options_(nullptr)
     , slice_manager_(nullptr)
     , progress_handler_(nullptr)
+    , speed_handler_(nullptr)
+    , loop_(nullptr)
     , multi_(nullptr)
-    , speed_handler_(nullptr) {
+    , quota_(nullptr)
+    , stage_(Stage::FetchingInfo)
+    , result_(ZoeResult::SUCCESSED)
+    , fetch_curl_(nullptr)
+    , fetch_header_chunk_(nullptr)
+    , fetch_try_times_(0)
+    , running_slices_(0)
+    , new_connections_(0)
+    , paused_applied_(false)
+    , write_paused_(false)
+    , refetched_(false) {
   user_paused_.store(false);
   state_.store(DownloadState::Stopped);
 }
 
 EntryHandler::~EntryHandler() {
   if (async_task_.valid())
-    async_task_.get();
+    async_task_.wait();
+
+  if (loop_task_.valid())
+    loop_task_.wait();
 }
 
 static size_t __WriteBodyCallback(char* buffer,
@@ -103,10 +118,34 @@ static size_t __WriteHeaderCallback(char* buffer,
   return total;
 }
 
-std::shared_future<ZoeResult> EntryHandler::start(Options* options) {
+std::shared_future<ZoeResult> EntryHandler::start(Options* options, JobScheduler* scheduler) {
   options_ = options;
-  async_task_ = std::async(std::launch::async,
-                           std::bind(&EntryHandler::asyncTaskProcess, this));
+  options_->internal_stop_event.unset();
+  user_paused_.store(false);
+  state_.store(DownloadState::Downloading);
+
+  promise_ = std::promise<ZoeResult>();
+  async_task_ = promise_.get_future().share();
+
+  if (scheduler) {
+    quota_ = scheduler->quota();
+    if (!scheduler->submit(this)) {
+      OutputVerbose(options_->verbose_functor, "Scheduler has no available event loop.\n");
+      complete(ZoeResult::INIT_CURL_MULTI_FAILED);
+    }
+    return async_task_;
+  }
+
+  std::shared_ptr<EventLoop> loop = std::make_shared<EventLoop>(options_->event_engine);
+  if (!loop->init()) {
+    OutputVerbose(options_->verbose_functor, "curl_multi_init failed.\n");
+    complete(ZoeResult::INIT_CURL_MULTI_FAILED);
+    return async_task_;
+  }
+
+  loop->addJob(this);
+  loop_task_ = std::async(std::launch::async, [loop]() { loop->run(true); });
+
   return async_task_;
 }
 
@@ -147,13 +186,16 @@ std::shared_future<ZoeResult> EntryHandler::futureResult() {
   return async_task_;
 }
 
-ZoeResult EntryHandler::asyncTaskProcess() {
-  options_->internal_stop_event.unset();
-  user_paused_.store(false);
-  state_.store(DownloadState::Downloading);
+ConcurrencyStats EntryHandler::concurrencyStats() const {
+  return tuner_.stats();
+}
 
-  const ZoeResult ret = _asyncTaskProcess();
+bool EntryHandler::isStopRequested() const {
+  return (options_->internal_stop_event.isSetted() ||
+          (options_->user_stop_event && options_->user_stop_event->isSetted()));
+}
 
+void EntryHandler::complete(ZoeResult ret) {
   state_.store(DownloadState::Stopped);
 
   options_->internal_stop_event.set();
@@ -172,430 +214,751 @@ ZoeResult EntryHandler::asyncTaskProcess() {
   if (options_->result_functor)
     options_->result_functor(ret);
 
-  return ret;
+  // Must be the last one, the owner may destroy this object once the result is ready.
+  promise_.set_value(ret);
 }
 
-ZoeResult EntryHandler::_asyncTaskProcess() {
+void EntryHandler::onAttach(EventLoop* loop) {
+  loop_ = loop;
+  multi_ = loop->multi();
+  host_ = GetUrlHost(options_->url);
+
   OutputVerbose(options_->verbose_functor, "URL: %s.\n", options_->url.c_str());
   OutputVerbose(options_->verbose_functor, "Thread number: %d.\n", options_->thread_num);
-  OutputVerbose(options_->verbose_functor, "Disk Cache Size: %ld bytes.\n", options_->disk_cache_size);
+  OutputVerbose(options_->verbose_functor, "Disk Cache Size: %" PRId64 " bytes.\n", options_->disk_cache_size);
   OutputVerbose(options_->verbose_functor, "Target file path: %s.\n", options_->target_file_path.c_str());
+  const EventEngine engine = loop->engine();
+  OutputVerbose(options_->verbose_functor, "Event engine: %s.\n",
+                engine == EventEngine::Epoll ? "epoll" : (engine == EventEngine::External ? "external" : "select"));
 
   OutputVerbose(options_->verbose_functor, "Fetching file size...\n");
-  FileInfo file_info;
-  bool fetch_size_ret = false;
-  int32_t try_times = 0;
-  do {
-    fetch_size_ret = fetchFileInfo(file_info);
-    if (fetch_size_ret)
-      break;
-    if (options_->internal_stop_event.isSetted() || (options_->user_stop_event && options_->user_stop_event->isSetted()))
+  stage_ = Stage::FetchingInfo;
+}
+
+bool EntryHandler::onTick() {
+  switch (stage_) {
+    case Stage::FetchingInfo:
+      return tickFetchingInfo();
+    case Stage::Validating:
+      return tickValidating();
+    case Stage::Downloading:
+      return tickDownloading();
+    case Stage::Finishing:
+      return tickFinishing();
+    default:
       break;
+  }
+  return false;
+}
+
+int32_t EntryHandler::maxWaitMs() const {
+  // Poll the result of validating or finishing task frequently, there is no network event to wake
+  // up the loop. So are the slices paused by a full write queue, or waiting for their queued writes.
+  return ((stage_ == Stage::Validating || stage_ == Stage::Finishing || write_paused_ || !draining_.empty()) ? 10 : 100);
+}
+
+void EntryHandler::onDetach() {
+  assert(!fetch_curl_ && running_slices_ == 0);
+  loop_ = nullptr;
+  multi_ = nullptr;
+  complete(result_);
+}
+
+void EntryHandler::cancel() {
+  stop();
+}
+
+void EntryHandler::onTransferDone(CURL* curl, CURLcode result) {
+  assert(curl == fetch_curl_);
+  if (curl != fetch_curl_)
+    return;
+
+  countNewConnections(curl);
+  const bool fetch_ret = parseFetchFileInfo(result);
+  cleanupFetchFileInfo();
+
+  if (fetch_ret) {
+    onFileInfoFetched();
+    return;
+  }
+
+  if (isStopRequested())
+    return;  // handled in next tick
+
+  if (++fetch_try_times_ <= options_->fetch_file_info_retry) {
+    OutputVerbose(options_->verbose_functor, "Fetching file size failed, retry...\n");
+    file_info_.clear();
+    return;
+  }
+
+  OutputVerbose(options_->verbose_functor, "Fetch file size failed.\n");
+  result_ = ZoeResult::FETCH_FILE_INFO_FAILED;
+  stage_ = Stage::Finished;
+}
+
+bool EntryHandler::tickFetchingInfo() {
+  if (isStopRequested()) {
+    cleanupFetchFileInfo();
+    result_ = ZoeResult::CANCELED;
+    return false;
+  }
+
+  if (fetch_curl_)
+    return true;  // in progress
+
+  if (quota_ && !quota_->tryAcquire(host_))
+    return true;  // wait for a free connection
+
+  if (!startFetchFileInfo()) {
+    if (quota_)
+      quota_->release(host_);
+
+    if (++fetch_try_times_ > options_->fetch_file_info_retry) {
+      OutputVerbose(options_->verbose_functor, "Fetch file size failed.\n");
+      result_ = ZoeResult::FETCH_FILE_INFO_FAILED;
+      return false;
+    }
     OutputVerbose(options_->verbose_functor, "Fetching file size failed, retry...\n");
-  } while (++try_times <= options_->fetch_file_info_retry);
+  }
+
+  return true;
+}
+
+bool EntryHandler::startFetchFileInfo() {
+  assert(!fetch_curl_ && !fetch_header_chunk_);
+  CURL* curl = AcquireEasyHandle();
+  if (!curl)
+    return false;
+
+  file_info_.clear();
+
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L));
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L));
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_URL, options_->url.c_str()));
+  if (options_->use_head_method_fetch_file_info)
+    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_NOBODY, 1L));
+  else
+    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_NOBODY, 0L));
+
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L));
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, options_->verify_peer_host ? 2L : 0L));
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, options_->verify_peer_certificate ? 1L : 0L));
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, options_->network_conn_timeout));
+  CHECK_SETOPT2(SetHttpVersion(curl, options_->http_version_policy));
+
+  if (options_->verify_peer_certificate && options_->ca_path.length() > 0)
+    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_CAINFO, options_->ca_path.c_str()));
+
+  // avoid libcurl failed with "Failed writing body".
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, __WriteBodyCallback));
+
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, __WriteHeaderCallback));
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*)&file_info_));
+
+  if (options_->proxy.length() > 0) {
+    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_PROXY, options_->proxy.c_str()));
+  }
+
+  if (options_->cookie_list.length() > 0) {
+    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_COOKIELIST, options_->cookie_list.c_str()));
+  }
+
+  const HttpHeaders& headers = options_->http_headers;
+  if (headers.size() > 0) {
+    for (const auto& it : headers) {
+      utf8string headerStr = it.first + ": " + it.second;
+      fetch_header_chunk_ = curl_slist_append(fetch_header_chunk_, headerStr.c_str());
+    }
+    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, fetch_header_chunk_));
+  }
+
+  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_PRIVATE, (void*)static_cast<TransferObserver*>(this)));
+
+  fetch_curl_ = curl;
+  if (curl_multi_add_handle(multi_, curl) != CURLM_OK) {
+    fetch_curl_ = nullptr;
+    if (fetch_header_chunk_) {
+      curl_slist_free_all(fetch_header_chunk_);
+      fetch_header_chunk_ = nullptr;
+    }
+    ReleaseEasyHandle(curl);
+    return false;
+  }
 
-  if (options_->internal_stop_event.isSetted() || (options_->user_stop_event && options_->user_stop_event->isSetted())) {
-    return ZoeResult::CANCELED;
+  return true;
+}
+
+bool EntryHandler::parseFetchFileInfo(CURLcode result) {
+  if (result != CURLE_OK) {
+    OutputVerbose(options_->verbose_functor,
+                  "curl_multi_perform failed, CURLcode: %ld(%s).\n",
+                  (long)result, curl_easy_strerror(result));
+    return false;
+  }
+
+  char* redirect_url = nullptr;
+  if (curl_easy_getinfo(fetch_curl_, CURLINFO_REDIRECT_URL, &redirect_url) == CURLE_OK && redirect_url) {
+    file_info_.redirectUrl = redirect_url;
+  }
+
+  CURLcode ret_code = CURLE_OK;
+  long http_code = 0;
+  if ((ret_code = curl_easy_getinfo(fetch_curl_, CURLINFO_RESPONSE_CODE, &http_code)) != CURLE_OK) {
+    OutputVerbose(
+        options_->verbose_functor,
+        "Get CURLINFO_RESPONSE_CODE failed, CURLcode: %ld(%s).\n",
+        (long)ret_code, curl_easy_strerror(ret_code));
+    return false;
+  }
+
+  if (http_code != 200 && http_code != 350) {
+    // A 350 response code is sent by the server in response to a file-related command that
+    // requires further commands in order for the operation to be completed
+    OutputVerbose(options_->verbose_functor,
+                  "HTTP response code error, code: %ld.\n",
+                  (long)http_code);
+    return false;
   }
 
-  if (!fetch_size_ret) {
-    OutputVerbose(options_->verbose_functor, "Fetch file size failed.\n");
-    return ZoeResult::FETCH_FILE_INFO_FAILED;
+  return true;
+}
+
+void EntryHandler::cleanupFetchFileInfo() {
+  if (!fetch_curl_)
+    return;
+
+  curl_multi_remove_handle(multi_, fetch_curl_);
+  ReleaseEasyHandle(fetch_curl_);
+  fetch_curl_ = nullptr;
+
+  if (fetch_header_chunk_) {
+    curl_slist_free_all(fetch_header_chunk_);
+    fetch_header_chunk_ = nullptr;
   }
 
-  OutputVerbose(options_->verbose_functor, "File size: %" PRId64 " bytes.\n", file_info.fileSize);
+  if (quota_)
+    quota_->release(host_);
+}
+
+void EntryHandler::onFileInfoFetched() {
+  stage_ = Stage::Finished;
+
+  OutputVerbose(options_->verbose_functor, "File size: %" PRId64 " bytes.\n", file_info_.fileSize);
+
+  // Nothing to deliver.
+  if (file_info_.fileSize == 0 && options_->stream_functor) {
+    result_ = ZoeResult::SUCCESSED;
+    return;
+  }
 
   // If target file is an empty file, create it.
-  if (file_info.fileSize == 0) {
-    return FileUtil::CreateFixedSizeFile(options_->target_file_path, 0)
-               ? ZoeResult::SUCCESSED
-               : ZoeResult::CREATE_TARGET_FILE_FAILED;
+  if (file_info_.fileSize == 0) {
+    result_ = FileUtil::CreateFixedSizeFile(options_->target_file_path, 0)
+                  ? ZoeResult::SUCCESSED
+                  : ZoeResult::CREATE_TARGET_FILE_FAILED;
+    return;
   }
 
-  OutputVerbose(options_->verbose_functor, "Content MD5: %s.\n", file_info.contentMd5.c_str());
-  OutputVerbose(options_->verbose_functor, "Redirect URL: %s.\n", file_info.redirectUrl.c_str());
+  OutputVerbose(options_->verbose_functor, "Content MD5: %s.\n", file_info_.contentMd5.c_str());
+  OutputVerbose(options_->verbose_functor, "Redirect URL: %s.\n", file_info_.redirectUrl.c_str());
 
   assert(!slice_manager_);
-  slice_manager_ = std::make_shared<SliceManager>(options_, file_info.redirectUrl);
+  slice_manager_ = std::make_shared<SliceManager>(options_, file_info_.redirectUrl);
+
+  // A stream always starts from the beginning.
+  if (!slice_manager_->isStream() &&
+      slice_manager_->loadExistSlice(file_info_.fileSize, file_info_.contentMd5) == ZoeResult::SUCCESSED) {
+    // Reading back the loaded data may take a long time, do not block the event loop.
+    std::shared_ptr<SliceManager> slice_manager = slice_manager_;
+    validate_task_ = std::async(std::launch::async, [slice_manager]() {
+      return slice_manager->validateExistSlices();
+    });
+    stage_ = Stage::Validating;
+    return;
+  }
 
-  if (slice_manager_->loadExistSlice(file_info.fileSize, file_info.contentMd5) != ZoeResult::SUCCESSED) {
-    slice_manager_->setOriginFileSize(file_info.fileSize);
-    slice_manager_->setContentMd5(file_info.contentMd5);
+  slice_manager_->setOriginFileSize(file_info_.fileSize);
+  slice_manager_->setContentMd5(file_info_.contentMd5);
 
-    const ZoeResult ms_ret = slice_manager_->makeSlices(file_info.acceptRanges);
-    if (ms_ret != ZoeResult::SUCCESSED) {
-      return ms_ret;
-    }
+  const ZoeResult ms_ret = slice_manager_->makeSlices(file_info_.acceptRanges);
+  if (ms_ret != ZoeResult::SUCCESSED) {
+    result_ = ms_ret;
+    return;
   }
 
+  startDownloading();
+}
+
+bool EntryHandler::tickValidating() {
+  if (validate_task_.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
+    return true;
+
+  validate_task_.get();
+  validate_task_ = std::shared_future<int32_t>();
+
+  // Stopped while validating, the index file records the slices reset so far.
+  if (isStopRequested()) {
+    startFinishing(true);
+    return true;
+  }
+
+  stage_ = Stage::Finished;
+  startDownloading();
+  return true;
+}
+
+void EntryHandler::startDownloading() {
   if (slice_manager_->originFileSize() != -1L && slice_manager_->checkAllSliceCompletedByFileSize() == ZoeResult::SUCCESSED) {
     OutputVerbose(options_->verbose_functor, "All of slices have been downloaded.\n");
-    return slice_manager_->finishDownloadProgress(false, multi_);
+    startFinishing(false);
+    return;
   }
 
-  multi_ = curl_multi_init();
-  if (!multi_) {
-    OutputVerbose(options_->verbose_functor, "curl_multi_init failed.\n");
-    return ZoeResult::INIT_CURL_MULTI_FAILED;
+  if (!hasPendingSlice()) {
+    OutputVerbose(options_->verbose_functor, "No available slice.\n");
+    result_ = ZoeResult::UNKNOWN_ERROR;
+    return;
   }
 
+  // Slices download from the redirected URL.
+  if (file_info_.redirectUrl.length() > 0)
+    host_ = GetUrlHost(file_info_.redirectUrl);
+
+  tuner_.reset(options_, slice_manager_);
+  if (options_->adaptive_thread_num)
+    OutputVerbose(options_->verbose_functor, "Adaptive thread number: %d ~ %d, initial: %d.\n",
+                  options_->min_thread_num, options_->max_thread_num, tuner_.target());
+
   int64_t disk_cache_per_slice = 0L;
   int64_t max_speed_per_slice = 0L;
   calculateSliceInfo(
-      std::min(slice_manager_->getUnfetchAndUncompletedSliceNum(), options_->thread_num),
+      std::min(tuner_.target(), slice_manager_->getUnfetchAndUncompletedSliceNum()),
       &disk_cache_per_slice, &max_speed_per_slice);
-
   OutputVerbose(options_->verbose_functor, "Disk cache per slice: %" PRId64 " bytes.\n", disk_cache_per_slice);
   OutputVerbose(options_->verbose_functor, "Max speed per slice: %" PRId64 " bytes.\n", max_speed_per_slice);
 
-  ZoeResult ss_ret = ZoeResult::SUCCESSED;
-  int32_t selected = 0;
-  while (true) {
-    if (selected >= options_->thread_num)
-      break;
-
-    std::shared_ptr<Slice> slice = slice_manager_->getSlice(Slice::SliceStatus::UNFETCH);
-    if (!slice)
-      break;
-
-    slice->setStatus(Slice::SliceStatus::FETCHED);
-    ss_ret = slice->start(multi_, disk_cache_per_slice, max_speed_per_slice);
-    if (ss_ret != ZoeResult::SUCCESSED) {
-      OutputVerbose(options_->verbose_functor,
-                    "Slice<%d> start downloading failed: %s.\n",
-                    slice->index(), Zoe::GetResultString(ss_ret));
-
-      // fatal error, return immediately!
-      curl_multi_cleanup(multi_);
-      multi_ = nullptr;
-      return ss_ret;
-    }
-    OutputVerbose(options_->verbose_functor, "Slice<%d> start downloading.\n", slice->index());
-    selected++;
-  }
-
-  if (selected == 0) {
-    OutputVerbose(options_->verbose_functor, "No available slice.\n");
-    curl_multi_cleanup(multi_);
-    multi_ = nullptr;
-    return ZoeResult::UNKNOWN_ERROR;
-  }
-
   if (options_->progress_functor)
     progress_handler_ = std::make_shared<ProgressHandler>(options_, slice_manager_);
 
   if (options_->speed_functor)
-    speed_handler_ = std::make_shared<SpeedHandler>(slice_manager_->totalDownloaded(), options_, slice_manager_);
-
-  // https://curl.haxx.se/libcurl/c/curl_multi_fdset.html
-  // https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-select
-  // https://manpages.courier-mta.org/htmlman2/select.2.html
-  //
-  struct timeval select_timeout;
-  select_timeout.tv_sec = 1;
-  select_timeout.tv_usec = 0;
-
-  long curl_timeo = -1;
-  curl_multi_timeout(multi_, &curl_timeo);
-
-  if (curl_timeo > 0) {
-    select_timeout.tv_sec = curl_timeo / 1000;
-    if (select_timeout.tv_sec > 1)
-      select_timeout.tv_sec = 1;
-    else
-      select_timeout.tv_usec = (curl_timeo % 1000) * 1000;
-  }
-  else {
-    select_timeout.tv_sec = 0;
-    select_timeout.tv_usec = 100 * 1000;
-  }
+    speed_handler_ = std::make_shared<SpeedHandler>(slice_manager_->downloadedBytes(), options_, slice_manager_);
+
+  flush_time_meter_.Restart();
+  speed_limit_time_meter_.Restart();
+  rate_time_meter_.Restart();
+  paused_applied_ = false;
+  write_paused_ = false;
+  stage_ = Stage::Downloading;
+  OutputVerbose(options_->verbose_functor, "Start downloading.\n");
+}
 
-  fd_set fdread;
-  fd_set fdwrite;
-  fd_set fdexcep;
-  int maxfd = -1;
-  int still_running = 0;
+bool EntryHandler::tickDownloading() {
+  if (isStopRequested()) {
+    startFinishing(true);
+    return true;
+  }
 
-  CURLMcode mcode = curl_multi_perform(multi_, &still_running);
-  OutputVerbose(options_->verbose_functor, "Start downloading.\n");
+  if (loop_->lastError() != CURLM_OK) {
+    OutputVerbose(options_->verbose_functor,
+                  "Wait for network events failed, code: %ld(%s).\n",
+                  (long)loop_->lastError(), curl_multi_strerror(loop_->lastError()));
+    startFinishing(true);
+    return true;
+  }
 
-  TimeMeter flush_time_meter;
+  if (slice_manager_->streamCanceled()) {
+    OutputVerbose(options_->verbose_functor, "Stream is canceled by the receiver.\n");
+    result_ = ZoeResult::CANCELED;
+    startFinishing(false);
+    return true;
+  }
 
-  do {
-    if (user_paused_.load()) {
-      while (true) {
-        if (options_->internal_stop_event.wait(50))
-          break;
+  if (slice_manager_->streamStalled()) {
+    OutputVerbose(options_->verbose_functor, "Stream is stalled by a failed slice.\n");
+    result_ = ZoeResult::SLICE_DOWNLOAD_FAILED;
+    startFinishing(true);
+    return true;
+  }
 
-        if (options_->user_stop_event && options_->user_stop_event->isSetted())
-          break;
+  tickDraining();
+  applyPauseState();
 
-        if (!user_paused_.load())
-          break;
-      }
+  if (!paused_applied_) {
+    if (slice_manager_->needSync()) {
+      // Record the newly synced data at once.
+      if (slice_manager_->syncSlices(true))
+        slice_manager_->flushIndexFile();
     }
 
-    if (options_->internal_stop_event.isSetted() || (options_->user_stop_event && options_->user_stop_event->isSetted()))
-      break;
-
-    if (flush_time_meter.Elapsed() >= 10000) {  // 10s
+    if (flush_time_meter_.Elapsed() >= 10000) {  // 10s
       slice_manager_->flushAllSlices();
       slice_manager_->flushIndexFile();
-      flush_time_meter.Restart();
+      flush_time_meter_.Restart();
     }
 
-    FD_ZERO(&fdread);
-    FD_ZERO(&fdwrite);
-    FD_ZERO(&fdexcep);
-    /*
-    If no file descriptors are set by libcurl, max_fd will contain -1 when this function returns. 
-    Otherwise it will contain the highest descriptor number libcurl set. 
-    When libcurl returns -1 in max_fd, it is because libcurl currently does something 
-    that isn't possible for your application to monitor with a socket and unfortunately 
-    you can then not know exactly when the current action is completed using select(). 
-    You then need to wait a while before you proceed and call curl_multi_perform anyway. 
-    How long to wait? Unless curl_multi_timeout gives you a lower number, we suggest 100 milliseconds or so, 
-    but you may want to test it out in your own particular conditions to find a suitable value.
-    */
-    mcode = curl_multi_fdset(multi_, &fdread, &fdwrite, &fdexcep, &maxfd);
-    if (mcode != CURLM_CALL_MULTI_PERFORM && mcode != CURLM_OK) {
-      OutputVerbose(options_->verbose_functor,
-                    "curl_multi_fdset failed, code: %ld(%s).\n", (long)mcode, curl_multi_strerror(mcode));
-      break;
+    if (options_->hedge_enabled && rate_time_meter_.Elapsed() >= 1000) {
+      slice_manager_->updateSliceRates();
+      rate_time_meter_.Restart();
     }
 
-    if (maxfd == -1) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    else {
-      /*
-      The select function returns the total number of socket handles that are ready and contained in the fd_set structures, 
-      zero if the time limit expired, or SOCKET_ERROR if an error occurred. 
-      If the return value is SOCKET_ERROR, WSAGetLastError can be used to retrieve a specific error code.
-      */
-      const int rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &select_timeout);
-      if (rc == -1) {  // SOCKET_ERROR
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-      }
-    }
+    write_paused_ = slice_manager_->resumeWritePausedSlices();
 
-    curl_multi_perform(multi_, &still_running);
-
-    if (still_running < options_->thread_num) {
-      updateSliceStatus();
-
-      // Get a slice that not be fetched(of cause not completed).
-      std::shared_ptr<Slice> slice = slice_manager_->getSlice(Slice::SliceStatus::UNFETCH);
-      if (!slice) {
-        // Try to download the slice that is failed previous again.
-        slice = slice_manager_->getSlice(Slice::SliceStatus::DOWNLOAD_FAILED);
-        if (slice) {
-          if (slice->failedTimes() >= options_->slice_max_failed_times)
-            slice.reset();
-          else
-            OutputVerbose(options_->verbose_functor, "Re-download slice<%d>.\n", slice->index());
-        }
-        else {
-          if (!slice_manager_->getSlice(Slice::SliceStatus::DOWNLOADING)) {
-            // only one slice that end_ is -1, so don't need loop
-            slice = slice_manager_->getSlice(Slice::SliceStatus::CURL_OK_BUT_COMPLETED_NOT_SURE);
-            if (slice) {
-              if (slice_manager_->originFileSize() == -1 || slice_manager_->checkAllSliceCompletedByFileSize() == ZoeResult::SUCCESSED) {
-                slice->setStatus(Slice::SliceStatus::DOWNLOAD_COMPLETED);
-                slice.reset();
-              }
-              else {
-                OutputVerbose(options_->verbose_functor, "Re-download slice<%d>.\n", slice->index());
-              }
-            }
-          }
-        }
-      }
-      else {
-        slice->setStatus(Slice::SliceStatus::FETCHED);
-        disk_cache_per_slice = 0L;
-        max_speed_per_slice = 0L;
-        calculateSliceInfo(still_running + 1, &disk_cache_per_slice, &max_speed_per_slice);
-
-        const ZoeResult start_ret = slice->start(multi_, disk_cache_per_slice, max_speed_per_slice);
-        if (still_running <= 0) {
-          if (start_ret == ZoeResult::SUCCESSED) {
-            curl_multi_perform(multi_, &still_running);
-            OutputVerbose(options_->verbose_functor, "Slice<%d> start downloading.\n", slice->index());
-          }
-          else {
-            still_running = 1;
-            OutputVerbose(options_->verbose_functor, "Slice<%d> start downloading failed: %s.\n",
-                          slice->index(), Zoe::GetResultString(start_ret));
-          }
-        }
+    tuner_.onTick(running_slices_, false);
+    startPendingSlices();
+
+    // The connection is taken by the next tick.
+    if (write_paused_ && slice_manager_->isStream()) {
+      const std::shared_ptr<Slice> parked = slice_manager_->parkBlockedSlice(multi_);
+      if (parked) {
+        stopSliceLater(parked, Slice::SliceStatus::UNFETCH);
+        releaseSliceConnection();
       }
     }
-  } while (still_running > 0 || user_paused_.load());
 
-  OutputVerbose(options_->verbose_functor, "Downloading end.\n");
+    applySpeedLimit();
+  }
+  else {
+    write_paused_ = false;
+    tuner_.onTick(running_slices_, true);
+  }
 
-  ZoeResult ret = slice_manager_->finishDownloadProgress(true, multi_);
+  if (progress_handler_)
+    progress_handler_->onTick();
 
-  if (multi_) {
-    curl_multi_cleanup(multi_);
-    multi_ = nullptr;
-  }
+  if (speed_handler_)
+    speed_handler_->onTick();
 
-  state_.store(DownloadState::Stopped);
+  if (stage_ == Stage::Downloading && running_slices_ == 0 && draining_.empty() && !hasPendingSlice())
+    startFinishing(true);
 
-  if (ret == ZoeResult::SUCCESSED) {
-    OutputVerbose(options_->verbose_functor, "All success!\n");
-    return ret;
+  return true;
+}
+
+std::shared_ptr<Slice> EntryHandler::nextSlice() {
+  // The data of a stream is delivered in order, so are the slices fetched.
+  std::shared_ptr<Slice> slice;
+  if (slice_manager_->isStream()) {
+    slice = slice_manager_->getFirstPendingSlice();
+    if (slice)
+      return slice;
   }
 
-  if (options_->internal_stop_event.isSetted() ||
-      (options_->user_stop_event && options_->user_stop_event->isSetted()))
-    ret = ZoeResult::CANCELED;  // user cancel, ignore other failed reason
+  // Get a slice that not be fetched(of cause not completed).
+  slice = slice_manager_->getSlice(Slice::SliceStatus::UNFETCH);
+  if (slice)
+    return slice;
 
-  return ret;
-}
+  // Try to download the slice that is failed previous again.
+  slice = slice_manager_->getRetryableFailedSlice();
+  if (slice) {
+    OutputVerbose(options_->verbose_functor, "Re-download slice<%d>.\n", slice->index());
+    return slice;
+  }
 
-bool EntryHandler::fetchFileInfo(FileInfo& fileInfo) {
-  return doFetchFileInfo(options_->url, fileInfo);
-}
+  if (slice_manager_->hasSlice(Slice::SliceStatus::DOWNLOADING)) {
+    // Steal the back half of the largest in-flight range instead of leaving the connection idle.
+    if (!file_info_.acceptRanges)
+      return nullptr;
 
-bool EntryHandler::doFetchFileInfo(const utf8string& url, FileInfo& fileInfo) {
-  if (!options_)
-    return false;
+    slice = slice_manager_->splitSlice(ZOE_MIN_SPLIT_SLICE_SIZE_BYTE);
+    if (!slice && options_->hedge_enabled)
+      slice = slice_manager_->makeHedgeSlice(options_->hedge_rate_percent);
+    return slice;
+  }
 
-  CURLM* multi = curl_multi_init();
-  if (!multi)
-    return false;
+  // only one slice that end_ is -1, so don't need loop
+  slice = slice_manager_->getSlice(Slice::SliceStatus::CURL_OK_BUT_COMPLETED_NOT_SURE);
+  if (slice) {
+    if (slice_manager_->originFileSize() == -1 || slice_manager_->checkAllSliceCompletedByFileSize() == ZoeResult::SUCCESSED) {
+      slice->setStatus(Slice::SliceStatus::DOWNLOAD_COMPLETED);
+      return nullptr;
+    }
 
-  CURL* curl = curl_easy_init();
-  if (!curl) {
-    curl_multi_cleanup(multi);
-    return false;
+    if (slice->failedTimes() >= options_->slice_max_failed_times)
+      return nullptr;
+
+    slice->increaseFailedTimes();
+    OutputVerbose(options_->verbose_functor, "Re-download slice<%d>.\n", slice->index());
   }
 
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L));
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L));
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_URL, url.c_str()));
-  if (options_->use_head_method_fetch_file_info)
-    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_NOBODY, 1L));
-  else
-    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_NOBODY, 0L));
+  return slice;
+}
 
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L));
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, options_->verify_peer_host ? 2L : 0L));
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, options_->verify_peer_certificate ? 1L : 0L));
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, options_->network_conn_timeout));
+void EntryHandler::startPendingSlices() {
+  // Exceeding connections are not stopped when the target shrinks, they just are not replaced.
+  while (running_slices_ < tuner_.target()) {
+    std::shared_ptr<Slice> slice = nextSlice();
+    if (!slice)
+      break;
 
-  if (options_->verify_peer_certificate && options_->ca_path.length() > 0)
-    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_CAINFO, options_->ca_path.c_str()));
+    if (quota_ && !quota_->tryAcquire(host_))
+      break;  // wait for a free connection
 
-  // avoid libcurl failed with "Failed writing body".
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, __WriteBodyCallback));
+    slice->setStatus(Slice::SliceStatus::FETCHED);
 
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, __WriteHeaderCallback));
-  CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*)&fileInfo));
+    int64_t disk_cache_per_slice = 0L;
+    int64_t max_speed_per_slice = 0L;
+    calculateSliceInfo(running_slices_ + 1, &disk_cache_per_slice, &max_speed_per_slice);
 
-  if (options_->proxy.length() > 0) {
-    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_PROXY, options_->proxy.c_str()));
-  }
+    const ZoeResult start_ret = slice->start(multi_, this, disk_cache_per_slice, max_speed_per_slice);
+    if (start_ret != ZoeResult::SUCCESSED) {
+      if (quota_)
+        quota_->release(host_);
 
-  if (options_->cookie_list.length() > 0) {
-    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_COOKIELIST, options_->cookie_list.c_str()));
-  }
+      OutputVerbose(options_->verbose_functor, "Slice<%d> start downloading failed: %s.\n",
+                    slice->index(), Zoe::GetResultString(start_ret));
 
-  struct curl_slist* headerChunk = nullptr;
-  const HttpHeaders& headers = options_->http_headers;
-  if (headers.size() > 0) {
-    for (const auto& it : headers) {
-      utf8string headerStr = it.first + ": " + it.second;
-      headerChunk = curl_slist_append(headerChunk, headerStr.c_str());
+      // fatal error, stop downloading.
+      result_ = start_ret;
+      startFinishing(true);
+      return;
     }
-    CHECK_SETOPT2(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerChunk));
-  }
 
-  if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
-    curl_easy_cleanup(curl);
-    curl_multi_cleanup(multi);
-    return false;
+    running_slices_++;
+    OutputVerbose(options_->verbose_functor, "Slice<%d> start downloading.\n", slice->index());
   }
+}
 
-  int still_running = 0;
-  do {
-    if (options_->internal_stop_event.isSetted() || (options_->user_stop_event && options_->user_stop_event->isSetted()))
-      break;
+void EntryHandler::applyPauseState() {
+  const bool paused = user_paused_.load();
+  if (paused == paused_applied_)
+    return;
 
-    CURLMcode mc = curl_multi_perform(multi, &still_running);
-    if (!mc && still_running) {
-      /* wait for activity, timeout or "nothing" */
-      mc = curl_multi_poll(multi, NULL, 0, 30, NULL);
-    }
+  paused_applied_ = paused;
+  slice_manager_->pauseAllSlices(paused);
+}
 
-    if (mc)
-      break;
-  } while (still_running);
+void EntryHandler::applySpeedLimit() {
+  if (!quota_ || quota_->maxSpeed() <= 0)
+    return;
 
-  auto cleanupFn = [multi, curl, headerChunk]() {
-    curl_multi_remove_handle(multi, curl);
+  if (speed_limit_time_meter_.Elapsed() < 1000)
+    return;
+  speed_limit_time_meter_.Restart();
 
-    if (headerChunk) {
-      curl_slist_free_all(headerChunk);
+  // Bandwidth of the scheduler is shared by the active connections, re-balance it periodically.
+  int64_t max_speed_per_slice = 0L;
+  calculateSliceInfo(running_slices_, nullptr, &max_speed_per_slice);
+  slice_manager_->setSlicesMaxSpeed(max_speed_per_slice);
+}
+
+void EntryHandler::startFinishing(bool need_check_completed) {
+  if (stage_ == Stage::Downloading)
+    OutputVerbose(options_->verbose_functor, "Downloading end, new connections: %ld.\n", new_connections_);
+
+  stage_ = Stage::Finishing;
+
+  // Easy handles must leave the multi handle on the loop thread.
+  slice_manager_->detachAllSlices(multi_);
+  if (quota_) {
+    for (int32_t i = 0; i < running_slices_; i++)
+      quota_->release(host_);
+  }
+  running_slices_ = 0;
+
+  // Flushing and hash verifying may take a long time, do not block the event loop.
+  // Neither does waiting for the slices stopped on the loop thread.
+  std::shared_ptr<SliceManager> slice_manager = slice_manager_;
+  std::vector<Draining> draining;
+  draining.swap(draining_);
+  finish_task_ = std::async(std::launch::async, [slice_manager, need_check_completed, draining]() {
+    for (auto& d : draining) {
+      for (auto& s : d.slices)
+        s->waitWritten();
+      if (d.done)
+        d.done();
     }
+    return slice_manager->finishDownloadProgress(need_check_completed, nullptr);
+  });
+}
 
-    curl_easy_cleanup(curl);
-    curl_multi_cleanup(multi);
-  };
+bool EntryHandler::tickFinishing() {
+  if (finish_task_.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready)
+    return true;
 
-  if (options_->internal_stop_event.isSetted() || (options_->user_stop_event && options_->user_stop_event->isSetted())) {
-    cleanupFn();
-    return false;
+  const ZoeResult ret = finish_task_.get();
+
+  // The slices that do not match their checksums have been reset, download them once more.
+  if (ret == ZoeResult::HASH_VERIFY_NOT_PASS && result_ == ZoeResult::SUCCESSED && !refetched_ &&
+      !isStopRequested() && slice_manager_->hasSlice(Slice::SliceStatus::UNFETCH)) {
+    OutputVerbose(options_->verbose_functor, "Download the corrupted slices again.\n");
+    refetched_ = true;
+    flush_time_meter_.Restart();
+    write_paused_ = false;
+    stage_ = Stage::Downloading;
+    return true;
   }
 
-  CURLcode ret_code = CURLE_FAILED_INIT;
-  int msg_in_queue = 0;
-  CURLMsg* m = curl_multi_info_read(multi, &msg_in_queue);
-  if (m && m->msg == CURLMSG_DONE) {
-    ret_code = m->data.result;
+  if (result_ == ZoeResult::SUCCESSED)
+    result_ = ret;
+
+  if (result_ == ZoeResult::SUCCESSED)
+    OutputVerbose(options_->verbose_functor, "All success!\n");
+  else if (isStopRequested())
+    result_ = ZoeResult::CANCELED;  // user cancel, ignore other failed reason
+
+  stage_ = Stage::Finished;
+  return false;
+}
+
+void EntryHandler::countNewConnections(void* curl) {
+  long num = 0;
+  if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num) == CURLE_OK)
+    new_connections_ += num;
+}
+
+void EntryHandler::onSliceDone(std::shared_ptr<Slice> slice, CURLcode result) {
+  countNewConnections(slice->curlHandle());
+
+  const std::shared_ptr<Slice> primary = slice_manager_->primaryOf(slice.get());
+  if (primary) {
+    onHedgeSliceDone(primary, slice, result);
+    return;
   }
 
-  if (ret_code != CURLE_OK) {
+  // Finished slices are the reference of slow slices.
+  slice->updateRate(true);
+
+  const std::shared_ptr<Slice> hedge = slice_manager_->hedgeOf(slice.get());
+  const bool hedge_running = (hedge && hedge->status() == Slice::SliceStatus::DOWNLOADING);
+
+  // A truncated slice is aborted by its write callback once the range has been received.
+  if (slice->isDataCompletedClearly()) {
+    stopSliceLater(slice, Slice::SliceStatus::DOWNLOAD_COMPLETED);
+  }
+  else if (hedge_running && slice->writePosition() >= hedge->begin()) {
+    // The hedge slice covers the rest of the range, it may still finish the slice.
     OutputVerbose(options_->verbose_functor,
-                  "curl_multi_perform failed, CURLcode: %ld(%s).\n",
-                  (long)ret_code, curl_easy_strerror(ret_code));
-    cleanupFn();
-    return false;
+                  "Slice<%d> download failed %ld(%s), wait for its hedge slice.\n",
+                  slice->index(), (long)result, curl_easy_strerror(result));
+
+    // Stays DOWNLOADING without a transfer, see onHedgeSliceDone.
+    slice->increaseFailedTimes();
+    slice->stopTransfer(multi_);
+    releaseSliceConnection();
+    return;
+  }
+  else if (result == CURLE_OK) {
+    if (slice->end() == -1) {
+      stopSliceLater(slice, Slice::SliceStatus::CURL_OK_BUT_COMPLETED_NOT_SURE);
+    }
+    else {
+      slice->increaseFailedTimes();
+      stopSliceLater(slice, Slice::SliceStatus::DOWNLOAD_FAILED);
+    }
   }
-
-  char* redirect_url = nullptr;
-  if (curl_easy_getinfo(curl, CURLINFO_REDIRECT_URL, &redirect_url) == CURLE_OK && redirect_url) {
-    fileInfo.redirectUrl = redirect_url;
+  else {
+    OutputVerbose(options_->verbose_functor,
+                  "Slice<%d> download failed %ld(%s).\n",
+                  slice->index(), (long)result,
+                  curl_easy_strerror(result));
+
+    slice->increaseFailedTimes();
+    stopSliceLater(slice, Slice::SliceStatus::DOWNLOAD_FAILED);
+  }
+  releaseSliceConnection();
+
+  // The primary slice finished first, or failed before the hedge slice got a connection, cancel
+  // the duplicate request.
+  if (hedge) {
+    if (hedge_running) {
+      OutputVerbose(options_->verbose_functor, "Cancel the hedge slice of slice<%d>.\n", slice->index());
+      hedge->abandon(multi_);
+      finishLater({hedge}, nullptr);
+      releaseSliceConnection();
+    }
+    slice_manager_->removeHedge(slice.get());
   }
+}
 
-  int http_code = 0;
-  if ((ret_code = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code)) != CURLE_OK) {
-    OutputVerbose(
-        options_->verbose_functor,
-        "Get CURLINFO_RESPONSE_CODE failed, CURLcode: %ld(%s).\n",
-        (long)ret_code, curl_easy_strerror(ret_code));
+void EntryHandler::onHedgeSliceDone(std::shared_ptr<Slice> primary, std::shared_ptr<Slice> hedge, CURLcode result) {
+  if (hedge->isDataCompletedClearly()) {
+    OutputVerbose(options_->verbose_functor, "Hedge slice<%d> finished first.\n", primary->index());
+    hedge->stopTransfer(multi_);
+    if (primary->status() == Slice::SliceStatus::DOWNLOADING) {
+      // The connection of a failed primary slice has been released already.
+      if (primary->curlHandle()) {
+        primary->stopTransfer(multi_);
+        releaseSliceConnection();
+      }
 
-    cleanupFn();
-    return false;
+      // The whole range is on disk once the writes of both slices are done.
+      finishLater({hedge, primary}, [hedge, primary]() {
+        hedge->setStatus(Slice::SliceStatus::DOWNLOAD_COMPLETED);
+        hedge->stop(nullptr);
+        primary->completeByHedge(nullptr);
+      });
+    }
+    else {
+      finishLater({hedge}, [hedge]() {
+        hedge->setStatus(Slice::SliceStatus::DOWNLOAD_COMPLETED);
+        hedge->stop(nullptr);
+      });
+    }
   }
-
-  if (http_code != 200 && http_code != 350) {
-    // A 350 response code is sent by the server in response to a file-related command that
-    // requires further commands in order for the operation to be completed
+  else {
     OutputVerbose(options_->verbose_functor,
-                  "HTTP response code error, code: %ld.\n",
-                  (long)http_code);
+                  "Hedge slice<%d> failed %ld(%s).\n",
+                  primary->index(), (long)result, curl_easy_strerror(result));
+    hedge->abandon(multi_);
+    finishLater({hedge}, nullptr);
 
-    cleanupFn();
-    return false;
+    // Both failed, the primary slice is downloaded again from its received data.
+    if (primary->status() == Slice::SliceStatus::DOWNLOADING && !primary->curlHandle())
+      stopSliceLater(primary, Slice::SliceStatus::DOWNLOAD_FAILED);
   }
 
-  cleanupFn();
+  slice_manager_->removeHedge(primary.get());
+  releaseSliceConnection();
+}
 
-  return true;
+void EntryHandler::finishLater(const std::vector<std::shared_ptr<Slice>>& slices, std::function<void()> done) {
+  Draining draining;
+  draining.slices = slices;
+  draining.done = done;
+  draining_.push_back(draining);
+
+  // Nothing is queued if the data is written in the write callbacks.
+  tickDraining();
+}
+
+void EntryHandler::stopSliceLater(std::shared_ptr<Slice> slice, Slice::SliceStatus status) {
+  slice->stopTransfer(multi_);
+  finishLater({slice}, [slice, status]() {
+    slice->setStatus(status);
+    slice->stop(nullptr);
+  });
+}
+
+void EntryHandler::tickDraining() {
+  for (size_t i = 0; i < draining_.size();) {
+    bool pending = false;
+    for (auto& s : draining_[i].slices)
+      pending = pending || s->writesPending();
+
+    if (pending) {
+      i++;
+      continue;
+    }
+
+    const std::function<void()> done = draining_[i].done;
+    draining_.erase(draining_.begin() + i);
+    if (done)
+      done();
+  }
+}
+
+void EntryHandler::releaseSliceConnection() {
+  assert(running_slices_ > 0);
+  running_slices_--;
+  if (quota_)
+    quota_->release(host_);
+}
+
+bool EntryHandler::hasPendingSlice() const {
+  return (slice_manager_->hasSlice(Slice::SliceStatus::UNFETCH) ||
+          slice_manager_->hasSlice(Slice::SliceStatus::DOWNLOADING) ||
+          slice_manager_->hasSlice(Slice::SliceStatus::DOWNLOAD_FAILED));
 }
 
 void EntryHandler::calculateSliceInfo(int32_t concurrency_num,
@@ -620,48 +983,12 @@ void EntryHandler::calculateSliceInfo(int32_t concurrency_num,
           (options_->max_speed == -1 ? -1 : (options_->max_speed / concurrency_num));
     }
   }
-}
 
-void EntryHandler::updateSliceStatus() {
-  struct CURLMsg* m = nullptr;
-  do {
-    int msg_in_queue = 0;
-    m = curl_multi_info_read(multi_, &msg_in_queue);
-
-    if (m && m->msg == CURLMSG_DONE) {
-      const std::shared_ptr<Slice> slice = slice_manager_->getSlice(m->easy_handle);
-      assert(slice);
-      if (!slice)
-        continue;
-
-      if (m->data.result == CURLE_OK) {
-        if (slice->isDataCompletedClearly()) {
-          slice->setStatus(Slice::SliceStatus::DOWNLOAD_COMPLETED);
-          slice->stop(multi_);
-        }
-        else {
-          if (slice->end() == -1) {
-            slice->setStatus(Slice::SliceStatus::CURL_OK_BUT_COMPLETED_NOT_SURE);
-            slice->stop(multi_);
-          }
-          else {
-            slice->setStatus(Slice::SliceStatus::DOWNLOAD_FAILED);
-            slice->increaseFailedTimes();
-            slice->stop(multi_);
-          }
-        }
-      }
-      else {
-        OutputVerbose(options_->verbose_functor,
-                      "Slice<%d> download failed %ld(%s).\n",
-                      slice->index(), m->data.result,
-                      curl_easy_strerror(m->data.result));
-
-        slice->setStatus(Slice::SliceStatus::DOWNLOAD_FAILED);
-        slice->increaseFailedTimes();
-        slice->stop(multi_);
-      }
-    }
-  } while (m);
+  // The bandwidth of scheduler is divided equally across its active connections.
+  if (max_speed_per_slice && quota_) {
+    const int64_t share = quota_->speedPerConnection();
+    if (share > 0 && (*max_speed_per_slice <= 0 || share < *max_speed_per_slice))
+      *max_speed_per_slice = share;
+  }
 }
 }  // namespace zoe
@@ -20,15 +20,25 @@
 #pragma once
 
 #include <memory>
+#include <future>
+#include <vector>
+#include <functional>
 #include "slice_manager.h"
 #include "progress_handler.h"
 #include "speed_handler.h"
 #include "options.h"
 #include "curl_utils.h"
+#include "event_loop.h"
+#include "connection_quota.h"
+#include "scheduler_impl.h"
+#include "time_meter.hpp"
+#include "concurrency_tuner.h"
 
 namespace zoe {
 
-class EntryHandler {
+// Download job of a Zoe instance, driven by an EventLoop:
+//   fetching file info -> [validating resumed slices ->] downloading slices -> finishing (flush, hash, rename).
+class EntryHandler : public LoopJob, public TransferObserver, public SliceObserver {
  public:
   typedef struct _FileInfo {
     bool acceptRanges;
@@ -51,7 +61,8 @@ class EntryHandler {
   EntryHandler();
   virtual ~EntryHandler();
 
-  std::shared_future<ZoeResult> start(Options* options);
+  // If |scheduler| is nullptr, the job runs on a private event loop thread.
+  std::shared_future<ZoeResult> start(Options* options, JobScheduler* scheduler);
   void pause();
   void resume();
   void stop();
@@ -61,26 +72,106 @@ class EntryHandler {
 
   DownloadState state() const;
 
+  ConcurrencyStats concurrencyStats() const;
+
   std::shared_future<ZoeResult> futureResult();
+
+  // LoopJob
+  virtual void onAttach(EventLoop* loop);
+  virtual bool onTick();
+  virtual int32_t maxWaitMs() const;
+  virtual void onDetach();
+  virtual void cancel();
+
+  // TransferObserver, only the request of fetching file info.
+  virtual void onTransferDone(CURL* curl, CURLcode result);
+
+  // SliceObserver
+  virtual void onSliceDone(std::shared_ptr<Slice> slice, CURLcode result);
+
  protected:
-  ZoeResult asyncTaskProcess();
-  ZoeResult _asyncTaskProcess();
+  enum class Stage {
+    FetchingInfo = 0,
+    Validating = 1,
+    Downloading = 2,
+    Finishing = 3,
+    Finished = 4
+  };
+
+  bool isStopRequested() const;
+  void complete(ZoeResult ret);
+
+  bool tickFetchingInfo();
+  bool startFetchFileInfo();
+  bool parseFetchFileInfo(CURLcode result);
+  void cleanupFetchFileInfo();
+  void onFileInfoFetched();
+
+  bool tickValidating();
+  void startDownloading();
+
+  bool tickDownloading();
+  void startPendingSlices();
+  std::shared_ptr<Slice> nextSlice();
+  void applyPauseState();
+  void applySpeedLimit();
+  void startFinishing(bool need_check_completed);
+
+  bool tickFinishing();
 
-  bool fetchFileInfo(FileInfo& fileInfo);
-  bool doFetchFileInfo(const utf8string& url, FileInfo& fileInfo);
   void calculateSliceInfo(int32_t concurrency_num,
                           int64_t* disk_cache_per_slice,
                           int64_t* max_speed_per_slice) const;
-  void updateSliceStatus();
+  void onHedgeSliceDone(std::shared_ptr<Slice> primary, std::shared_ptr<Slice> hedge, CURLcode result);
+  void releaseSliceConnection();
+  void countNewConnections(void* curl);
+  bool hasPendingSlice() const;
+
+  // The slices stopped on the loop thread are finished once their queued writes are done, the
+  // event loop does not wait for the disk.
+  struct Draining {
+    std::vector<std::shared_ptr<Slice>> slices;
+    std::function<void()> done;
+  };
+  void finishLater(const std::vector<std::shared_ptr<Slice>>& slices, std::function<void()> done);
+  // Stop the transfer of |slice|, set |status| and stop() it later.
+  void stopSliceLater(std::shared_ptr<Slice> slice, Slice::SliceStatus status);
+  void tickDraining();
 
  protected:
+  std::promise<ZoeResult> promise_;
   std::shared_future<ZoeResult> async_task_;
+  std::shared_future<void> loop_task_;  // private event loop thread
   Options* options_;
   std::shared_ptr<SliceManager> slice_manager_;
   std::shared_ptr<ProgressHandler> progress_handler_;
   std::shared_ptr<SpeedHandler> speed_handler_;
 
+  EventLoop* loop_;
   void* multi_;
+  ConnectionQuota* quota_;  // nullptr if not attached to a scheduler
+  utf8string host_;         // host that the connections are counted against
+
+  Stage stage_;
+  ZoeResult result_;
+
+  void* fetch_curl_;
+  struct curl_slist* fetch_header_chunk_;
+  FileInfo file_info_;
+  int32_t fetch_try_times_;
+
+  int32_t running_slices_;
+  long new_connections_;  // connections opened by finished transfers, reused ones excluded
+  ConcurrencyTuner tuner_;
+  bool paused_applied_;
+  bool write_paused_;  // some slices are paused by a full write queue
+  bool refetched_;     // the corrupted slices have been downloaded again
+  TimeMeter flush_time_meter_;
+  TimeMeter speed_limit_time_meter_;
+  TimeMeter rate_time_meter_;
+  std::shared_future<int32_t> validate_task_;
+  std::shared_future<ZoeResult> finish_task_;
+  std::vector<Draining> draining_;
 
   std::atomic_bool user_paused_;
 
@@ -0,0 +1,351 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "event_driver.h"
+#include <assert.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#if defined(__linux__)
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#endif
+
+namespace zoe {
+namespace {
+int64_t SteadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
+EventDriver* EventDriver::Create(EventEngine engine) {
+#if defined(__linux__)
+  if (engine == EventEngine::Epoll)
+    return new EpollEventDriver();
+#endif
+  return new SelectEventDriver();
+}
+
+SelectEventDriver::SelectEventDriver()
+    : multi_(nullptr) {}
+
+SelectEventDriver::~SelectEventDriver() {}
+
+EventEngine SelectEventDriver::engine() const {
+  return EventEngine::Select;
+}
+
+bool SelectEventDriver::attach(CURLM* multi) {
+  multi_ = multi;
+  return (multi_ != nullptr);
+}
+
+CURLMcode SelectEventDriver::wait(int max_wait_ms, int* still_running) {
+  assert(multi_);
+
+  // https://curl.haxx.se/libcurl/c/curl_multi_fdset.html
+  // https://docs.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-select
+  // https://manpages.courier-mta.org/htmlman2/select.2.html
+  //
+  long curl_timeo = -1;
+  curl_multi_timeout(multi_, &curl_timeo);
+
+  long wait_ms = max_wait_ms;
+  if (curl_timeo >= 0)
+    wait_ms = std::min(curl_timeo, wait_ms);
+  else
+    wait_ms = std::min(100L, wait_ms);
+
+  struct timeval select_timeout;
+  select_timeout.tv_sec = wait_ms / 1000;
+  select_timeout.tv_usec = (wait_ms % 1000) * 1000;
+
+  fd_set fdread;
+  fd_set fdwrite;
+  fd_set fdexcep;
+  int maxfd = -1;
+
+  FD_ZERO(&fdread);
+  FD_ZERO(&fdwrite);
+  FD_ZERO(&fdexcep);
+
+  /*
+  If no file descriptors are set by libcurl, max_fd will contain -1 when this function returns.
+  Otherwise it will contain the highest descriptor number libcurl set.
+  When libcurl returns -1 in max_fd, it is because libcurl currently does something
+  that isn't possible for your application to monitor with a socket and unfortunately
+  you can then not know exactly when the current action is completed using select().
+  You then need to wait a while before you proceed and call curl_multi_perform anyway.
+  How long to wait? Unless curl_multi_timeout gives you a lower number, we suggest 100 milliseconds or so,
+  but you may want to test it out in your own particular conditions to find a suitable value.
+  */
+  CURLMcode mcode = curl_multi_fdset(multi_, &fdread, &fdwrite, &fdexcep, &maxfd);
+  if (mcode != CURLM_CALL_MULTI_PERFORM && mcode != CURLM_OK)
+    return mcode;
+
+  if (maxfd == -1) {
+    if (wait_ms > 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(std::min(100L, wait_ms)));
+  }
+  else {
+    /*
+    The select function returns the total number of socket handles that are ready and contained in the fd_set structures,
+    zero if the time limit expired, or SOCKET_ERROR if an error occurred.
+    If the return value is SOCKET_ERROR, WSAGetLastError can be used to retrieve a specific error code.
+    */
+    const int rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &select_timeout);
+    if (rc == -1) {  // SOCKET_ERROR
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+
+  return perform(still_running);
+}
+
+CURLMcode SelectEventDriver::perform(int* still_running) {
+  assert(multi_);
+  int running = 0;
+  const CURLMcode mcode = curl_multi_perform(multi_, &running);
+  if (still_running)
+    *still_running = running;
+  return (mcode == CURLM_CALL_MULTI_PERFORM ? CURLM_OK : mcode);
+}
+
+ExternalEventDriver::ExternalEventDriver(WatchFunctor watch_functor)
+    : multi_(nullptr)
+    , watch_functor_(watch_functor)
+    , running_(0)
+    , timer_deadline_(-1) {}
+
+ExternalEventDriver::~ExternalEventDriver() {
+  if (multi_) {
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, nullptr);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, nullptr);
+    multi_ = nullptr;
+  }
+}
+
+EventEngine ExternalEventDriver::engine() const {
+  return EventEngine::External;
+}
+
+bool ExternalEventDriver::attach(CURLM* multi) {
+  assert(!multi_);
+  if (!multi)
+    return false;
+
+  multi_ = multi;
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, &ExternalEventDriver::SocketCallback);
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, &ExternalEventDriver::TimerCallback);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+  return true;
+}
+
+int ExternalEventDriver::SocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
+  ExternalEventDriver* pThis = static_cast<ExternalEventDriver*>(userp);
+  assert(pThis);
+  if (pThis && pThis->watch_functor_)
+    pThis->watch_functor_(s, what);
+  return 0;
+}
+
+int ExternalEventDriver::TimerCallback(CURLM* multi, long timeout_ms, void* userp) {
+  ExternalEventDriver* pThis = static_cast<ExternalEventDriver*>(userp);
+  assert(pThis);
+  if (!pThis)
+    return -1;
+
+  pThis->timer_deadline_ = (timeout_ms < 0 ? -1 : SteadyNowMs() + timeout_ms);
+  return 0;
+}
+
+int ExternalEventDriver::remainTimeout() const {
+  if (timer_deadline_ < 0)
+    return -1;
+  const int64_t remain = timer_deadline_ - SteadyNowMs();
+  return (int)std::max<int64_t>(remain, 0);
+}
+
+void ExternalEventDriver::syncTimer() {
+  // Same as EpollEventDriver, the expired deadline must be refreshed from the multi handle.
+  long timeout_ms = -1;
+  if (curl_multi_timeout(multi_, &timeout_ms) != CURLM_OK)
+    return;
+  timer_deadline_ = (timeout_ms < 0 ? -1 : SteadyNowMs() + timeout_ms);
+}
+
+CURLMcode ExternalEventDriver::wait(int max_wait_ms, int* still_running) {
+  return perform(still_running);
+}
+
+CURLMcode ExternalEventDriver::perform(int* still_running) {
+  return action(CURL_SOCKET_TIMEOUT, 0, still_running);
+}
+
+CURLMcode ExternalEventDriver::action(curl_socket_t s, int ev_bitmask, int* still_running) {
+  assert(multi_);
+  const CURLMcode mcode = curl_multi_socket_action(multi_, s, ev_bitmask, &running_);
+  syncTimer();
+  if (still_running)
+    *still_running = running_;
+  return mcode;
+}
+
+#if defined(__linux__)
+EpollEventDriver::EpollEventDriver()
+    : multi_(nullptr)
+    , epfd_(-1)
+    , running_(0)
+    , timer_deadline_(-1) {}
+
+EpollEventDriver::~EpollEventDriver() {
+  if (multi_) {
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, nullptr);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, nullptr);
+    multi_ = nullptr;
+  }
+
+  if (epfd_ != -1) {
+    close(epfd_);
+    epfd_ = -1;
+  }
+}
+
+EventEngine EpollEventDriver::engine() const {
+  return EventEngine::Epoll;
+}
+
+bool EpollEventDriver::attach(CURLM* multi) {
+  assert(!multi_ && epfd_ == -1);
+  if (!multi)
+    return false;
+
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ == -1)
+    return false;
+
+  multi_ = multi;
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, &EpollEventDriver::SocketCallback);
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, &EpollEventDriver::TimerCallback);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+  return true;
+}
+
+int EpollEventDriver::SocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
+  EpollEventDriver* pThis = static_cast<EpollEventDriver*>(userp);
+  assert(pThis);
+  if (!pThis || pThis->epfd_ == -1)
+    return 0;
+
+  if (what == CURL_POLL_REMOVE) {
+    // The socket may be closed already, ignore the error.
+    epoll_ctl(pThis->epfd_, EPOLL_CTL_DEL, s, nullptr);
+    return 0;
+  }
+
+  struct epoll_event ev;
+  ev.data.fd = s;
+  ev.events = 0;
+  if (what & CURL_POLL_IN)
+    ev.events |= EPOLLIN;
+  if (what & CURL_POLL_OUT)
+    ev.events |= EPOLLOUT;
+
+  if (epoll_ctl(pThis->epfd_, EPOLL_CTL_MOD, s, &ev) != 0) {
+    if (errno == ENOENT)
+      epoll_ctl(pThis->epfd_, EPOLL_CTL_ADD, s, &ev);
+  }
+
+  return 0;
+}
+
+int EpollEventDriver::TimerCallback(CURLM* multi, long timeout_ms, void* userp) {
+  EpollEventDriver* pThis = static_cast<EpollEventDriver*>(userp);
+  assert(pThis);
+  if (!pThis)
+    return -1;
+
+  pThis->timer_deadline_ = (timeout_ms < 0 ? -1 : SteadyNowMs() + timeout_ms);
+  return 0;
+}
+
+int EpollEventDriver::remainTimeout() const {
+  if (timer_deadline_ < 0)
+    return -1;
+  const int64_t remain = timer_deadline_ - SteadyNowMs();
+  return (int)std::max<int64_t>(remain, 0);
+}
+
+void EpollEventDriver::syncTimer() {
+  // libcurl only calls the timer callback when the timeout value changes, the expired
+  // deadline must be refreshed from the multi handle, otherwise the next timeout is lost.
+  long timeout_ms = -1;
+  if (curl_multi_timeout(multi_, &timeout_ms) != CURLM_OK)
+    return;
+  timer_deadline_ = (timeout_ms < 0 ? -1 : SteadyNowMs() + timeout_ms);
+}
+
+CURLMcode EpollEventDriver::wait(int max_wait_ms, int* still_running) {
+  assert(multi_ && epfd_ != -1);
+
+  int wait_ms = max_wait_ms;
+  const int remain = remainTimeout();
+  if (remain >= 0)
+    wait_ms = std::min(remain, wait_ms);
+
+  struct epoll_event events[64];
+  const int n = epoll_wait(epfd_, events, 64, wait_ms);
+
+  CURLMcode mcode = CURLM_OK;
+  for (int i = 0; i < n && mcode == CURLM_OK; i++) {
+    int ev_bitmask = 0;
+    if (events[i].events & EPOLLIN)
+      ev_bitmask |= CURL_CSELECT_IN;
+    if (events[i].events & EPOLLOUT)
+      ev_bitmask |= CURL_CSELECT_OUT;
+    if (events[i].events & (EPOLLERR | EPOLLHUP))
+      ev_bitmask |= CURL_CSELECT_ERR;
+
+    mcode = curl_multi_socket_action(multi_, events[i].data.fd, ev_bitmask, &running_);
+  }
+
+  if (mcode == CURLM_OK && timer_deadline_ >= 0 && remainTimeout() == 0)
+    mcode = curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running_);
+
+  syncTimer();
+
+  if (still_running)
+    *still_running = running_;
+
+  return mcode;
+}
+
+CURLMcode EpollEventDriver::perform(int* still_running) {
+  assert(multi_);
+  const CURLMcode mcode = curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running_);
+  syncTimer();
+  if (still_running)
+    *still_running = running_;
+  return mcode;
+}
+#endif
+}  // namespace zoe
@@ -0,0 +1,125 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef ZOE_EVENT_DRIVER_H_
+#define ZOE_EVENT_DRIVER_H_
+#pragma once
+
+#include <functional>
+#include "zoe/zoe.h"
+#include "curl/curl.h"
+
+namespace zoe {
+// Waits for network activity on a curl multi handle and lets libcurl progress its transfers.
+class EventDriver {
+ public:
+  // Create the driver of |engine|, fall back to EventEngine::Select when the engine is not
+  // supported on current platform.
+  static EventDriver* Create(EventEngine engine);
+
+  virtual ~EventDriver() {}
+
+  virtual EventEngine engine() const = 0;
+
+  virtual bool attach(CURLM* multi) = 0;
+
+  // Wait at most |max_wait_ms| milliseconds for socket activity or libcurl timeout,
+  // then drive the transfers. |still_running| receives the number of running easy handles.
+  virtual CURLMcode wait(int max_wait_ms, int* still_running) = 0;
+
+  // Drive the transfers without waiting, e.g. right after easy handles were added.
+  virtual CURLMcode perform(int* still_running) = 0;
+};
+
+// curl_multi_fdset + select(), available on all platforms.
+class SelectEventDriver : public EventDriver {
+ public:
+  SelectEventDriver();
+  virtual ~SelectEventDriver();
+
+  virtual EventEngine engine() const;
+  virtual bool attach(CURLM* multi);
+  virtual CURLMcode wait(int max_wait_ms, int* still_running);
+  virtual CURLMcode perform(int* still_running);
+
+ protected:
+  CURLM* multi_;
+};
+
+// curl_multi_socket_action, the sockets are watched by a reactor outside of zoe.
+class ExternalEventDriver : public EventDriver {
+ public:
+  // |what| is one of CURL_POLL_IN, CURL_POLL_OUT, CURL_POLL_INOUT and CURL_POLL_REMOVE.
+  typedef std::function<void(curl_socket_t s, int what)> WatchFunctor;
+
+  explicit ExternalEventDriver(WatchFunctor watch_functor);
+  virtual ~ExternalEventDriver();
+
+  virtual EventEngine engine() const;
+  virtual bool attach(CURLM* multi);
+
+  // Never blocks, the reactor does the waiting. Same as perform().
+  virtual CURLMcode wait(int max_wait_ms, int* still_running);
+  virtual CURLMcode perform(int* still_running);
+
+  // Drive the transfers on |s|, which is ready for |ev_bitmask| (CURL_CSELECT_*).
+  CURLMcode action(curl_socket_t s, int ev_bitmask, int* still_running);
+
+  // Milliseconds until libcurl needs perform() to be called, -1 if no timer.
+  int remainTimeout() const;
+
+ protected:
+  static int SocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp);
+  static int TimerCallback(CURLM* multi, long timeout_ms, void* userp);
+
+  void syncTimer();
+
+ protected:
+  CURLM* multi_;
+  WatchFunctor watch_functor_;
+  int running_;
+  int64_t timer_deadline_;  // milliseconds of steady clock, -1 means no timer
+};
+
+#if defined(__linux__)
+// curl_multi_socket_action + epoll, the cost of each wakeup scales with active sockets.
+class EpollEventDriver : public EventDriver {
+ public:
+  EpollEventDriver();
+  virtual ~EpollEventDriver();
+
+  virtual EventEngine engine() const;
+  virtual bool attach(CURLM* multi);
+  virtual CURLMcode wait(int max_wait_ms, int* still_running);
+  virtual CURLMcode perform(int* still_running);
+
+ protected:
+  static int SocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp);
+  static int TimerCallback(CURLM* multi, long timeout_ms, void* userp);
+
+  int remainTimeout() const;
+  void syncTimer();
+
+ protected:
+  CURLM* multi_;
+  int epfd_;
+  int running_;
+  int64_t timer_deadline_;  // milliseconds of steady clock, -1 means no timer
+};
+#endif
+}  // namespace zoe
+#endif  // !ZOE_EVENT_DRIVER_H_
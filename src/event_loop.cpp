@@ -0,0 +1,178 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "event_loop.h"
+#include <assert.h>
+#include <algorithm>
+
+// Upper bound of one wait, jobs are ticked at least at this interval.
+#define LOOP_MAX_WAIT_MS 100
+
+namespace zoe {
+EventLoop::EventLoop(EventEngine engine)
+    : engine_(engine)
+    , multi_(nullptr)
+    , last_error_(CURLM_OK) {
+  job_count_.store(0);
+  quit_.store(false);
+}
+
+EventLoop::~EventLoop() {
+  assert(jobs_.empty());
+  if (multi_) {
+    curl_multi_cleanup(multi_);
+    multi_ = nullptr;
+  }
+
+  // libcurl may call the socket callbacks during curl_multi_cleanup.
+  event_driver_.reset();
+}
+
+bool EventLoop::init() {
+  assert(!multi_);
+  multi_ = curl_multi_init();
+  if (!multi_)
+    return false;
+
+  // Transfers that use HTTP/2 share connections to the same host as streams.
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+  event_driver_.reset(createDriver());
+  if (!event_driver_ || !event_driver_->attach(multi_)) {
+    curl_multi_cleanup(multi_);
+    multi_ = nullptr;
+    event_driver_.reset();
+    return false;
+  }
+
+  engine_ = event_driver_->engine();
+  return true;
+}
+
+CURLM* EventLoop::multi() const {
+  return multi_;
+}
+
+EventEngine EventLoop::engine() const {
+  return engine_;
+}
+
+CURLMcode EventLoop::lastError() const {
+  return last_error_;
+}
+
+void EventLoop::addJob(LoopJob* job) {
+  assert(job);
+  std::lock_guard<std::mutex> lg(pending_mutex_);
+  pending_jobs_.push_back(job);
+  job_count_++;
+}
+
+int32_t EventLoop::jobCount() const {
+  return job_count_.load();
+}
+
+void EventLoop::quit() {
+  quit_.store(true);
+}
+
+EventDriver* EventLoop::createDriver() {
+  return EventDriver::Create(engine_);
+}
+
+void EventLoop::attachPendingJobs() {
+  std::vector<LoopJob*> jobs;
+  {
+    std::lock_guard<std::mutex> lg(pending_mutex_);
+    jobs.swap(pending_jobs_);
+  }
+
+  for (auto job : jobs) {
+    jobs_.push_back(job);
+    job->onAttach(this);
+  }
+}
+
+void EventLoop::dispatchDoneMessages() {
+  CURLMsg* m = nullptr;
+  do {
+    int msg_in_queue = 0;
+    m = curl_multi_info_read(multi_, &msg_in_queue);
+    if (m && m->msg == CURLMSG_DONE) {
+      TransferObserver* observer = nullptr;
+      curl_easy_getinfo(m->easy_handle, CURLINFO_PRIVATE, (char**)&observer);
+      assert(observer);
+      if (observer)
+        observer->onTransferDone(m->easy_handle, m->data.result);
+    }
+  } while (m);
+}
+
+int32_t EventLoop::tickJobs() {
+  std::vector<LoopJob*> finished;
+  int32_t wait_ms = LOOP_MAX_WAIT_MS;
+  for (auto job : jobs_) {
+    if (!job->onTick())
+      finished.push_back(job);
+    else
+      wait_ms = std::min(wait_ms, job->maxWaitMs());
+  }
+
+  for (auto job : finished) {
+    jobs_.erase(std::remove(jobs_.begin(), jobs_.end(), job), jobs_.end());
+    job_count_--;
+    job->onDetach();
+  }
+
+  return wait_ms;
+}
+
+void EventLoop::run(bool exit_when_idle) {
+  assert(multi_);
+  bool canceled = false;
+
+  while (true) {
+    attachPendingJobs();
+
+    if (quit_.load() && !canceled) {
+      canceled = true;
+      for (auto job : jobs_)
+        job->cancel();
+    }
+
+    if (jobs_.empty() && (exit_when_idle || quit_.load())) {
+      std::lock_guard<std::mutex> lg(pending_mutex_);
+      if (pending_jobs_.empty())
+        break;
+      continue;
+    }
+
+    const int32_t wait_ms = tickJobs();
+    if (jobs_.empty() && exit_when_idle)
+      continue;
+
+    int still_running = 0;
+    const CURLMcode mcode = event_driver_->wait(wait_ms, &still_running);
+    if (mcode != CURLM_OK)
+      last_error_ = mcode;
+
+    // Read completed transfers right after each wait, a transfer may finish within the same
+    // call that started it.
+    dispatchDoneMessages();
+  }
+}
+}  // namespace zoe
@@ -0,0 +1,105 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef ZOE_EVENT_LOOP_H_
+#define ZOE_EVENT_LOOP_H_
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include "zoe/zoe.h"
+#include "curl_utils.h"
+#include "event_driver.h"
+
+namespace zoe {
+class EventLoop;
+
+// A unit of work hosted by EventLoop, all methods are called on the loop thread.
+class LoopJob {
+ public:
+  virtual ~LoopJob() {}
+
+  virtual void onAttach(EventLoop* loop) = 0;
+
+  // Called once per loop iteration. Return false when the job has finished and removed
+  // all of its easy handles from the multi handle.
+  virtual bool onTick() = 0;
+
+  // Upper bound of next wait for network events, in milliseconds.
+  virtual int32_t maxWaitMs() const = 0;
+
+  // The job has been removed from the loop, the loop never touches it again.
+  virtual void onDetach() = 0;
+
+  // The loop is quitting, the job should stop as soon as possible.
+  virtual void cancel() = 0;
+};
+
+// Owns a curl multi handle and drives the transfers of all attached jobs on one thread.
+// Easy handles added to the multi handle must set CURLOPT_PRIVATE to a TransferObserver.
+class EventLoop {
+ public:
+  explicit EventLoop(EventEngine engine);
+  virtual ~EventLoop();
+
+  bool init();
+
+  CURLM* multi() const;
+  EventEngine engine() const;
+
+  // Last error of waiting for network events, CURLM_OK if no error.
+  CURLMcode lastError() const;
+
+  // Thread-safe, the job will be attached on the loop thread.
+  void addJob(LoopJob* job);
+
+  // Number of attached and pending jobs, thread-safe.
+  int32_t jobCount() const;
+
+  // Run on current thread until quit() is called and all jobs are finished.
+  // If |exit_when_idle| is true, return as soon as there is no job.
+  void run(bool exit_when_idle);
+
+  // Thread-safe, cancel all jobs and let run() return once they are finished.
+  void quit();
+
+ protected:
+  virtual EventDriver* createDriver();
+
+  void attachPendingJobs();
+  void dispatchDoneMessages();
+
+  // Tick all attached jobs and detach the finished ones, return the upper bound of next wait.
+  int32_t tickJobs();
+
+ protected:
+  EventEngine engine_;
+  CURLM* multi_;
+  std::shared_ptr<EventDriver> event_driver_;
+  CURLMcode last_error_;
+
+  std::vector<LoopJob*> jobs_;
+
+  mutable std::mutex pending_mutex_;
+  std::vector<LoopJob*> pending_jobs_;
+  std::atomic<int32_t> job_count_;
+  std::atomic_bool quit_;
+};
+}  // namespace zoe
+#endif  // !ZOE_EVENT_LOOP_H_
@@ -0,0 +1,61 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_EXTERNAL_LOOP_IMPL_H_
+#define ZOE_EXTERNAL_LOOP_IMPL_H_
+#pragma once
+
+#include "zoe/zoe.h"
+#include "event_loop.h"
+#include "scheduler_impl.h"
+#include "connection_quota.h"
+
+namespace zoe {
+// An event loop that never waits by itself, each call of step() is one iteration of
+// EventLoop::run(), the reactor of the caller does the waiting.
+class ZoeExternalLoop::ExternalLoopImpl : public EventLoop, public JobScheduler {
+ public:
+  ExternalLoopImpl(ZoeExternalLoop::SocketFunctor socket_functor,
+                   ZoeExternalLoop::TimerFunctor timer_functor);
+  virtual ~ExternalLoopImpl();
+
+  // |s| is ready for |ev_bitmask| (CURL_CSELECT_*), or CURL_SOCKET_TIMEOUT when the timer expired.
+  void step(curl_socket_t s, int ev_bitmask);
+
+  // Cancel all jobs and step until they are finished.
+  void shutdown();
+
+  // Attach |job| on next step, the timer is fired at once.
+  virtual bool submit(LoopJob* job);
+
+  virtual ConnectionQuota* quota();
+
+ protected:
+  virtual EventDriver* createDriver();
+
+  void onSocketWatch(curl_socket_t s, int what);
+  void scheduleTimer(int32_t wait_ms);
+
+ protected:
+  ZoeExternalLoop::SocketFunctor socket_functor_;
+  ZoeExternalLoop::TimerFunctor timer_functor_;
+  bool canceled_;
+  ConnectionQuota quota_;
+};
+}  // namespace zoe
+#endif  // !ZOE_EXTERNAL_LOOP_IMPL_H_
@@ -0,0 +1,1060 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "file_backend.h"
+#include <assert.h>
+#include <algorithm>
+#include <memory>
+#include "file_util.h"
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+#include <io.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+// Mappings larger than this get the page cache hints.
+#define MMAP_LARGE_REGION_SIZE 268435456  // 256MB
+
+// Covers the logical block size of common disks.
+#define DIRECT_IO_ALIGNMENT 4096
+// Unaligned buffers are copied to an aligned one by pieces of this size.
+#define DIRECT_IO_BOUNCE_SIZE 1048576  // 1MB
+
+// Buffers merged into one pwritev.
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define POSIX_MAX_IOV IOV_MAX
+#else
+#define POSIX_MAX_IOV 1024
+#endif
+#endif
+#if defined(WITH_IO_URING)
+#include <vector>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 64
+#define URING_MAX_IO_SIZE 0x40000000  // len of a sqe is 32-bit
+#define URING_PROBE_OPS 256
+#endif
+
+namespace zoe {
+FileBackend* FileBackend::Create(FileIoEngine engine) {
+  if (engine == FileIoEngine::Stdio)
+    return new StdioFileBackend();
+#if defined(WITH_IO_URING)
+  if (engine == FileIoEngine::IoUring)
+    return new UringFileBackend();
+#endif
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+  if (engine == FileIoEngine::Mmap)
+    return new MmapFileBackend();
+  if (engine == FileIoEngine::Direct)
+    return new DirectFileBackend();
+  return new PosixFileBackend();
+#else
+  return new StdioFileBackend();
+#endif
+}
+
+void FileBackend::performBatch(FileIoRequest* requests, int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    FileIoRequest& r = requests[i];
+    r.result = (r.write ? write(r.pos, r.data, r.size) : read(r.pos, r.data, r.size));
+  }
+}
+
+StdioFileBackend::StdioFileBackend()
+    : f_(nullptr)
+    , file_seek_pos_(0L) {}
+
+StdioFileBackend::~StdioFileBackend() {
+  close();
+}
+
+bool StdioFileBackend::open(const utf8string& path) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  assert(f_ == nullptr);
+  if (f_)
+    return false;
+
+  f_ = FileUtil::Open(path, "rb+");
+  if (f_) {
+    file_seek_pos_ = 0L;
+    FileUtil::Seek(f_, 0L, SEEK_SET);
+  }
+  return (f_ != nullptr);
+}
+
+void StdioFileBackend::close() {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (f_) {
+    fflush(f_);
+    FileUtil::Close(f_);
+    f_ = nullptr;
+  }
+}
+
+bool StdioFileBackend::isOpened() const {
+  return (f_ != nullptr);
+}
+
+int64_t StdioFileBackend::write(int64_t pos, const void* data, int64_t data_size) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  assert(f_);
+  int64_t written = 0L;
+  do {
+    if (!f_)
+      break;
+    if (!data || data_size == 0)
+      break;
+    if (pos < 0)
+      break;
+
+    if (file_seek_pos_ != pos) {
+      if (FileUtil::Seek(f_, pos, SEEK_SET) != 0) {
+        assert(false);
+        break;
+      }
+      file_seek_pos_ = pos;
+    }
+
+    // Buffered by stdio until sync().
+    written = fwrite(data, 1, (long)data_size, f_);
+    assert(written == data_size);
+    file_seek_pos_ += written;
+  } while (false);
+
+  return written;
+}
+
+int64_t StdioFileBackend::read(int64_t pos, void* data, int64_t data_size) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (!f_ || !data || data_size <= 0 || pos < 0)
+    return 0L;
+
+  // Switching between writing and reading requires a seek.
+  if (FileUtil::Seek(f_, pos, SEEK_SET) != 0)
+    return 0L;
+
+  const int64_t read = (int64_t)fread(data, 1, (size_t)data_size, f_);
+  file_seek_pos_ = -1L;
+  return read;
+}
+
+int64_t StdioFileBackend::fileSize() {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (!f_)
+    return 0L;
+
+  const int64_t ret = FileUtil::GetFileSize(f_);
+  FileUtil::Seek(f_, file_seek_pos_, SEEK_SET);
+  return ret;
+}
+
+void StdioFileBackend::adviseSequentialRead(int64_t pos, int64_t size) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (f_) {
+    posix_fadvise(fileno(f_), (off_t)pos, (off_t)size, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fileno(f_), (off_t)pos, (off_t)size, POSIX_FADV_NOREUSE);
+  }
+#endif
+}
+
+bool StdioFileBackend::sync(bool to_disk) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (!f_)
+    return false;
+
+  if (fflush(f_) != 0)
+    return false;
+
+  if (!to_disk)
+    return true;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  return (_commit(_fileno(f_)) == 0);
+#else
+  return (fsync(fileno(f_)) == 0);
+#endif
+}
+
+FILE* StdioFileBackend::stream() const {
+  return f_;
+}
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+PosixFileBackend::PosixFileBackend() {
+  fd_.store(-1);
+}
+
+PosixFileBackend::~PosixFileBackend() {
+  close();
+}
+
+bool PosixFileBackend::open(const utf8string& path) {
+  assert(fd_.load() == -1);
+  if (fd_.load() != -1)
+    return false;
+
+  const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  fd_.store(fd);
+  return (fd != -1);
+}
+
+void PosixFileBackend::close() {
+  const int fd = fd_.exchange(-1);
+  if (fd != -1)
+    ::close(fd);
+}
+
+bool PosixFileBackend::isOpened() const {
+  return (fd_.load() != -1);
+}
+
+int64_t PosixFileBackend::write(int64_t pos, const void* data, int64_t data_size) {
+  const int fd = fd_.load();
+  assert(fd != -1);
+  if (fd == -1 || !data || data_size <= 0 || pos < 0)
+    return 0L;
+
+  // pwrite may write less than requested, e.g. interrupted by a signal.
+  int64_t written = 0L;
+  while (written < data_size) {
+    const ssize_t n = pwrite(fd, (const char*)data + written, (size_t)(data_size - written), (off_t)(pos + written));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (n == 0)
+      break;
+    written += n;
+  }
+
+  assert(written == data_size);
+  return written;
+}
+
+int64_t PosixFileBackend::read(int64_t pos, void* data, int64_t data_size) {
+  const int fd = fd_.load();
+  if (fd == -1 || !data || data_size <= 0 || pos < 0)
+    return 0L;
+
+  int64_t read = 0L;
+  while (read < data_size) {
+    const ssize_t n = pread(fd, (char*)data + read, (size_t)(data_size - read), (off_t)(pos + read));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (n == 0)
+      break;  // end of file
+    read += n;
+  }
+  return read;
+}
+
+void PosixFileBackend::performBatch(FileIoRequest* requests, int32_t count) {
+  std::vector<int32_t> writes;
+  for (int32_t i = 0; i < count; i++) {
+    FileIoRequest& r = requests[i];
+    r.result = 0L;
+    if (!r.write)
+      r.result = read(r.pos, r.data, r.size);
+    else if (r.data && r.size > 0 && r.pos >= 0)
+      writes.push_back(i);
+  }
+
+  std::sort(writes.begin(), writes.end(), [requests](int32_t a, int32_t b) {
+    return requests[a].pos < requests[b].pos;
+  });
+
+  std::vector<struct iovec> iov;
+  size_t begin = 0;
+  while (begin < writes.size()) {
+    // The writes that continue the previous one, overlapped writes are not merged.
+    size_t end = begin + 1;
+    int64_t run_end = requests[writes[begin]].pos + requests[writes[begin]].size;
+    while (end < writes.size() && end - begin < POSIX_MAX_IOV && requests[writes[end]].pos == run_end) {
+      run_end += requests[writes[end]].size;
+      end++;
+    }
+
+    if (end - begin == 1) {
+      FileIoRequest& r = requests[writes[begin]];
+      r.result = write(r.pos, r.data, r.size);
+      begin = end;
+      continue;
+    }
+
+    iov.resize(end - begin);
+    for (size_t i = begin; i < end; i++) {
+      iov[i - begin].iov_base = requests[writes[i]].data;
+      iov[i - begin].iov_len = (size_t)requests[writes[i]].size;
+    }
+    int64_t written = writeVector(requests[writes[begin]].pos, iov.data(), (int32_t)iov.size());
+
+    // A short write is charged to the requests in order.
+    for (size_t i = begin; i < end; i++) {
+      FileIoRequest& r = requests[writes[i]];
+      r.result = std::min(written, r.size);
+      written -= r.result;
+    }
+    begin = end;
+  }
+}
+
+int64_t PosixFileBackend::writeVector(int64_t pos, struct iovec* iov, int32_t count) {
+  const int fd = fd_.load();
+  assert(fd != -1);
+  if (fd == -1)
+    return 0L;
+
+  int64_t written = 0L;
+  int32_t index = 0;
+  while (index < count) {
+    const ssize_t n = pwritev(fd, iov + index, count - index, (off_t)(pos + written));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (n == 0)
+      break;
+    written += n;
+
+    // Skip the buffers that have been written, the rest of a partial one goes next time.
+    size_t left = (size_t)n;
+    while (index < count && left >= iov[index].iov_len) {
+      left -= iov[index].iov_len;
+      index++;
+    }
+    if (index < count && left > 0) {
+      iov[index].iov_base = (char*)iov[index].iov_base + left;
+      iov[index].iov_len -= left;
+    }
+  }
+  return written;
+}
+
+int64_t PosixFileBackend::fileSize() {
+  const int fd = fd_.load();
+  if (fd == -1)
+    return 0L;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return -1L;
+  return (int64_t)st.st_size;
+}
+
+void PosixFileBackend::adviseSequentialRead(int64_t pos, int64_t size) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+  const int fd = fd_.load();
+  if (fd != -1) {
+    posix_fadvise(fd, (off_t)pos, (off_t)size, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, (off_t)pos, (off_t)size, POSIX_FADV_NOREUSE);
+  }
+#endif
+}
+
+bool PosixFileBackend::sync(bool to_disk) {
+  const int fd = fd_.load();
+  if (fd == -1)
+    return false;
+
+  // pwrite has no user space buffer.
+  if (!to_disk)
+    return true;
+#if defined(__APPLE__) && defined(__MACH__)
+  return (fsync(fd) == 0);
+#else
+  return (fdatasync(fd) == 0);
+#endif
+}
+#endif
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+MmapFileBackend::MmapFileBackend()
+    : mapping_(nullptr)
+    , mapping_size_(0L) {}
+
+MmapFileBackend::~MmapFileBackend() {
+  close();
+}
+
+bool MmapFileBackend::open(const utf8string& path) {
+  if (!PosixFileBackend::open(path))
+    return false;
+
+  // The size of a file that has unknown size grows by writing, it can not be mapped.
+  const int64_t file_size = fileSize();
+  if (file_size <= 0 || (uint64_t)file_size > (uint64_t)SIZE_MAX)
+    return true;
+
+  // The created file is sparse, reserve its blocks.
+#if defined(__APPLE__) && defined(__MACH__)
+  const bool reserved = true;
+#else
+  const bool reserved = (posix_fallocate(fd_.load(), 0, (off_t)file_size) == 0);
+#endif
+  if (!reserved)
+    return true;
+
+  void* p = mmap(nullptr, (size_t)file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.load(), 0);
+  if (p == MAP_FAILED)
+    return true;
+
+  mapping_ = (char*)p;
+  mapping_size_ = file_size;
+
+  // Each slice writes its range from the beginning to the end.
+  if (mapping_size_ >= MMAP_LARGE_REGION_SIZE)
+    madvise(mapping_, (size_t)mapping_size_, MADV_SEQUENTIAL);
+  return true;
+}
+
+void MmapFileBackend::close() {
+  if (mapping_) {
+    munmap(mapping_, (size_t)mapping_size_);
+    mapping_ = nullptr;
+    mapping_size_ = 0L;
+  }
+  PosixFileBackend::close();
+}
+
+int64_t MmapFileBackend::write(int64_t pos, const void* data, int64_t data_size) {
+  if (!mapping_ || pos < 0 || data_size <= 0 || pos + data_size > mapping_size_)
+    return PosixFileBackend::write(pos, data, data_size);
+
+  memcpy(mapping_ + pos, data, (size_t)data_size);
+  return data_size;
+}
+
+int64_t MmapFileBackend::read(int64_t pos, void* data, int64_t data_size) {
+  if (!mapping_ || pos < 0 || data_size <= 0 || pos >= mapping_size_)
+    return PosixFileBackend::read(pos, data, data_size);
+
+  const int64_t size = std::min(data_size, mapping_size_ - pos);
+  memcpy(data, mapping_ + pos, (size_t)size);
+  return size;
+}
+
+void MmapFileBackend::performBatch(FileIoRequest* requests, int32_t count) {
+  FileBackend::performBatch(requests, count);
+}
+
+bool MmapFileBackend::sync(bool to_disk) {
+  if (!mapping_)
+    return PosixFileBackend::sync(to_disk);
+
+  // The mapping is shared with the page cache.
+  if (!to_disk)
+    return true;
+
+  if (msync(mapping_, (size_t)mapping_size_, MS_SYNC) != 0)
+    return false;
+
+  // The written back pages are clean, let the kernel reclaim them first.
+  if (mapping_size_ >= MMAP_LARGE_REGION_SIZE) {
+    madvise(mapping_, (size_t)mapping_size_, MADV_DONTNEED);
+#if !defined(__APPLE__) || !defined(__MACH__)
+    posix_fadvise(fd_.load(), 0, (off_t)mapping_size_, POSIX_FADV_DONTNEED);
+#endif
+  }
+  return true;
+}
+
+bool MmapFileBackend::isMapped() const {
+  return (mapping_ != nullptr);
+}
+#endif
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+DirectFileBackend::DirectFileBackend() {
+  direct_fd_.store(-1);
+}
+
+DirectFileBackend::~DirectFileBackend() {
+  close();
+}
+
+bool DirectFileBackend::open(const utf8string& path) {
+  if (!PosixFileBackend::open(path))
+    return false;
+
+#if defined(O_DIRECT)
+  // Not an error, e.g. tmpfs does not support O_DIRECT.
+  direct_fd_.store(::open(path.c_str(), O_RDWR | O_CLOEXEC | O_DIRECT));
+#endif
+  return true;
+}
+
+void DirectFileBackend::close() {
+  const int fd = direct_fd_.exchange(-1);
+  if (fd != -1)
+    ::close(fd);
+  PosixFileBackend::close();
+}
+
+void DirectFileBackend::performBatch(FileIoRequest* requests, int32_t count) {
+  FileBackend::performBatch(requests, count);
+}
+
+int64_t DirectFileBackend::ioAlignment() const {
+  return (direct_fd_.load() != -1 ? DIRECT_IO_ALIGNMENT : 1);
+}
+
+int64_t DirectFileBackend::write(int64_t pos, const void* data, int64_t data_size) {
+  const int64_t written = transfer(true, pos, (char*)data, data_size);
+  assert(written == data_size);
+  return written;
+}
+
+int64_t DirectFileBackend::read(int64_t pos, void* data, int64_t data_size) {
+  return transfer(false, pos, (char*)data, data_size);
+}
+
+int64_t DirectFileBackend::transfer(bool write, int64_t pos, char* data, int64_t data_size) {
+  if (!data || data_size <= 0 || pos < 0)
+    return 0L;
+
+  const int64_t end = pos + data_size;
+  const int64_t middle_begin = (pos + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+  const int64_t middle_end = end / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+  if (direct_fd_.load() == -1 || middle_begin >= middle_end) {
+    return (write ? PosixFileBackend::write(pos, data, data_size)
+                  : PosixFileBackend::read(pos, data, data_size));
+  }
+
+  int64_t done = 0L;
+  if (middle_begin > pos) {
+    const int64_t head = middle_begin - pos;
+    done = (write ? PosixFileBackend::write(pos, data, head) : PosixFileBackend::read(pos, data, head));
+    if (done != head)
+      return done;
+  }
+
+  const int64_t middle = middle_end - middle_begin;
+  const int64_t n = transferDirect(write, middle_begin, data + done, middle);
+  done += n;
+  if (n != middle || middle_end == end)
+    return done;
+
+  const int64_t tail = end - middle_end;
+  done += (write ? PosixFileBackend::write(middle_end, data + done, tail)
+                 : PosixFileBackend::read(middle_end, data + done, tail));
+  return done;
+}
+
+int64_t DirectFileBackend::transferDirect(bool write, int64_t pos, char* data, int64_t data_size) {
+  const int fd = direct_fd_.load();
+  char* bounce = nullptr;
+  if ((uintptr_t)data % DIRECT_IO_ALIGNMENT != 0) {
+    void* p = nullptr;
+    if (posix_memalign(&p, DIRECT_IO_ALIGNMENT, (size_t)std::min(data_size, (int64_t)DIRECT_IO_BOUNCE_SIZE)) != 0)
+      return 0L;
+    bounce = (char*)p;
+  }
+
+  int64_t done = 0L;
+  while (done < data_size) {
+    const int64_t piece = (bounce ? std::min(data_size - done, (int64_t)DIRECT_IO_BOUNCE_SIZE) : data_size - done);
+    char* buffer = (bounce ? bounce : data + done);
+    if (bounce && write)
+      memcpy(bounce, data + done, (size_t)piece);
+
+    const ssize_t n = (write ? pwrite(fd, buffer, (size_t)piece, (off_t)(pos + done))
+                             : pread(fd, buffer, (size_t)piece, (off_t)(pos + done)));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (bounce && !write)
+      memcpy(data + done, bounce, (size_t)n);
+    done += n;
+
+    // End of file, or a short write that leaves the position unaligned.
+    if (n < piece)
+      break;
+  }
+
+  if (bounce)
+    free(bounce);
+  return done;
+}
+#endif
+
+#if defined(WITH_IO_URING)
+static int UringSetup(unsigned entries, struct io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int UringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int UringRegister(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+UringFileBackend::UringFileBackend()
+    : ring_fd_(-1)
+    , ring_entries_(0)
+    , buffers_registered_(false)
+    , sq_ring_(nullptr)
+    , sq_ring_size_(0)
+    , sq_head_(nullptr)
+    , sq_tail_(nullptr)
+    , sq_mask_(nullptr)
+    , sq_array_(nullptr)
+    , sqes_(nullptr)
+    , sqes_size_(0)
+    , cq_ring_(nullptr)
+    , cq_ring_size_(0)
+    , cq_head_(nullptr)
+    , cq_tail_(nullptr)
+    , cq_mask_(nullptr)
+    , cqes_(nullptr) {}
+
+UringFileBackend::~UringFileBackend() {
+  close();
+}
+
+bool UringFileBackend::open(const utf8string& path) {
+  if (!PosixFileBackend::open(path))
+    return false;
+
+  // Not an error, the requests are done by pwrite/pread.
+  std::lock_guard<std::mutex> lg(ring_mutex_);
+  setupRing();
+  return true;
+}
+
+void UringFileBackend::close() {
+  {
+    std::lock_guard<std::mutex> lg(ring_mutex_);
+    teardownRing();
+  }
+  PosixFileBackend::close();
+}
+
+bool UringFileBackend::ringEnabled() const {
+  return (ring_fd_ != -1);
+}
+
+bool UringFileBackend::setupRing() {
+  assert(ring_fd_ == -1);
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int ring_fd = UringSetup(URING_ENTRIES, &params);
+  if (ring_fd < 0)
+    return false;
+  ring_fd_ = ring_fd;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+  if (single_mmap) {
+    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    cq_ring_size_ = sq_ring_size_;
+  }
+
+  void* p = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (p == MAP_FAILED) {
+    teardownRing();
+    return false;
+  }
+  sq_ring_ = p;
+
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  }
+  else {
+    p = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (p == MAP_FAILED) {
+      teardownRing();
+      return false;
+    }
+    cq_ring_ = p;
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  p = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (p == MAP_FAILED) {
+    teardownRing();
+    return false;
+  }
+  sqes_ = (struct io_uring_sqe*)p;
+
+  char* sq = (char*)sq_ring_;
+  sq_head_ = (uint32_t*)(sq + params.sq_off.head);
+  sq_tail_ = (uint32_t*)(sq + params.sq_off.tail);
+  sq_mask_ = (uint32_t*)(sq + params.sq_off.ring_mask);
+  sq_array_ = (uint32_t*)(sq + params.sq_off.array);
+
+  char* cq = (char*)cq_ring_;
+  cq_head_ = (uint32_t*)(cq + params.cq_off.head);
+  cq_tail_ = (uint32_t*)(cq + params.cq_off.tail);
+  cq_mask_ = (uint32_t*)(cq + params.cq_off.ring_mask);
+  cqes_ = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  ring_entries_ = params.sq_entries;
+
+  // The ring can be set up since Linux 5.1, but IORING_OP_READ/WRITE are supported since 5.6.
+  if (!probeOpcodes()) {
+    teardownRing();
+    return false;
+  }
+  return true;
+}
+
+bool UringFileBackend::probeOpcodes() {
+  const size_t probe_size = sizeof(struct io_uring_probe) + URING_PROBE_OPS * sizeof(struct io_uring_probe_op);
+  std::unique_ptr<char[]> memory(new char[probe_size]);
+  memset(memory.get(), 0, probe_size);
+  struct io_uring_probe* probe = (struct io_uring_probe*)memory.get();
+
+  // IORING_REGISTER_PROBE is added by Linux 5.6 too, it fails on the older kernels.
+  if (UringRegister(ring_fd_, IORING_REGISTER_PROBE, probe, URING_PROBE_OPS) != 0)
+    return false;
+
+  const uint8_t opcodes[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED};
+  for (uint8_t op : opcodes) {
+    if (op >= probe->ops_len || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+      return false;
+  }
+  return true;
+}
+
+void UringFileBackend::teardownRing() {
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = nullptr;
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  cq_ring_ = nullptr;
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = nullptr;
+  }
+
+  // The registered buffers are released with the ring.
+  if (ring_fd_ != -1) {
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+  buffers_registered_ = false;
+  ring_entries_ = 0;
+}
+
+int64_t UringFileBackend::write(int64_t pos, const void* data, int64_t data_size) {
+  FileIoRequest request = {true, pos, (void*)data, data_size, -1, 0L};
+  performBatch(&request, 1);
+  assert(request.result == data_size);
+  return request.result;
+}
+
+int64_t UringFileBackend::read(int64_t pos, void* data, int64_t data_size) {
+  FileIoRequest request = {false, pos, data, data_size, -1, 0L};
+  performBatch(&request, 1);
+  return request.result;
+}
+
+void UringFileBackend::performBatch(FileIoRequest* requests, int32_t count) {
+  if (count <= 0)
+    return;
+
+  std::unique_ptr<bool[]> finished(new bool[count]);
+  for (int32_t i = 0; i < count; i++) {
+    requests[i].result = 0L;
+    finished[i] = (fd_.load() == -1 || !requests[i].data || requests[i].size <= 0 || requests[i].pos < 0);
+  }
+
+  {
+    std::lock_guard<std::mutex> lg(ring_mutex_);
+    std::vector<int32_t> indexes;
+    while (ring_fd_ != -1) {
+      // Short reads and writes are submitted again for the rest.
+      indexes.clear();
+      for (int32_t i = 0; i < count; i++) {
+        if (!finished[i])
+          indexes.push_back(i);
+      }
+      if (indexes.empty())
+        break;
+
+      for (size_t begin = 0; begin < indexes.size(); begin += ring_entries_) {
+        const int32_t n = (int32_t)std::min((size_t)ring_entries_, indexes.size() - begin);
+        if (!submitAndWait(requests, &indexes[begin], n, finished.get())) {
+          teardownRing();
+          break;
+        }
+      }
+    }
+  }
+
+  // Without the ring.
+  for (int32_t i = 0; i < count; i++) {
+    if (finished[i])
+      continue;
+
+    FileIoRequest& r = requests[i];
+    if (r.write)
+      r.result += PosixFileBackend::write(r.pos + r.result, (const char*)r.data + r.result, r.size - r.result);
+    else
+      r.result += PosixFileBackend::read(r.pos + r.result, (char*)r.data + r.result, r.size - r.result);
+  }
+}
+
+bool UringFileBackend::submitAndWait(FileIoRequest* requests, const int32_t* indexes, int32_t count, bool* finished) {
+  const uint32_t sq_mask = *sq_mask_;
+  uint32_t tail = *sq_tail_;
+  for (int32_t k = 0; k < count; k++) {
+    const FileIoRequest& r = requests[indexes[k]];
+    const bool fixed = (buffers_registered_ && r.buffer_index >= 0);
+
+    struct io_uring_sqe* sqe = &sqes_[tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    if (r.write)
+      sqe->opcode = (fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+    else
+      sqe->opcode = (fixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+    sqe->fd = fd_.load();
+    sqe->off = (uint64_t)(r.pos + r.result);
+    sqe->addr = (uint64_t)(uintptr_t)((char*)r.data + r.result);
+    sqe->len = (uint32_t)std::min(r.size - r.result, (int64_t)URING_MAX_IO_SIZE);
+    if (fixed)
+      sqe->buf_index = (uint16_t)r.buffer_index;
+    sqe->user_data = (uint64_t)indexes[k];
+
+    sq_array_[tail & sq_mask] = (tail & sq_mask);
+    tail++;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  bool ring_ok = true;
+  int32_t submitted = 0;
+  while (submitted < count) {
+    const int ret = UringEnter(ring_fd_, (unsigned)(count - submitted), 0, 0);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      ring_ok = false;
+      break;
+    }
+    submitted += ret;
+  }
+
+  const uint32_t cq_mask = *cq_mask_;
+  uint32_t head = *cq_head_;
+  int32_t reaped = 0;
+  while (reaped < submitted) {
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      const int ret = UringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+      if (ret < 0 && errno != EINTR) {
+        ring_ok = false;
+        break;
+      }
+      continue;
+    }
+
+    const struct io_uring_cqe* cqe = &cqes_[head & cq_mask];
+    const int32_t i = (int32_t)cqe->user_data;
+    if (cqe->res > 0) {
+      requests[i].result += cqe->res;
+      finished[i] = (requests[i].result >= requests[i].size);
+    }
+    else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+      // The opcode is rejected by the kernel, the request is done by pwrite/pread without the ring.
+      ring_ok = false;
+    }
+    else if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+      finished[i] = true;  // end of file or error
+    }
+
+    head++;
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    reaped++;
+  }
+
+  return ring_ok;
+}
+
+bool UringFileBackend::registerBuffers(void* const* buffers, int64_t buffer_size, int32_t count) {
+  std::lock_guard<std::mutex> lg(ring_mutex_);
+  if (ring_fd_ == -1 || buffers_registered_ || !buffers || buffer_size <= 0 || count <= 0)
+    return false;
+
+  std::vector<struct iovec> iovecs((size_t)count);
+  for (int32_t i = 0; i < count; i++) {
+    iovecs[i].iov_base = buffers[i];
+    iovecs[i].iov_len = (size_t)buffer_size;
+  }
+
+  // May fail by the limit of locked memory.
+  if (UringRegister(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(), (unsigned)count) != 0)
+    return false;
+
+  buffers_registered_ = true;
+  return true;
+}
+
+void UringFileBackend::unregisterBuffers() {
+  std::lock_guard<std::mutex> lg(ring_mutex_);
+  if (ring_fd_ != -1 && buffers_registered_)
+    UringRegister(ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+  buffers_registered_ = false;
+}
+#endif
+StreamFileBackend::StreamFileBackend(StreamFunctor functor,
+                                     int64_t window_size,
+                                     std::unique_ptr<Hasher> hasher,
+                                     HashType hash_type)
+    : functor_(functor)
+    , window_size_(window_size)
+    , hasher_(std::move(hasher))
+    , hash_type_(hash_type)
+    , opened_(false)
+    , pending_bytes_(0L) {
+  delivered_.store(0L);
+  failed_.store(false);
+}
+
+StreamFileBackend::~StreamFileBackend() {
+  close();
+}
+
+bool StreamFileBackend::open(const utf8string& path) {
+  opened_ = true;
+  return true;
+}
+
+void StreamFileBackend::close() {
+  std::lock_guard<std::mutex> lg(mutex_);
+  opened_ = false;
+  pending_.clear();
+  pending_bytes_ = 0L;
+}
+
+bool StreamFileBackend::isOpened() const {
+  return opened_;
+}
+
+bool StreamFileBackend::deliver(const char* data, int64_t data_size) {
+  if (hasher_)
+    hasher_->update(data, (size_t)data_size);
+  delivered_ += data_size;
+
+  if (functor_ && !functor_(data, data_size)) {
+    failed_.store(true);
+    return false;
+  }
+  return true;
+}
+
+int64_t StreamFileBackend::write(int64_t pos, const void* data, int64_t data_size) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (failed_.load() || data_size <= 0)
+    return 0L;
+
+  const char* p = (const char*)data;
+  const int64_t end = pos + data_size;
+  int64_t delivered = delivered_.load();
+  if (end <= delivered)
+    return data_size;  // received again by a retry or a hedge
+
+  if (pos > delivered) {
+    std::vector<char>& buffer = pending_[pos];
+    if ((int64_t)buffer.size() < data_size) {
+      pending_bytes_ += (data_size - (int64_t)buffer.size());
+      buffer.assign(p, p + data_size);
+    }
+    return data_size;
+  }
+
+  if (!deliver(p + (delivered - pos), end - delivered))
+    return 0L;
+
+  // Drain the data that has become contiguous, the ranges may overlap.
+  while (!pending_.empty() && !failed_.load()) {
+    auto it = pending_.begin();
+    delivered = delivered_.load();
+    if (it->first > delivered)
+      break;
+
+    const int64_t it_end = it->first + (int64_t)it->second.size();
+    if (it_end > delivered)
+      deliver(it->second.data() + (delivered - it->first), it_end - delivered);
+    pending_bytes_ -= (int64_t)it->second.size();
+    pending_.erase(it);
+  }
+
+  return (failed_.load() ? 0L : data_size);
+}
+
+int64_t StreamFileBackend::read(int64_t pos, void* data, int64_t data_size) {
+  return 0L;
+}
+
+bool StreamFileBackend::writable(int64_t pos, int64_t data_size) const {
+  // A failed stream accepts everything, the writes fail at once.
+  if (failed_.load())
+    return true;
+
+  const int64_t delivered = delivered_.load();
+  return (pos <= delivered || pos + data_size <= delivered + window_size_);
+}
+
+int64_t StreamFileBackend::fileSize() {
+  return delivered_.load();
+}
+
+bool StreamFileBackend::sync(bool to_disk) {
+  return !failed_.load();
+}
+
+bool StreamFileBackend::hash(HashType type, utf8string& str_hash) {
+  std::lock_guard<std::mutex> lg(mutex_);
+  if (!hasher_ || type != hash_type_)
+    return false;
+
+  if (hash_.empty())
+    hash_ = hasher_->final();
+  str_hash = hash_;
+  return true;
+}
+
+bool StreamFileBackend::failed() const {
+  return failed_.load();
+}
+
+}  // namespace zoe
@@ -0,0 +1,297 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_FILE_BACKEND_H_
+#define ZOE_FILE_BACKEND_H_
+#pragma once
+
+#include <stdio.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include "zoe/zoe.h"
+#include "hasher.h"
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+struct iovec;
+#endif
+
+#if defined(WITH_IO_URING)
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace zoe {
+// One read or write of FileBackend::performBatch.
+struct FileIoRequest {
+  bool write;
+  int64_t pos;
+  void* data;
+  int64_t size;
+  int32_t buffer_index;  // index of the registered buffer that contains |data|, -1 if none
+  int64_t result;        // bytes transferred, set by the backend
+};
+
+// Reads and writes the temporary file at explicit positions.
+class FileBackend {
+ public:
+  // Create the backend of |engine|, an unsupported engine falls back to the preferred backend
+  // of current platform.
+  static FileBackend* Create(FileIoEngine engine);
+
+  virtual ~FileBackend() {}
+
+  // Open an existing file for reading and writing.
+  virtual bool open(const utf8string& path) = 0;
+  virtual void close() = 0;
+  virtual bool isOpened() const = 0;
+
+  // Write |data_size| bytes at |pos|, return the number of bytes written.
+  // Thread-safe, writes at different positions may run in parallel.
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size) = 0;
+
+  // Read |data_size| bytes at |pos|, return the number of bytes read, less at the end of file.
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size) = 0;
+
+  // Perform the requests, the backend may submit them together. Thread-safe.
+  virtual void performBatch(FileIoRequest* requests, int32_t count);
+
+  // Writes are copied into a mapping of the file, there is no need to cache or queue them.
+  virtual bool isMapped() const { return false; }
+
+  // Requests whose position, size and buffer are aligned to this value are done without copying.
+  virtual int64_t ioAlignment() const { return 1; }
+
+  // Whether |data_size| bytes at |pos| can be written without exceeding the memory bound of the
+  // backend, the writer should pause otherwise.
+  virtual bool writable(int64_t pos, int64_t data_size) const { return true; }
+
+  // Register the buffers used by the requests, so they are not mapped by the kernel on each
+  // request. Return false if not supported.
+  virtual bool registerBuffers(void* const* buffers, int64_t buffer_size, int32_t count) { return false; }
+  virtual void unregisterBuffers() {}
+
+  virtual int64_t fileSize() = 0;
+
+  // [pos, pos + size) will be read once in order, e.g. to calculate the hash. Only a hint.
+  virtual void adviseSequentialRead(int64_t pos, int64_t size) {}
+
+  // Hand the written data to the OS, and if |to_disk| is true, wait until it is on the disk.
+  virtual bool sync(bool to_disk) = 0;
+
+  // The stdio stream of the opened file, nullptr if the backend does not use stdio.
+  virtual FILE* stream() const { return nullptr; }
+};
+
+// FILE* with fseek + fwrite, writes are serialized by a mutex. Available on all platforms.
+class StdioFileBackend : public FileBackend {
+ public:
+  StdioFileBackend();
+  virtual ~StdioFileBackend();
+
+  virtual bool open(const utf8string& path);
+  virtual void close();
+  virtual bool isOpened() const;
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size);
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size);
+  virtual int64_t fileSize();
+  virtual void adviseSequentialRead(int64_t pos, int64_t size);
+  virtual bool sync(bool to_disk);
+  virtual FILE* stream() const;
+
+ protected:
+  FILE* f_;
+  int64_t file_seek_pos_;
+  std::mutex mutex_;
+};
+
+// No file, the data is delivered to the StreamFunctor in file order. The data written ahead of
+// the delivered position is held in memory until the gap before it is filled, the data that has
+// been delivered is skipped, so a range can be written again by a retry or a hedge.
+class StreamFileBackend : public FileBackend {
+ public:
+  // |hasher| is fed with the delivered data, may be nullptr.
+  StreamFileBackend(StreamFunctor functor, int64_t window_size, std::unique_ptr<Hasher> hasher, HashType hash_type);
+  virtual ~StreamFileBackend();
+
+  virtual bool open(const utf8string& path);
+  virtual void close();
+  virtual bool isOpened() const;
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size);
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size);
+  virtual bool writable(int64_t pos, int64_t data_size) const;
+  virtual int64_t fileSize();  // bytes delivered
+  virtual bool sync(bool to_disk);
+
+  // The hash of the delivered data, false if there is no hasher of |type|.
+  bool hash(HashType type, utf8string& str_hash);
+
+  // The functor returned false, all following writes fail.
+  bool failed() const;
+
+ protected:
+  // Hand |data_size| bytes at delivered_ to the functor.
+  bool deliver(const char* data, int64_t data_size);
+
+ protected:
+  StreamFunctor functor_;
+  int64_t window_size_;
+  std::unique_ptr<Hasher> hasher_;
+  HashType hash_type_;
+  utf8string hash_;
+  bool opened_;
+
+  std::atomic<int64_t> delivered_;
+  std::atomic<bool> failed_;
+  std::map<int64_t, std::vector<char>> pending_;  // position -> data written ahead
+  int64_t pending_bytes_;
+  std::mutex mutex_;  // one functor call at a time
+};
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+// File descriptor with pwrite, there is no shared seek position, so no lock is needed.
+// The writes of a batch are sorted by position, adjacent ones are merged into one pwritev.
+class PosixFileBackend : public FileBackend {
+ public:
+  PosixFileBackend();
+  virtual ~PosixFileBackend();
+
+  virtual bool open(const utf8string& path);
+  virtual void close();
+  virtual bool isOpened() const;
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size);
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size);
+  virtual void performBatch(FileIoRequest* requests, int32_t count);
+  virtual int64_t fileSize();
+  virtual void adviseSequentialRead(int64_t pos, int64_t size);
+  virtual bool sync(bool to_disk);
+
+ protected:
+  // Write the buffers of |iov| one after another from |pos|, |iov| is modified.
+  int64_t writeVector(int64_t pos, struct iovec* iov, int32_t count);
+
+ protected:
+  std::atomic<int> fd_;
+};
+#endif
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+// The whole file is mapped by mmap, writes and reads are memcpy. The disk space is reserved when
+// opened, a page fault on a full disk would raise SIGBUS.
+// Uses pwrite/pread if the file is empty or can not be mapped.
+class MmapFileBackend : public PosixFileBackend {
+ public:
+  MmapFileBackend();
+  virtual ~MmapFileBackend();
+
+  virtual bool open(const utf8string& path);
+  virtual void close();
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size);
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size);
+  virtual void performBatch(FileIoRequest* requests, int32_t count);  // one by one, memcpy
+  virtual bool sync(bool to_disk);
+  virtual bool isMapped() const;
+
+ protected:
+  char* mapping_;
+  int64_t mapping_size_;
+};
+#endif
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+// The aligned blocks of a request bypass the page cache by a second O_DIRECT descriptor, the
+// unaligned head and tail are done by the buffered descriptor. A block is only written by one
+// request, except the fragments, so the two descriptors do not overlap.
+// Uses pwrite/pread only if the file system does not support O_DIRECT.
+class DirectFileBackend : public PosixFileBackend {
+ public:
+  DirectFileBackend();
+  virtual ~DirectFileBackend();
+
+  virtual bool open(const utf8string& path);
+  virtual void close();
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size);
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size);
+  virtual void performBatch(FileIoRequest* requests, int32_t count);  // one by one, see transfer
+  virtual int64_t ioAlignment() const;
+
+ protected:
+  int64_t transfer(bool write, int64_t pos, char* data, int64_t data_size);
+  int64_t transferDirect(bool write, int64_t pos, char* data, int64_t data_size);
+
+ protected:
+  std::atomic<int> direct_fd_;
+};
+#endif
+
+#if defined(WITH_IO_URING)
+// io_uring through system calls, the requests of a batch are submitted by one io_uring_enter.
+// Uses pwrite/pread if the kernel does not support io_uring.
+class UringFileBackend : public PosixFileBackend {
+ public:
+  UringFileBackend();
+  virtual ~UringFileBackend();
+
+  virtual bool open(const utf8string& path);
+  virtual void close();
+  virtual int64_t write(int64_t pos, const void* data, int64_t data_size);
+  virtual int64_t read(int64_t pos, void* data, int64_t data_size);
+  virtual void performBatch(FileIoRequest* requests, int32_t count);
+  virtual bool registerBuffers(void* const* buffers, int64_t buffer_size, int32_t count);
+  virtual void unregisterBuffers();
+
+  bool ringEnabled() const;
+
+ protected:
+  bool setupRing();
+  void teardownRing();
+  // Whether the kernel supports the opcodes submitted by submitAndWait.
+  bool probeOpcodes();
+
+  // Submit the unfinished requests and wait for their completions, return false if the ring
+  // failed.
+  bool submitAndWait(FileIoRequest* requests, const int32_t* indexes, int32_t count, bool* finished);
+
+ protected:
+  int ring_fd_;
+  uint32_t ring_entries_;
+  bool buffers_registered_;
+
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  uint32_t* sq_head_;
+  uint32_t* sq_tail_;
+  uint32_t* sq_mask_;
+  uint32_t* sq_array_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  uint32_t* cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  std::mutex ring_mutex_;  // one submitter at a time
+};
+#endif
+}  // namespace zoe
+#endif  // !ZOE_FILE_BACKEND_H_
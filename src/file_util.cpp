@@ -26,6 +26,7 @@
 #include <fileapi.h>
 #else
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -201,7 +202,13 @@ void FileUtil::Close(FILE* f) {
   }
 }
 
-bool FileUtil::CreateFixedSizeFile(const utf8string& path, int64_t fixed_size) {
+bool FileUtil::CreateFixedSizeFile(const utf8string& path,
+                                   int64_t fixed_size,
+                                   PreallocatePolicy policy,
+                                   bool* no_space) {
+  if (no_space)
+    *no_space = false;
+
   utf8string str_dir = GetDirectory(path);
   if (!str_dir.empty() && !IsExist(str_dir)) {
     if (!CreateDirectories(str_dir))
@@ -223,8 +230,12 @@ bool FileUtil::CreateFixedSizeFile(const utf8string& path, int64_t fixed_size) {
     if (SetFilePointerEx(h, offset, NULL, FILE_BEGIN) == 0)
       break;
 
-    if (!SetEndOfFile(h))
+    // NTFS allocates the clusters of the new length.
+    if (!SetEndOfFile(h)) {
+      if (GetLastError() == ERROR_DISK_FULL && no_space)
+        *no_space = true;
       break;
+    }
 
     prealloc = true;
   } while (false);
@@ -238,6 +249,10 @@ bool FileUtil::CreateFixedSizeFile(const utf8string& path, int64_t fixed_size) {
     return true;
   }
 
+  if (no_space && *no_space) {
+    return false;
+  }
+
   // Candidacy
   //
   FILE* f = nullptr;
@@ -277,38 +292,70 @@ bool FileUtil::CreateFixedSizeFile(const utf8string& path, int64_t fixed_size) {
   if (fd == -1) {
     return false;
   }
+  bool ret = true;
   if (fixed_size > 0) {
-    fstore_t fstore = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0,
-                       fixed_size, 0};
-    if (fcntl(fd, F_PREALLOCATE, &fstore) == -1) {
-      // Retry non-contig.
-      fstore.fst_flags = F_ALLOCATEALL;
+    int err = 0;
+    if (policy != PreallocatePolicy::Sparse) {
+      fstore_t fstore = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0,
+                         fixed_size, 0};
       if (fcntl(fd, F_PREALLOCATE, &fstore) == -1) {
-        //int err = errno;
-        close(fd);
-        return false;
+        // Retry non-contig.
+        fstore.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &fstore) == -1)
+          err = errno;
       }
     }
-    // This forces the allocation on disk.
-    ftruncate(fd, fixed_size);
+
+    if (err == ENOSPC || err == EDQUOT) {
+      if (no_space)
+        *no_space = true;
+      ret = false;
+    }
+    else if (err != 0 && policy == PreallocatePolicy::Reserve) {
+      ret = false;
+    }
+    else {
+      // This forces the allocation on disk.
+      ret = (ftruncate(fd, fixed_size) == 0);
+    }
   }
   close(fd);
-  return true;
+  return ret;
 #else
   int fd = open(path.c_str(), O_RDWR | O_CREAT,
                 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
   if (fd == -1) {
     return false;
   }
+  bool ret = true;
   if (fixed_size > 0) {
-    if (fallocate(fd, 0, 0, fixed_size) != 0) {
-      close(fd);
-      return false;
+    int err = 0;
+    if (policy != PreallocatePolicy::Sparse) {
+#if defined(__linux__)
+      // Unlike posix_fallocate, fallocate does not fall back to writing each block if the file
+      // system does not support it. The length is set by the same call.
+      err = (fallocate(fd, 0, 0, (off_t)fixed_size) == 0 ? 0 : errno);
+#else
+      err = posix_fallocate(fd, 0, (off_t)fixed_size);
+#endif
+    }
+
+    if (err == ENOSPC || err == EDQUOT) {
+      if (no_space)
+        *no_space = true;
+      ret = false;
+    }
+    else if (err != 0 && policy == PreallocatePolicy::Reserve) {
+      ret = false;
+    }
+    else if (err != 0 || policy == PreallocatePolicy::Sparse) {
+      // The blocks are allocated when they are written.
+      ret = (ftruncate(fd, (off_t)fixed_size) == 0);
     }
   }
   close(fd);
 
-  return true;
+  return ret;
 #endif
 }
 
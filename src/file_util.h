@@ -39,7 +39,11 @@ namespace zoe {
     static FILE* Open(const utf8string& path, const utf8string& mode);
     static int Seek(FILE* f, int64_t offset, int origin);
     static void Close(FILE* f);
-    static bool CreateFixedSizeFile(const utf8string& path, int64_t fixed_size);
+    // |no_space| is set to true if the disk space can not be reserved by |policy|.
+    static bool CreateFixedSizeFile(const utf8string& path,
+                                    int64_t fixed_size,
+                                    PreallocatePolicy policy = PreallocatePolicy::Auto,
+                                    bool* no_space = nullptr);
     static bool PathFormatting(const utf8string& path, utf8string& formatted);
   };
 }  // namespace zoe
@@ -0,0 +1,189 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "hash_reader.h"
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "hasher.h"
+#include "file_util.h"
+#include "options.h"
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+#include <fcntl.h>
+#endif
+
+#define HASH_FILE_BLOCK_SIZE 4194304  // 4MB
+
+namespace zoe {
+static bool IsStopped(Options* opt) {
+  return opt && (opt->internal_stop_event.isSetted() ||
+                 (opt->user_stop_event && opt->user_stop_event->isSetted()));
+}
+
+HashReader::HashReader(int64_t block_size, int64_t alignment, int64_t range_size)
+    : block_size_(std::max(block_size, (int64_t)1))
+    , buffer_count_(range_size > block_size ? HASH_READER_BUFFER_NUM : 1) {
+  alignment = std::max(alignment, (int64_t)1);
+  memory_.reset(new char[(size_t)(block_size_ * buffer_count_ + alignment)]);
+  char* aligned = memory_.get() + (alignment - (uintptr_t)memory_.get() % alignment) % alignment;
+  for (int32_t i = 0; i < HASH_READER_BUFFER_NUM; i++)
+    buffers_[i] = (i < buffer_count_ ? aligned + (size_t)(block_size_ * i) : nullptr);
+}
+
+int64_t HashReader::blockSize() const {
+  return block_size_;
+}
+
+int32_t HashReader::bufferCount() const {
+  return buffer_count_;
+}
+
+void* HashReader::buffer(int32_t index) const {
+  return buffers_[index];
+}
+
+ZoeResult HashReader::run(const ReadFunc& read, int64_t pos, int64_t end, Hasher* hasher, Options* opt) {
+  if (end - pos <= block_size_ || buffer_count_ < HASH_READER_BUFFER_NUM) {
+    while (pos < end) {
+      if (IsStopped(opt))
+        return ZoeResult::CANCELED;
+      const int64_t size = std::min(block_size_, end - pos);
+      if (!read(pos, size, 0))
+        return ZoeResult::CALCULATE_HASH_FAILED;
+      hasher->update(buffers_[0], (size_t)size);
+      pos += size;
+    }
+    return ZoeResult::SUCCESSED;
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<int32_t> free_buffers;
+  std::deque<std::pair<int32_t, int64_t>> filled_buffers;  // index, size
+  bool stop = false;
+  bool failed = false;
+  for (int32_t i = 0; i < buffer_count_; i++)
+    free_buffers.push_back(i);
+
+  std::thread reader([&]() {
+    int64_t read_pos = pos;
+    while (read_pos < end) {
+      int32_t index = -1;
+      {
+        std::unique_lock<std::mutex> ul(mutex);
+        cv.wait(ul, [&]() { return stop || !free_buffers.empty(); });
+        if (stop)
+          return;
+        index = free_buffers.front();
+        free_buffers.pop_front();
+      }
+
+      const int64_t size = std::min(block_size_, end - read_pos);
+      const bool ret = read(read_pos, size, index);
+      {
+        std::lock_guard<std::mutex> lg(mutex);
+        if (ret)
+          filled_buffers.push_back(std::make_pair(index, size));
+        else
+          failed = true;
+      }
+      cv.notify_all();
+      if (!ret)
+        return;
+      read_pos += size;
+    }
+  });
+
+  ZoeResult result = ZoeResult::SUCCESSED;
+  while (pos < end) {
+    if (IsStopped(opt)) {
+      result = ZoeResult::CANCELED;
+      break;
+    }
+
+    std::pair<int32_t, int64_t> block;
+    {
+      std::unique_lock<std::mutex> ul(mutex);
+      cv.wait(ul, [&]() { return failed || !filled_buffers.empty(); });
+      if (filled_buffers.empty()) {
+        result = ZoeResult::CALCULATE_HASH_FAILED;
+        break;
+      }
+      block = filled_buffers.front();
+      filled_buffers.pop_front();
+    }
+
+    hasher->update(buffers_[block.first], (size_t)block.second);
+    pos += block.second;
+
+    {
+      std::lock_guard<std::mutex> lg(mutex);
+      free_buffers.push_back(block.first);
+    }
+    cv.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> lg(mutex);
+    stop = true;
+  }
+  cv.notify_all();
+  reader.join();
+
+  return result;
+}
+
+ZoeResult HashReader::HashFile(const utf8string& file_path, HashType type, Options* opt, utf8string& str_hash) {
+  FILE* f = FileUtil::Open(file_path, "rb");
+  if (!f)
+    return ZoeResult::CALCULATE_HASH_FAILED;
+
+  const ZoeResult ret = HashFile(f, type, opt, str_hash);
+  fclose(f);
+  return ret;
+}
+
+ZoeResult HashReader::HashFile(FILE* f, HashType type, Options* opt, utf8string& str_hash) {
+  std::unique_ptr<Hasher> hasher(Hasher::Create(type));
+  if (!f || !hasher)
+    return ZoeResult::CALCULATE_HASH_FAILED;
+
+  const int64_t file_size = FileUtil::GetFileSize(f);
+  if (file_size < 0 || FileUtil::Seek(f, 0L, SEEK_SET) != 0)
+    return ZoeResult::CALCULATE_HASH_FAILED;
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+  // Read once from the beginning to the end, the pages are not needed after hashing.
+  posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fileno(f), 0, 0, POSIX_FADV_NOREUSE);
+#endif
+
+  // The blocks are read in order, the stream position follows.
+  HashReader reader(HASH_FILE_BLOCK_SIZE, 1, file_size);
+  const ZoeResult ret = reader.run(
+      [&reader, f](int64_t pos, int64_t size, int32_t index) {
+        return (int64_t)fread(reader.buffer(index), 1, (size_t)size, f) == size;
+      },
+      0L, file_size, hasher.get(), opt);
+  if (ret == ZoeResult::SUCCESSED)
+    str_hash = hasher->final();
+  return ret;
+}
+}  // namespace zoe
@@ -0,0 +1,63 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef ZOE_HASH_READER_H_
+#define ZOE_HASH_READER_H_
+#pragma once
+
+#include <stdio.h>
+#include <memory>
+#include <functional>
+#include "zoe/zoe.h"
+
+// Buffers of a HashReader, one is hashed while the next block is read into the other.
+#define HASH_READER_BUFFER_NUM 2
+
+namespace zoe {
+typedef struct _Options Options;
+class Hasher;
+
+// Reads a range of a file by large blocks and feeds them to a Hasher. The blocks are read on a
+// read-ahead thread, so the reading of the next block overlaps with the hashing of the current one.
+class HashReader {
+ public:
+  // Read |size| bytes at |pos| into buffer(|index|), return false if fewer bytes are read.
+  typedef std::function<bool(int64_t pos, int64_t size, int32_t index)> ReadFunc;
+
+  // The buffers are |block_size| bytes and aligned to |alignment|. Only one buffer is allocated if
+  // |range_size| fits in one block.
+  HashReader(int64_t block_size, int64_t alignment, int64_t range_size);
+
+  int64_t blockSize() const;
+  int32_t bufferCount() const;
+  void* buffer(int32_t index) const;
+
+  // Hash [pos, end) by |read|. The range that fits in one block is read on the calling thread.
+  ZoeResult run(const ReadFunc& read, int64_t pos, int64_t end, Hasher* hasher, Options* opt);
+
+  // Hash the whole file, used by CalculateFileMd5/CRC32/SHA256.
+  static ZoeResult HashFile(const utf8string& file_path, HashType type, Options* opt, utf8string& str_hash);
+  static ZoeResult HashFile(FILE* f, HashType type, Options* opt, utf8string& str_hash);
+ protected:
+  std::unique_ptr<char[]> memory_;
+  char* buffers_[HASH_READER_BUFFER_NUM];
+  int64_t block_size_;
+  int32_t buffer_count_;
+};
+}  // namespace zoe
+
+#endif  // !ZOE_HASH_READER_H_
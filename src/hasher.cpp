@@ -0,0 +1,98 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "hasher.h"
+#include <stdio.h>
+
+// The update functions of the hash libraries take 32-bit lengths.
+#define HASHER_MAX_UPDATE_SIZE 0x40000000
+
+namespace zoe {
+Hasher* Hasher::Create(HashType type) {
+  if (type == HashType::MD5)
+    return new Md5Hasher();
+  if (type == HashType::CRC32)
+    return new Crc32Hasher();
+  if (type == HashType::SHA256)
+    return new Sha256Hasher();
+  return nullptr;
+}
+
+Md5Hasher::Md5Hasher() {
+  libmd5_internal::MD5Init(&ctx_);
+}
+
+void Md5Hasher::update(const void* data, size_t size) {
+  const unsigned char* p = (const unsigned char*)data;
+  while (size > 0) {
+    const size_t n = (size > HASHER_MAX_UPDATE_SIZE ? HASHER_MAX_UPDATE_SIZE : size);
+    libmd5_internal::MD5Update(&ctx_, p, (unsigned)n);
+    p += n;
+    size -= n;
+  }
+}
+
+utf8string Md5Hasher::final() {
+  unsigned char sig[16] = {0};
+  char str[33] = {0};
+  libmd5_internal::MD5Final(sig, &ctx_);
+  libmd5_internal::MD5SigToString(sig, str, 33);
+  return str;
+}
+
+Crc32Hasher::Crc32Hasher() {
+  crc32_internal::crc32Init(&crc32_);
+}
+
+void Crc32Hasher::update(const void* data, size_t size) {
+  unsigned char* p = (unsigned char*)data;
+  while (size > 0) {
+    const size_t n = (size > HASHER_MAX_UPDATE_SIZE ? HASHER_MAX_UPDATE_SIZE : size);
+    crc32_internal::crc32Update(&crc32_, p, (uint32_t)n);
+    p += n;
+    size -= n;
+  }
+}
+
+utf8string Crc32Hasher::final() {
+  crc32_internal::crc32Finish(&crc32_);
+
+  char str[10] = {0};
+  snprintf(str, sizeof(str), "%08x", crc32_);
+  return str;
+}
+
+Sha256Hasher::Sha256Hasher() {
+  sha256_internal::sha256_init(&ctx_);
+}
+
+void Sha256Hasher::update(const void* data, size_t size) {
+  const unsigned char* p = (const unsigned char*)data;
+  while (size > 0) {
+    const size_t n = (size > HASHER_MAX_UPDATE_SIZE ? HASHER_MAX_UPDATE_SIZE : size);
+    sha256_internal::sha256_update(&ctx_, p, (uint32_t)n);
+    p += n;
+    size -= n;
+  }
+}
+
+utf8string Sha256Hasher::final() {
+  sha256_internal::sha256_final(&ctx_);
+  return sha256_internal::sha256_digest(&ctx_);
+}
+}  // namespace zoe
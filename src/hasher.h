@@ -0,0 +1,74 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_HASHER_H_
+#define ZOE_HASHER_H_
+#pragma once
+
+#include <stddef.h>
+#include "zoe/zoe.h"
+#include "md5.h"
+#include "crc32.h"
+#include "sha256.h"
+
+namespace zoe {
+// Incremental hash, the data can be fed in any number of pieces.
+class Hasher {
+ public:
+  // nullptr if |type| is not supported.
+  static Hasher* Create(HashType type);
+
+  virtual ~Hasher() {}
+
+  virtual void update(const void* data, size_t size) = 0;
+
+  // The lowercase hex string, the same as CalculateFileMd5/CRC32/SHA256.
+  virtual utf8string final() = 0;
+};
+
+class Md5Hasher : public Hasher {
+ public:
+  Md5Hasher();
+  virtual void update(const void* data, size_t size);
+  virtual utf8string final();
+
+ protected:
+  libmd5_internal::MD5Context ctx_;
+};
+
+class Crc32Hasher : public Hasher {
+ public:
+  Crc32Hasher();
+  virtual void update(const void* data, size_t size);
+  virtual utf8string final();
+
+ protected:
+  uint32_t crc32_;
+};
+
+class Sha256Hasher : public Hasher {
+ public:
+  Sha256Hasher();
+  virtual void update(const void* data, size_t size);
+  virtual utf8string final();
+
+ protected:
+  sha256_internal::SHA256_CTX ctx_;
+};
+}  // namespace zoe
+#endif  // !ZOE_HASHER_H_
@@ -0,0 +1,108 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#ifndef ZOE_INTRUSIVE_LIST_H_
+#define ZOE_INTRUSIVE_LIST_H_
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+
+namespace zoe {
+template <typename T>
+class IntrusiveList;
+
+// Derive from this node to be linked into an IntrusiveList<T>, one list at a time.
+template <typename T>
+class IntrusiveListNode {
+ public:
+  IntrusiveListNode() : prev_(nullptr), next_(nullptr), list_(nullptr) {}
+
+  bool isLinked() const { return list_ != nullptr; }
+
+ private:
+  friend class IntrusiveList<T>;
+  T* prev_;
+  T* next_;
+  IntrusiveList<T>* list_;
+};
+
+// Doubly linked list that does not own its elements, insertion and removal are O(1).
+template <typename T>
+class IntrusiveList {
+ public:
+  IntrusiveList() : head_(nullptr), tail_(nullptr), size_(0) {}
+  ~IntrusiveList() { clear(); }
+
+  IntrusiveList(const IntrusiveList&) = delete;
+  IntrusiveList& operator=(const IntrusiveList&) = delete;
+
+  T* front() const { return head_; }
+  T* next(const T* item) const { return node(item)->next_; }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  bool contains(const T* item) const { return node(item)->list_ == this; }
+
+  void pushBack(T* item) {
+    IntrusiveListNode<T>* n = node(item);
+    assert(!n->list_);
+    n->prev_ = tail_;
+    n->next_ = nullptr;
+    n->list_ = this;
+    if (tail_)
+      node(tail_)->next_ = item;
+    else
+      head_ = item;
+    tail_ = item;
+    size_++;
+  }
+
+  void remove(T* item) {
+    IntrusiveListNode<T>* n = node(item);
+    assert(n->list_ == this);
+    if (n->prev_)
+      node(n->prev_)->next_ = n->next_;
+    else
+      head_ = n->next_;
+    if (n->next_)
+      node(n->next_)->prev_ = n->prev_;
+    else
+      tail_ = n->prev_;
+    n->prev_ = nullptr;
+    n->next_ = nullptr;
+    n->list_ = nullptr;
+    size_--;
+  }
+
+  void clear() {
+    while (head_)
+      remove(head_);
+  }
+
+ private:
+  static IntrusiveListNode<T>* node(T* item) { return static_cast<IntrusiveListNode<T>*>(item); }
+  static const IntrusiveListNode<T>* node(const T* item) { return static_cast<const IntrusiveListNode<T>*>(item); }
+
+  T* head_;
+  T* tail_;
+  size_t size_;
+};
+}  // namespace zoe
+#endif  // !ZOE_INTRUSIVE_LIST_H_
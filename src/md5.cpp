@@ -1,7 +1,6 @@
 ﻿#include "md5.h"
 #include <memory.h>
-#include "file_util.h"
-#include "options.h"
+#include "hash_reader.h"
 
 namespace zoe {
 namespace libmd5_internal {
@@ -303,67 +302,11 @@ void MD5SigToString(unsigned char signature[16], char* str, int len) {
 }
 }  // namespace libmd5_internal
 
-ZoeResult CalculateFileMd5(const utf8string& file_path,
-                        Options* opt,
-                        utf8string& str_hash) {
-  FILE* f = FileUtil::Open(file_path, "rb");
-  if (!f)
-    return ZoeResult::CALCULATE_HASH_FAILED;
-
-  unsigned char szMd5Sig[16] = {0};
-  char szMd5[33] = {0};
-  libmd5_internal::MD5Context md5Context;
-  libmd5_internal::MD5Init(&md5Context);
-
-  size_t dwReadBytes = 0;
-  unsigned char szData[1024] = {0};
-
-  while ((dwReadBytes = fread(szData, 1, 1024, f)) > 0) {
-    if (opt && (opt->internal_stop_event.isSetted() ||
-                (opt->user_stop_event && opt->user_stop_event->isSetted()))) {
-      FileUtil::Close(f);
-      return ZoeResult::CANCELED;
-    }
-    libmd5_internal::MD5Update(&md5Context, szData, dwReadBytes);
-  }
-
-  FileUtil::Close(f);
-
-  libmd5_internal::MD5Final(szMd5Sig, &md5Context);
-  libmd5_internal::MD5SigToString(szMd5Sig, szMd5, 33);
-
-  str_hash = szMd5;
-
-  return ZoeResult::SUCCESSED;
+ZoeResult CalculateFileMd5(const utf8string& file_path, Options* opt, utf8string& str_hash) {
+  return HashReader::HashFile(file_path, HashType::MD5, opt, str_hash);
 }
 
 ZoeResult CalculateFileMd5(FILE* f, Options* opt, utf8string& str_hash) {
-  if (!f)
-    return ZoeResult::CALCULATE_HASH_FAILED;
-
-  FileUtil::Seek(f, 0L, SEEK_SET);
-
-  unsigned char szMd5Sig[16] = {0};
-  char szMd5[33] = {0};
-  libmd5_internal::MD5Context md5Context;
-  libmd5_internal::MD5Init(&md5Context);
-
-  size_t dwReadBytes = 0;
-  unsigned char szData[1024] = {0};
-
-  while ((dwReadBytes = fread(szData, 1, 1024, f)) > 0) {
-    if (opt && (opt->internal_stop_event.isSetted() ||
-                (opt->user_stop_event && opt->user_stop_event->isSetted()))) {
-      return ZoeResult::CANCELED;
-    }
-    libmd5_internal::MD5Update(&md5Context, szData, dwReadBytes);
-  }
-
-  libmd5_internal::MD5Final(szMd5Sig, &md5Context);
-  libmd5_internal::MD5SigToString(szMd5Sig, szMd5, 33);
-
-  str_hash = szMd5;
-
-  return ZoeResult::SUCCESSED;
+  return HashReader::HashFile(f, HashType::MD5, opt, str_hash);
 }
 }  // namespace zoe
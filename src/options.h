@@ -29,6 +29,16 @@ namespace zoe {
 #define ZOE_DEFAULT_FETCH_FILE_INFO_RETRY_TIMES 1
 #define ZOE_DEFAULT_THREAD_NUM 1
 #define ZOE_DEFAULT_SLICE_MAX_FAILED_TIMES 3
+#define ZOE_MIN_SPLIT_SLICE_SIZE_BYTE 524288  // 512KB
+#define ZOE_DEFAULT_HEDGE_RATE_PERCENT 25
+#define ZOE_DEFAULT_PROGRESS_INTERVAL_MS 500
+#define ZOE_DEFAULT_SPEED_INTERVAL_MS 1000
+#define ZOE_DEFAULT_SPEED_SMOOTHING_PERCENT 100  // no smoothing
+#define ZOE_DEFAULT_DURABILITY_SYNC_INTERVAL_MS 5000
+#define ZOE_DEFAULT_DURABILITY_SYNC_BYTES 67108864  // 64MB
+#define ZOE_DEFAULT_DISK_WRITER_THREAD_NUM 1
+#define ZOE_DEFAULT_DISK_WRITER_QUEUE_SIZE 33554432  // 32MB
+#define ZOE_DEFAULT_STREAM_WINDOW_SIZE 67108864  // 64MB
 
 typedef struct _Options {
   bool redirected_url_check_enabled;
@@ -37,7 +47,14 @@ typedef struct _Options {
   bool verify_peer_certificate;
   bool verify_peer_host;
   int32_t thread_num;
-  int32_t disk_cache_size;
+  bool adaptive_thread_num;
+  int32_t min_thread_num;
+  int32_t max_thread_num;
+  int64_t disk_cache_size;
+  int32_t disk_writer_thread_num;  // 0 means writing in the write callbacks
+  int64_t disk_writer_queue_size;
+  FileIoEngine file_io_engine;
+  PreallocatePolicy preallocate_policy;
   int32_t max_speed;
   int32_t min_speed;
   int32_t min_speed_duration;
@@ -58,6 +75,8 @@ typedef struct _Options {
   ProgressFunctor progress_functor;
   RealtimeSpeedFunctor speed_functor;
   VerboseOuputFunctor verbose_functor;
+  StreamFunctor stream_functor;  // set by Zoe::startStream, no target file is written
+  int64_t stream_window_size;
 
   mutable ZoeEvent internal_stop_event;
   ZoeEvent* user_stop_event;
@@ -77,6 +96,25 @@ typedef struct _Options {
 
   UncompletedSliceSavePolicy uncompleted_slice_save_policy;
 
+  bool hedge_enabled;
+  int32_t hedge_rate_percent;
+
+  HttpVersionPolicy http_version_policy;
+
+  int32_t progress_interval_ms;
+  int64_t progress_min_delta;  // bytes
+  int32_t speed_interval_ms;
+  int32_t speed_smoothing_percent;  // weight of the latest sample
+
+  DurabilityPolicy durability_policy;
+  int32_t durability_sync_interval_ms;  // <= 0 means disabled
+  int64_t durability_sync_bytes;        // <= 0 means disabled
+
+  EventEngine event_engine;
+
+  ZoeScheduler* scheduler;
+  ZoeExternalLoop* external_loop;
+
   _Options() : internal_stop_event(true) {
     redirected_url_check_enabled = true;
     content_md5_enabled = false;
@@ -86,7 +124,15 @@ typedef struct _Options {
     verify_peer_host = false;
 
     thread_num = ZOE_DEFAULT_THREAD_NUM;
+    adaptive_thread_num = false;
+    min_thread_num = ZOE_DEFAULT_THREAD_NUM;
+    max_thread_num = 100;
     disk_cache_size = ZOE_DEFAULT_TOTAL_DISK_CACHE_SIZE_BYTE;
+    disk_writer_thread_num = ZOE_DEFAULT_DISK_WRITER_THREAD_NUM;
+    disk_writer_queue_size = ZOE_DEFAULT_DISK_WRITER_QUEUE_SIZE;
+    file_io_engine = FileIoEngine::Auto;
+    preallocate_policy = PreallocatePolicy::Auto;
+    stream_window_size = ZOE_DEFAULT_STREAM_WINDOW_SIZE;
 
     slice_policy = SlicePolicy::Auto;
     slice_policy_value = 0L;
@@ -111,6 +157,25 @@ typedef struct _Options {
     user_stop_event = nullptr; // User-defined stop event
 
     uncompleted_slice_save_policy = UncompletedSliceSavePolicy::AlwaysDiscard;
+
+    hedge_enabled = false;
+    hedge_rate_percent = ZOE_DEFAULT_HEDGE_RATE_PERCENT;
+
+    http_version_policy = HttpVersionPolicy::Default;
+
+    progress_interval_ms = ZOE_DEFAULT_PROGRESS_INTERVAL_MS;
+    progress_min_delta = 0L;
+    speed_interval_ms = ZOE_DEFAULT_SPEED_INTERVAL_MS;
+    speed_smoothing_percent = ZOE_DEFAULT_SPEED_SMOOTHING_PERCENT;
+
+    durability_policy = DurabilityPolicy::None;
+    durability_sync_interval_ms = ZOE_DEFAULT_DURABILITY_SYNC_INTERVAL_MS;
+    durability_sync_bytes = ZOE_DEFAULT_DURABILITY_SYNC_BYTES;
+
+    event_engine = EventEngine::Select;
+
+    scheduler = nullptr;
+    external_loop = nullptr;
   }
 } Options;
 }  // namespace zoe
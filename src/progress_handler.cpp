@@ -16,36 +16,36 @@
 ******************************************************************************/
 
 #include "progress_handler.h"
-#include <functional>
+#include <stdlib.h>
 #include "options.h"
 
 namespace zoe {
 ProgressHandler::ProgressHandler(Options* options,
                                  std::shared_ptr<SliceManager> slice_manager)
-    : options_(options), slice_manager_(slice_manager) {
-  if (options_ && slice_manager_) {
-    async_task_ =
-        std::async(std::launch::async,
-                   std::bind(&ProgressHandler::asyncTaskProcess, this));
-  }
-}
+    : last_downloaded_(-1L), options_(options), slice_manager_(slice_manager) {}
 
-ProgressHandler::~ProgressHandler() {
-  if (async_task_.valid())
-    async_task_.get();
-}
+ProgressHandler::~ProgressHandler() {}
 
-void ProgressHandler::asyncTaskProcess() {
-  while (true) {
-    if (options_->internal_stop_event.wait(500))
-      break;
-    if (options_->user_stop_event && options_->user_stop_event->isSetted())
-      break;
-    if (options_ && options_->progress_functor && slice_manager_) {
-      options_->progress_functor(slice_manager_->originFileSize(),
-                                 slice_manager_->totalDownloaded());
-    }
+void ProgressHandler::onTick() {
+  if (!options_ || !options_->progress_functor || !slice_manager_)
+    return;
+
+  const int64_t total = slice_manager_->originFileSize();
+  const int64_t downloaded = slice_manager_->downloadedBytes();
+  if (downloaded == last_downloaded_)
+    return;
+
+  // The last progress is reported at once.
+  if (total <= 0 || downloaded != total) {
+    if (time_meter_.Elapsed() < options_->progress_interval_ms)
+      return;
+    if (last_downloaded_ >= 0 && llabs(downloaded - last_downloaded_) < options_->progress_min_delta)
+      return;
   }
+
+  time_meter_.Restart();
+  last_downloaded_ = downloaded;
+  options_->progress_functor(total, downloaded);
 }
 
 }  // namespace zoe
\ No newline at end of file
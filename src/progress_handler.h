@@ -21,21 +21,23 @@
 
 #include "zoe/zoe.h"
 #include "slice_manager.h"
+#include "time_meter.hpp"
 
 namespace zoe {
 typedef struct _Options Options;
 
+// Report download progress, driven by the event loop and the byte deltas of slices.
 class ProgressHandler {
  public:
   ProgressHandler(Options* options,
                   std::shared_ptr<SliceManager> slice_manager);
   virtual ~ProgressHandler();
 
- protected:
-  void asyncTaskProcess();
+  void onTick();
 
  protected:
-  std::shared_future<void> async_task_;
+  TimeMeter time_meter_;
+  int64_t last_downloaded_;
   const Options* options_;
   std::shared_ptr<SliceManager> slice_manager_;
 };
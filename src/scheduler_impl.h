@@ -0,0 +1,61 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef ZOE_SCHEDULER_IMPL_H_
+#define ZOE_SCHEDULER_IMPL_H_
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <future>
+#include "zoe/zoe.h"
+#include "event_loop.h"
+#include "connection_quota.h"
+
+namespace zoe {
+// What a download job needs from the scheduler it runs on.
+class JobScheduler {
+ public:
+  virtual ~JobScheduler() {}
+
+  // Attach |job| to one of the event loops, return false if no loop is available.
+  virtual bool submit(LoopJob* job) = 0;
+
+  virtual ConnectionQuota* quota() = 0;
+};
+
+class ZoeScheduler::SchedulerImpl : public JobScheduler {
+ public:
+  SchedulerImpl(int32_t loop_num, EventEngine engine);
+  virtual ~SchedulerImpl();
+
+  int32_t loopNum() const;
+  EventEngine engine() const;
+
+  // Attach |job| to the event loop that has the fewest jobs.
+  virtual bool submit(LoopJob* job);
+
+  virtual ConnectionQuota* quota();
+
+ protected:
+  EventEngine engine_;
+  std::vector<std::shared_ptr<EventLoop>> loops_;
+  std::vector<std::shared_future<void>> loop_tasks_;
+  ConnectionQuota quota_;
+};
+}  // namespace zoe
+#endif  // !ZOE_SCHEDULER_IMPL_H_
@@ -1,8 +1,34 @@
 #include "sha256.h"
 #include <stdio.h>
 #include <string.h>
-#include "file_util.h"
-#include "options.h"
+#include "hash_reader.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA256_TARGET_SHANI
+#else
+#include <cpuid.h>
+#define SHA256_TARGET_SHANI __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__linux__) || defined(__APPLE__))
+#define SHA256_ARM
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if defined(__clang__)
+#define SHA256_TARGET_ARM __attribute__((target("crypto")))
+#else
+#define SHA256_TARGET_ARM __attribute__((target("+crypto")))
+#endif
+#endif
 
 namespace zoe {
 namespace sha256_internal {
@@ -146,22 +172,206 @@ static void sha256_transform(uint32_t* state, uint32_t* data) {
   state[7] += H;
 }
 
-static void sha256_block(struct sha256_ctx* ctx, const unsigned char* block) {
+/* Compress |num| consecutive blocks into the state. */
+typedef void (*sha256_compress_func)(uint32_t* state, const unsigned char* blocks, uint32_t num);
+
+static void sha256_compress_scalar(uint32_t* state, const unsigned char* blocks, uint32_t num) {
   uint32_t data[SHA256_DATA_LENGTH];
   uint16_t i;
 
+  for (; num > 0; num--) {
+    /* Endian independent conversion */
+    for (i = 0; i < SHA256_DATA_LENGTH; i++, blocks += 4)
+      data[i] = STRING2INT(blocks);
+
+    sha256_transform(state, data);
+  }
+}
+
+#if defined(SHA256_X86)
+static bool sha256_detect_shani() {
+  unsigned int ecx1 = 0, ebx7 = 0;
+#if defined(_MSC_VER)
+  int info[4] = {0};
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  ecx1 = (unsigned int)info[2];
+  __cpuidex(info, 7, 0);
+  ebx7 = (unsigned int)info[1];
+#else
+  unsigned int eax = 0, ebx = 0, edx = 0;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+    return false;
+  unsigned int ecx = 0;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx7, &ecx, &edx))
+    return false;
+#endif
+  const unsigned int ssse3 = 1u << 9;
+  const unsigned int sse41 = 1u << 19;
+  const unsigned int sha = 1u << 29;
+  return (ecx1 & ssse3) && (ecx1 & sse41) && (ebx7 & sha);
+}
+
+static bool sha256_shani_supported() {
+  static const bool supported = sha256_detect_shani();
+  return supported;
+}
+
+/* Rounds 4g..4g+3. The state is kept as ABEF and CDGH, the message schedule of the next
+   groups is computed from the 4 message vectors by sha256msg1/sha256msg2. */
+#define SHANI_GROUP(g, cur, next, prev)                                                  \
+  do {                                                                                   \
+    if ((g) < 4)                                                                         \
+      cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 16 * (g))), mask); \
+    msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*)(K + 4 * (g))));            \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                                 \
+    if ((g) >= 3 && (g) <= 14) {                                                         \
+      next = _mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4));                         \
+      next = _mm_sha256msg2_epu32(next, cur);                                            \
+    }                                                                                    \
+    msg = _mm_shuffle_epi32(msg, 0x0E);                                                  \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                                 \
+    if ((g) >= 1 && (g) <= 12)                                                           \
+      prev = _mm_sha256msg1_epu32(prev, cur);                                            \
+  } while (0)
+
+SHA256_TARGET_SHANI static void sha256_compress_shani(uint32_t* state, const unsigned char* blocks, uint32_t num) {
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+  __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);           /* CDAB */
+  state1 = _mm_shuffle_epi32(state1, 0x1B);     /* EFGH */
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); /* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);  /* CDGH */
+
+  for (; num > 0; num--, blocks += SHA256_DATA_SIZE) {
+    const __m128i abef_save = state0;
+    const __m128i cdgh_save = state1;
+    __m128i msg;
+    __m128i msg0 = _mm_setzero_si128();
+    __m128i msg1 = _mm_setzero_si128();
+    __m128i msg2 = _mm_setzero_si128();
+    __m128i msg3 = _mm_setzero_si128();
+
+    for (int q = 0; q < 16; q += 4) {
+      SHANI_GROUP(q + 0, msg0, msg1, msg3);
+      SHANI_GROUP(q + 1, msg1, msg2, msg0);
+      SHANI_GROUP(q + 2, msg2, msg3, msg1);
+      SHANI_GROUP(q + 3, msg3, msg0, msg2);
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);        /* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);     /* DCHG */
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);  /* DCBA */
+  state1 = _mm_alignr_epi8(state1, tmp, 8);     /* ABEF */
+  _mm_storeu_si128((__m128i*)&state[0], state0);
+  _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+#endif
+
+#if defined(SHA256_ARM)
+static bool sha256_arm_crypto_supported() {
+#if defined(__APPLE__)
+  return true; /* all Apple ARM64 CPUs */
+#else
+  static const bool supported = (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+  return supported;
+#endif
+}
+
+/* Rounds 4g..4g+3, the message vector of the group is replaced by the one of group g+4. */
+#define ARM_GROUP(g, cur, m1, m2, m3)                                     \
+  do {                                                                    \
+    const uint32x4_t wk = vaddq_u32(cur, vld1q_u32(K + 4 * (g)));        \
+    if ((g) < 12)                                                         \
+      cur = vsha256su1q_u32(vsha256su0q_u32(cur, m1), m2, m3);            \
+    const uint32x4_t abcd = state0;                                       \
+    state0 = vsha256hq_u32(state0, state1, wk);                           \
+    state1 = vsha256h2q_u32(state1, abcd, wk);                            \
+  } while (0)
+
+SHA256_TARGET_ARM static void sha256_compress_arm(uint32_t* state, const unsigned char* blocks, uint32_t num) {
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  for (; num > 0; num--, blocks += SHA256_DATA_SIZE) {
+    const uint32x4_t abcd_save = state0;
+    const uint32x4_t efgh_save = state1;
+    uint32x4_t msg0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 0)));
+    uint32x4_t msg1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 16)));
+    uint32x4_t msg2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 32)));
+    uint32x4_t msg3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + 48)));
+
+    for (int q = 0; q < 16; q += 4) {
+      ARM_GROUP(q + 0, msg0, msg1, msg2, msg3);
+      ARM_GROUP(q + 1, msg1, msg2, msg3, msg0);
+      ARM_GROUP(q + 2, msg2, msg3, msg0, msg1);
+      ARM_GROUP(q + 3, msg3, msg0, msg1, msg2);
+    }
+
+    state0 = vaddq_u32(state0, abcd_save);
+    state1 = vaddq_u32(state1, efgh_save);
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+#endif
+
+static sha256_compress_func sha256_kernel_func(Sha256Kernel kernel) {
+  switch (kernel) {
+    case Sha256Kernel::Scalar:
+      return sha256_compress_scalar;
+#if defined(SHA256_X86)
+    case Sha256Kernel::ShaNi:
+      return (sha256_shani_supported() ? sha256_compress_shani : nullptr);
+#endif
+#if defined(SHA256_ARM)
+    case Sha256Kernel::ArmCrypto:
+      return (sha256_arm_crypto_supported() ? sha256_compress_arm : nullptr);
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+static Sha256Kernel sha256_select_kernel() {
+  if (sha256_kernel_func(Sha256Kernel::ShaNi))
+    return Sha256Kernel::ShaNi;
+  if (sha256_kernel_func(Sha256Kernel::ArmCrypto))
+    return Sha256Kernel::ArmCrypto;
+  return Sha256Kernel::Scalar;
+}
+
+static Sha256Kernel sha256_selected() {
+  static const Sha256Kernel selected = sha256_select_kernel();
+  return selected;
+}
+
+static void sha256_compress(sha256_compress_func compress,
+                            struct sha256_ctx* ctx,
+                            const unsigned char* blocks,
+                            uint32_t num) {
   /* Update block count */
-  if (!++ctx->count_low)
+  const uint32_t count_low = ctx->count_low;
+  ctx->count_low += num;
+  if (ctx->count_low < count_low)
     ++ctx->count_high;
 
-  /* Endian independent conversion */
-  for (i = 0; i < SHA256_DATA_LENGTH; i++, block += 4)
-    data[i] = STRING2INT(block);
-
-  sha256_transform(ctx->state, data);
+  compress(ctx->state, blocks, num);
 }
 
-void sha256_update(struct sha256_ctx* ctx, const unsigned char* buffer, uint32_t length) {
+static void sha256_update_with(sha256_compress_func compress,
+                               struct sha256_ctx* ctx,
+                               const unsigned char* buffer,
+                               uint32_t length) {
   uint32_t left;
 
   if (ctx->index) { /* Try to fill partial block */
@@ -173,15 +383,16 @@ void sha256_update(struct sha256_ctx* ctx, const unsigned char* buffer, uint32_t
     }
     else {
       memcpy(ctx->block + ctx->index, buffer, left);
-      sha256_block(ctx, ctx->block);
+      sha256_compress(compress, ctx, ctx->block, 1);
       buffer += left;
       length -= left;
     }
   }
-  while (length >= SHA256_DATA_SIZE) {
-    sha256_block(ctx, buffer);
-    buffer += SHA256_DATA_SIZE;
-    length -= SHA256_DATA_SIZE;
+  if (length >= SHA256_DATA_SIZE) {
+    const uint32_t num = length / SHA256_DATA_SIZE;
+    sha256_compress(compress, ctx, buffer, num);
+    buffer += num * SHA256_DATA_SIZE;
+    length -= num * SHA256_DATA_SIZE;
   }
   /* Buffer leftovers */
   /* NOTE: The corresponding sha1 code checks for the special case length == 0.
@@ -191,6 +402,38 @@ void sha256_update(struct sha256_ctx* ctx, const unsigned char* buffer, uint32_t
   ctx->index = length;
 }
 
+void sha256_update(struct sha256_ctx* ctx, const unsigned char* buffer, uint32_t length) {
+  static const sha256_compress_func compress = sha256_kernel_func(sha256_selected());
+  sha256_update_with(compress, ctx, buffer, length);
+}
+
+void sha256_update_by_kernel(Sha256Kernel kernel, struct sha256_ctx* ctx, const unsigned char* buffer, uint32_t length) {
+  const sha256_compress_func compress = sha256_kernel_func(kernel);
+  if (compress)
+    sha256_update_with(compress, ctx, buffer, length);
+}
+
+bool sha256_kernel_supported(Sha256Kernel kernel) {
+  return sha256_kernel_func(kernel) != nullptr;
+}
+
+Sha256Kernel sha256_selected_kernel() {
+  return sha256_selected();
+}
+
+const char* sha256_kernel_name(Sha256Kernel kernel) {
+  switch (kernel) {
+    case Sha256Kernel::Scalar:
+      return "scalar";
+    case Sha256Kernel::ShaNi:
+      return "sha-ni";
+    case Sha256Kernel::ArmCrypto:
+      return "armv8-crypto";
+    default:
+      return "unknown";
+  }
+}
+
 /* Final wrapup - pad to SHA1_DATA_SIZE-byte boundary with the bit pattern
       1 0* (64-bit count of bits processed, MSB-first) */
 
@@ -270,56 +513,10 @@ std::string sha256_digest(const struct sha256_ctx* ctx) {
 }  // namespace sha256_internal
 
 ZoeResult CalculateFileSHA256(const utf8string& file_path, Options* opt, utf8string& str_hash) {
-  FILE* f = FileUtil::Open(file_path, "rb");
-  if (!f)
-    return ZoeResult::CALCULATE_HASH_FAILED;
-
-  sha256_internal::SHA256_CTX sha256Ctx;
-  sha256_internal::sha256_init(&sha256Ctx);
-
-  size_t dwReadBytes = 0;
-  unsigned char szData[1024] = {0};
-
-  while ((dwReadBytes = fread(szData, 1, 1024, f)) > 0) {
-    if (opt && (opt->internal_stop_event.isSetted() || (opt->user_stop_event && opt->user_stop_event->isSetted()))) {
-      fclose(f);
-      return ZoeResult::CANCELED;
-    }
-    sha256_internal::sha256_update(&sha256Ctx, szData, dwReadBytes);
-  }
-  fclose(f);
-
-  sha256_internal::sha256_final(&sha256Ctx);
-
-  str_hash = sha256_internal::sha256_digest(&sha256Ctx);
-
-  return ZoeResult::SUCCESSED;
+  return HashReader::HashFile(file_path, HashType::SHA256, opt, str_hash);
 }
 
 ZoeResult CalculateFileSHA256(FILE* f, Options* opt, utf8string& str_hash) {
-  if (!f)
-    return ZoeResult::CALCULATE_HASH_FAILED;
-
-  FileUtil::Seek(f, 0L, SEEK_SET);
-
-  sha256_internal::SHA256_CTX sha256Ctx;
-  sha256_internal::sha256_init(&sha256Ctx);
-
-  size_t dwReadBytes = 0;
-  unsigned char szData[1024] = {0};
-
-  while ((dwReadBytes = fread(szData, 1, 1024, f)) > 0) {
-    if (opt && (opt->internal_stop_event.isSetted() ||
-                (opt->user_stop_event && opt->user_stop_event->isSetted()))) {
-      return ZoeResult::CANCELED;
-    }
-    sha256_internal::sha256_update(&sha256Ctx, szData, dwReadBytes);
-  }
-
-  sha256_internal::sha256_final(&sha256Ctx);
-
-  str_hash = sha256_internal::sha256_digest(&sha256Ctx);
-
-  return ZoeResult::SUCCESSED;
+  return HashReader::HashFile(f, HashType::SHA256, opt, str_hash);
 }
 }  // namespace zoe
\ No newline at end of file
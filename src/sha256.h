@@ -39,10 +39,28 @@ typedef struct sha256_ctx {
   uint32_t index;                        /* index into buffer */
 } SHA256_CTX;
 
+/* Block compression implementations, all give the same result. */
+enum class Sha256Kernel {
+  Scalar = 0,
+  ShaNi,     /* x86 SHA extensions, needs SHA, SSSE3 and SSE4.1 */
+  ArmCrypto, /* ARMv8 SHA2 crypto extensions */
+  KernelNum
+};
+
 void sha256_init(struct sha256_ctx* ctx);
 
+/* Uses the fastest kernel supported by the CPU, it is detected once at the first call. */
 void sha256_update(struct sha256_ctx* ctx, const unsigned char* data, uint32_t length);
 
+/* Update by the given kernel, which must be supported. */
+void sha256_update_by_kernel(Sha256Kernel kernel, struct sha256_ctx* ctx, const unsigned char* data, uint32_t length);
+
+bool sha256_kernel_supported(Sha256Kernel kernel);
+
+Sha256Kernel sha256_selected_kernel();
+
+const char* sha256_kernel_name(Sha256Kernel kernel);
+
 void sha256_final(struct sha256_ctx* ctx);
 
 void sha256_digest(const struct sha256_ctx* ctx, unsigned char* digest);
@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <string.h>
+#include <algorithm>
 #include "file_util.h"
 #include "curl_utils.h"
 #include "curl/curl.h"
@@ -26,6 +27,8 @@
 #include "string_encode.h"
 #include "verbose.h"
 #include "slice_manager.h"
+#include "buffer_pool.h"
+#include "crc32.h"
 
 #define CHECK_SETOPT1(x)                                                                                     \
   do {                                                                                                       \
@@ -35,6 +38,9 @@
     }                                                                                                        \
   } while (false)
 
+// Lower bound of the disk cache if the file is written by direct I/O.
+#define DIRECT_IO_MIN_CACHE_SIZE 1048576  // 1MB
+
 namespace zoe {
 
 Slice::Slice(int32_t index,
@@ -45,12 +51,21 @@ Slice::Slice(int32_t index,
     : index_(index)
     , begin_(begin)
     , end_(end)
+    , crc32_known_(init_capacity == 0)
+    , write_paused_(false)
     , curl_(nullptr)
     , header_chunk_(nullptr)
     , disk_cache_size_(0L)
     , disk_cache_buffer_(nullptr)
+    , disk_cache_offset_(0L)
+    , io_alignment_(1L)
     , status_(SliceStatus::UNFETCH)
     , failed_times_(0)
+    , hedge_times_(0)
+    , primary_(nullptr)
+    , observer_(nullptr)
+    , rate_(-1)
+    , start_received_(0)
     , slice_manager_(slice_manager) {
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
   InitializeCriticalSection(&crit_);
@@ -58,6 +73,13 @@ Slice::Slice(int32_t index,
   mutex_ = PTHREAD_MUTEX_INITIALIZER;
 #endif
   disk_capacity_.store(init_capacity);
+  durable_capacity_.store(init_capacity);  // loaded from the index file
+  crc32_internal::crc32Init(&disk_crc32_);
+  if (crc32_known_)
+    durable_checksum_ = FormatChecksum(disk_crc32_);
+  queued_capacity_.store(init_capacity);
+  pending_writes_.store(0);
+  write_failed_.store(false);
   disk_cache_capacity_.store(0L);
 
   assert(end_ == -1 || (end_ + 1 >= begin_ + disk_capacity_.load()));
@@ -68,6 +90,7 @@ Slice::Slice(int32_t index,
 
 Slice::~Slice() {
   assert(!curl_);
+  assert(pending_writes_.load() == 0);
   freeDiskCacheBuffer();
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
   DeleteCriticalSection(&crit_);
@@ -90,6 +113,108 @@ int64_t Slice::capacity() const {
   return disk_capacity_.load();
 }
 
+int64_t Slice::durableCapacity() const {
+  // The downloaded data may have been discarded after the last sync.
+  return std::min(durable_capacity_.load(), disk_capacity_.load());
+}
+
+void Slice::setDurableCapacity(int64_t capacity, const utf8string& checksum) {
+  std::lock_guard<std::mutex> lg(checksum_mutex_);
+  durable_capacity_.store(capacity);
+  durable_checksum_ = checksum;
+}
+
+utf8string Slice::checksum() const {
+  std::lock_guard<std::mutex> lg(checksum_mutex_);
+  return (crc32_known_ ? FormatChecksum(disk_crc32_) : utf8string());
+}
+
+utf8string Slice::durableChecksum() const {
+  std::lock_guard<std::mutex> lg(checksum_mutex_);
+  // The data discarded after the last sync, see durableCapacity().
+  if (durable_capacity_.load() > disk_capacity_.load())
+    return (crc32_known_ ? FormatChecksum(disk_crc32_) : utf8string());
+  return durable_checksum_;
+}
+
+void Slice::setChecksum(const utf8string& checksum) {
+  std::lock_guard<std::mutex> lg(checksum_mutex_);
+  crc32_known_ = !checksum.empty();
+  if (crc32_known_)
+    disk_crc32_ = ~(uint32_t)strtoul(checksum.c_str(), nullptr, 16);
+  durable_checksum_ = checksum;
+}
+
+void Slice::diskState(int64_t* capacity, utf8string* checksum) const {
+  std::lock_guard<std::mutex> lg(checksum_mutex_);
+  *capacity = disk_capacity_.load();
+  *checksum = (crc32_known_ ? FormatChecksum(disk_crc32_) : utf8string());
+}
+
+void Slice::reset() {
+  std::shared_ptr<TargetFile> target_file = slice_manager_->targetFile();
+  if (target_file && received() > 0)
+    target_file->discardWritten(begin_, received());
+
+  const int64_t before = received();
+  {
+    std::lock_guard<std::mutex> lg(checksum_mutex_);
+    disk_capacity_.store(0);
+    durable_capacity_.store(0);
+    crc32_internal::crc32Init(&disk_crc32_);
+    crc32_known_ = true;
+    durable_checksum_ = FormatChecksum(disk_crc32_);
+  }
+  queued_capacity_.store(0);
+  disk_cache_capacity_.store(0);
+  reportReceived(before);
+}
+
+void Slice::addDiskData(const char* data, int64_t written) {
+  if (written <= 0)
+    return;
+
+  std::lock_guard<std::mutex> lg(checksum_mutex_);
+  if (crc32_known_) {
+    int64_t done = 0L;
+    while (done < written) {
+      const uint32_t size = (uint32_t)std::min(written - done, (int64_t)0x40000000);
+      crc32_internal::crc32Update(&disk_crc32_, (unsigned char*)data + done, size);
+      done += size;
+    }
+  }
+  std::atomic_fetch_add(&disk_capacity_, written);
+}
+
+utf8string Slice::FormatChecksum(uint32_t crc32) {
+  crc32_internal::crc32Finish(&crc32);
+  char str[16] = {0};
+  snprintf(str, sizeof(str), "%08x", crc32);
+  return str;
+}
+
+int64_t Slice::remaining() const {
+  if (end_ == -1)
+    return -1;
+
+  return (size() - received());
+}
+
+int64_t Slice::writePosition() const {
+  return begin_ + received();
+}
+
+bool Slice::truncateEnd(int64_t new_end) {
+  if (end_ == -1 || new_end >= end_)
+    return false;
+
+  if (new_end + 1 < begin_ + received())
+    return false;
+
+  end_ = new_end;
+  return true;
+}
+
 int64_t Slice::diskCacheSize() const {
   return disk_cache_size_;
 }
@@ -113,28 +238,58 @@ static size_t __SliceWriteBodyCallback(char* buffer,
   Slice* pThis = (Slice*)outstream;
 
   size_t write_size = size * nitems;
-  if (!pThis->onNewData(buffer, write_size)) {
-    assert(false);
+
+  // The range may have been truncated by splitting, the data after it belongs to another slice.
+  // Returning a smaller size aborts the transfer with CURLE_WRITE_ERROR.
+  const int64_t remaining = pThis->remaining();
+  if (remaining >= 0 && (int64_t)write_size > remaining)
+    write_size = (size_t)remaining;
+
+  bool paused = false;
+  if (!pThis->onNewData(buffer, write_size, &paused)) {
     return 0;  // cause CURLE_WRITE_ERROR
   }
 
+  // libcurl delivers the same data again once the transfer is resumed.
+  if (paused)
+    return CURL_WRITEFUNC_PAUSE;
+
   return write_size;
 }
 
-ZoeResult Slice::start(void* multi, int64_t disk_cache_size, int64_t max_speed) {
+ZoeResult Slice::start(void* multi, SliceObserver* observer, int64_t disk_cache_size, int64_t max_speed) {
   if (!slice_manager_)
     return ZoeResult::UNKNOWN_ERROR;
 
   if (!slice_manager_->options())
     return ZoeResult::UNKNOWN_ERROR;
 
-  status_ = SliceStatus::DOWNLOADING;
+  setStatus(SliceStatus::DOWNLOADING);
+  observer_ = observer;
+  rate_ = -1;
+  start_received_ = received();
+  rate_time_meter_.Restart();
+  write_failed_.store(false);
+  write_paused_ = false;
+
+  // The data is copied into the mapping directly, or held by the reorder window of a stream.
+  std::shared_ptr<TargetFile> target_file = slice_manager_->targetFile();
+  disk_cache_size_ = ((target_file && (target_file->isMapped() || target_file->isStream())) ? 0L : disk_cache_size);
+
+  // Direct I/O writes whole blocks from the cache, the unaligned fragments are few if the cache
+  // is large.
+  io_alignment_ = (target_file ? target_file->ioAlignment() : 1L);
+  if (io_alignment_ > 1) {
+    disk_cache_size_ = (disk_cache_size_ + io_alignment_ - 1) / io_alignment_ * io_alignment_;
+    disk_cache_size_ = std::max(disk_cache_size_, (int64_t)DIRECT_IO_MIN_CACHE_SIZE);
+  }
+  disk_cache_offset_ = 0L;
 
-  disk_cache_size_ = disk_cache_size;
   if (disk_cache_size_ > 0) {
-    // TODO: support int64_t
-    disk_cache_buffer_ = (char*)malloc((size_t)disk_cache_size_);
+    disk_cache_buffer_ = BufferPool::Global()->acquire(disk_cache_size_);
     if (!disk_cache_buffer_) {
+      OutputVerbose(slice_manager_->options()->verbose_functor,
+                    "Slice[%d] buffer pool is exhausted, write without cache.\n", index_);
       disk_cache_size_ = 0L;
     }
   }
@@ -142,11 +297,11 @@ ZoeResult Slice::start(void* multi, int64_t disk_cache_size, int64_t max_speed)
   assert(curl_ == nullptr);
   assert(header_chunk_ == nullptr);
 
-  curl_ = curl_easy_init();
+  curl_ = AcquireEasyHandle();
   if (!curl_) {
-    OutputVerbose(slice_manager_->options()->verbose_functor, "curl_easy_init failed.\n");
+    OutputVerbose(slice_manager_->options()->verbose_functor, "Acquire curl handle failed.\n");
     freeDiskCacheBuffer();
-    status_ = SliceStatus::DOWNLOAD_FAILED;
+    setStatus(SliceStatus::DOWNLOAD_FAILED);
     return ZoeResult::INIT_CURL_FAILED;
   }
 
@@ -185,8 +340,10 @@ ZoeResult Slice::start(void* multi, int64_t disk_cache_size, int64_t max_speed)
     CHECK_SETOPT1(curl_easy_setopt(curl_, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)max_speed));
   }
   CHECK_SETOPT1(curl_easy_setopt(curl_, CURLOPT_FORBID_REUSE, 0L));
+  CHECK_SETOPT1(SetHttpVersion(curl_, slice_manager_->options()->http_version_policy));
   CHECK_SETOPT1(curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, __SliceWriteBodyCallback));
   CHECK_SETOPT1(curl_easy_setopt(curl_, CURLOPT_WRITEDATA, this));
+  CHECK_SETOPT1(curl_easy_setopt(curl_, CURLOPT_PRIVATE, (void*)static_cast<TransferObserver*>(this)));
 
   const HttpHeaders& headers = slice_manager_->options()->http_headers;
   if (headers.size() > 0) {
@@ -207,10 +364,10 @@ ZoeResult Slice::start(void* multi, int64_t disk_cache_size, int64_t max_speed)
         OutputVerbose(slice_manager_->options()->verbose_functor,
                       "CURLOPT_RANGE failed: %ld(%s).\n", (long)err,
                       curl_easy_strerror(err));
-        curl_easy_cleanup(curl_);
+        ReleaseEasyHandle(curl_);
         curl_ = nullptr;
         freeDiskCacheBuffer();
-        status_ = SliceStatus::DOWNLOAD_FAILED;
+        setStatus(SliceStatus::DOWNLOAD_FAILED);
         return ZoeResult::SET_CURL_OPTION_FAILED;
       }
     }
@@ -225,12 +382,12 @@ ZoeResult Slice::start(void* multi, int64_t disk_cache_size, int64_t max_speed)
                     "CURLOPT_RESUME_FROM_LARGE failed: %ld(%s).\n",
                     (long)err, curl_easy_strerror(err));
 
-      curl_easy_cleanup(curl_);
+      ReleaseEasyHandle(curl_);
       curl_ = nullptr;
 
       freeDiskCacheBuffer();
 
-      status_ = SliceStatus::DOWNLOAD_FAILED;
+      setStatus(SliceStatus::DOWNLOAD_FAILED);
       return ZoeResult::SET_CURL_OPTION_FAILED;
     }
   }
@@ -240,20 +397,19 @@ ZoeResult Slice::start(void* multi, int64_t disk_cache_size, int64_t max_speed)
     OutputVerbose(slice_manager_->options()->verbose_functor,
                   "curl_multi_add_handle failed: %ld(%s).\n",
                   (long)m_code, curl_multi_strerror(m_code));
-    curl_easy_cleanup(curl_);
+    ReleaseEasyHandle(curl_);
     curl_ = nullptr;
 
     freeDiskCacheBuffer();
 
-    status_ = SliceStatus::DOWNLOAD_FAILED;
+    setStatus(SliceStatus::DOWNLOAD_FAILED);
     return ZoeResult::ADD_CURL_HANDLE_FAILED;
   }
 
   return ZoeResult::SUCCESSED;
 }
 
-ZoeResult Slice::stop(void* multi) {
-  ZoeResult ret = ZoeResult::SUCCESSED;
+void Slice::cleanupCurl(void* multi) {
   if (curl_) {
     if (multi) {
       const CURLMcode code = curl_multi_remove_handle(multi, curl_);
@@ -269,9 +425,14 @@ ZoeResult Slice::stop(void* multi) {
       header_chunk_ = nullptr;
     }
 
-    curl_easy_cleanup(curl_);
+    ReleaseEasyHandle(curl_);
     curl_ = nullptr;
   }
+}
+
+ZoeResult Slice::stop(void* multi) {
+  ZoeResult ret = ZoeResult::SUCCESSED;
+  cleanupCurl(multi);
 
   bool discard_downloaded = false;
 
@@ -292,11 +453,13 @@ ZoeResult Slice::stop(void* multi) {
   }
 
   if (discard_downloaded) {
-    disk_capacity_.store(0);
-    disk_cache_capacity_.store(0);
+    waitWritten();
+    reset();
   }
-  else if (!flushToDisk()) {
-    ret = ZoeResult::FLUSH_TMP_FILE_FAILED;
+  else {
+    const bool flushed = flushToDisk();
+    if (!waitWritten() || !flushed)
+      ret = ZoeResult::FLUSH_TMP_FILE_FAILED;
   }
 
   freeDiskCacheBuffer();
@@ -304,8 +467,54 @@ ZoeResult Slice::stop(void* multi) {
   return ret;
 }
 
+void Slice::stopTransfer(void* multi) {
+  cleanupCurl(multi);
+  write_paused_ = false;
+  flushToDisk();
+}
+
+void Slice::detach(void* multi) {
+  if (curl_ && multi) {
+    const CURLMcode code = curl_multi_remove_handle(multi, curl_);
+    if (code != CURLM_CALL_MULTI_PERFORM && code != CURLM_OK) {
+      OutputVerbose(slice_manager_->options()->verbose_functor,
+                    "curl_multi_remove_handle failed: %ld(%s).\n",
+                    (long)code, curl_multi_strerror(code));
+    }
+  }
+}
+
+void Slice::pause(bool paused) {
+  // The write callback may pause the transfer again during resuming.
+  write_paused_ = false;
+  if (curl_) {
+    const CURLcode code = curl_easy_pause(curl_, paused ? CURLPAUSE_ALL : CURLPAUSE_CONT);
+    if (code != CURLE_OK) {
+      OutputVerbose(slice_manager_->options()->verbose_functor,
+                    "Slice<%d> curl_easy_pause failed: %ld(%s).\n",
+                    index_, (long)code, curl_easy_strerror(code));
+    }
+  }
+}
+
+bool Slice::writePaused() const {
+  return write_paused_;
+}
+
+void Slice::resumeWrite() {
+  if (write_paused_)
+    pause(false);
+}
+
+void Slice::setMaxSpeed(int64_t max_speed) {
+  if (curl_) {
+    CHECK_SETOPT1(curl_easy_setopt(curl_, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)(max_speed > 0 ? max_speed : 0)));
+  }
+}
+
 void Slice::setStatus(Slice::SliceStatus s) {
   status_ = s;
+  slice_manager_->onSliceChanged(this);
 }
 
 Slice::SliceStatus Slice::status() const {
@@ -314,17 +523,74 @@ Slice::SliceStatus Slice::status() const {
 
 void Slice::increaseFailedTimes() {
   failed_times_++;
+  slice_manager_->onSliceChanged(this);
 }
 
 int32_t Slice::failedTimes() const {
   return failed_times_;
 }
 
+void Slice::increaseHedgeTimes() {
+  hedge_times_++;
+}
+
+int32_t Slice::hedgeTimes() const {
+  return hedge_times_;
+}
+
+void Slice::setPrimary(Slice* primary) {
+  primary_ = primary;
+}
+
+Slice* Slice::primary() const {
+  return primary_;
+}
+
+int64_t Slice::rate() const {
+  return rate_;
+}
+
+void Slice::updateRate(bool finished) {
+  // The rate of a running transfer is meaningless until it has been running for a while.
+  const long elapsed = rate_time_meter_.Elapsed();
+  if (elapsed <= 0 || (!finished && elapsed < 1000))
+    return;
+
+  rate_ = (received() - start_received_) * 1000 / elapsed;
+}
+
+void Slice::abandon(void* multi) {
+  cleanupCurl(multi);
+
+  // The data that has been written is the same as the winner's, only drop the cache.
+  freeDiskCacheBuffer();
+}
+
+ZoeResult Slice::completeByHedge(void* multi) {
+  cleanupCurl(multi);
+
+  bool flushed = flushToDisk();
+  flushed = waitWritten() && flushed;
+  freeDiskCacheBuffer();
+
+  const int64_t before = received();
+  {
+    // The rest has been written by the hedge slice.
+    std::lock_guard<std::mutex> lg(checksum_mutex_);
+    disk_capacity_.store(size());
+    crc32_known_ = false;
+  }
+  queued_capacity_.store(size());
+  reportReceived(before);
+  setStatus(SliceStatus::DOWNLOAD_COMPLETED);
+  return (flushed ? ZoeResult::SUCCESSED : ZoeResult::FLUSH_TMP_FILE_FAILED);
+}
+
 bool Slice::isDataCompletedClearly() const {
   if (end_ == -1)
     return false;
 
-  return (size() == (disk_capacity_.load() + disk_cache_capacity_.load()));
+  return (size() == received());
 }
 
 bool Slice::flushToDisk() {
@@ -335,25 +601,16 @@ bool Slice::flushToDisk() {
 #else
     pthread_mutex_lock(&mutex_);
 #endif
-    int64_t written = 0;
-    const int64_t need_write = disk_cache_capacity_.load();
-    disk_cache_capacity_ = 0L;
-
-    if (need_write > 0) {
-      std::shared_ptr<TargetFile> target_file = slice_manager_->targetFile();
-      if (target_file) {
-        written = target_file->write(begin_ + disk_capacity_.load(), disk_cache_buffer_, need_write);
-      }
-
-      std::atomic_fetch_add(&disk_capacity_, written);
-      bret = (written == need_write);
-      assert(bret);
-      if (!bret) {
-        OutputVerbose(slice_manager_->options()->verbose_functor,
-                      "Slice[%d] flush to disk failed: %" PRId64 "/%" PRId64 ".\n",
-                      index_, written, need_write);
-      }
+    const int64_t before = received();
+    std::shared_ptr<TargetFile> target_file = slice_manager_->targetFile();
+    if (target_file) {
+      bret = flushCache(target_file, false);
     }
+    else {
+      bret = (disk_cache_capacity_.load() == 0);
+      disk_cache_capacity_.store(0L);
+    }
+    reportReceived(before);
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
     LeaveCriticalSection(&crit_);
 #else
@@ -364,16 +621,215 @@ bool Slice::flushToDisk() {
   return bret;
 }
 
+bool Slice::prepareFlush(FileIoRequest* request) {
+  bool bret = false;
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  EnterCriticalSection(&crit_);
+#else
+  pthread_mutex_lock(&mutex_);
+#endif
+  const int64_t capacity = disk_cache_capacity_.load();
+  if (disk_cache_buffer_ && capacity > 0) {
+    FileIoRequest r = {true, begin_ + queued_capacity_.load(), disk_cache_buffer_ + disk_cache_offset_, capacity, -1, 0L};
+    *request = r;
+    bret = true;
+  }
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  LeaveCriticalSection(&crit_);
+#else
+  pthread_mutex_unlock(&mutex_);
+#endif
+  return bret;
+}
+
+bool Slice::finishFlush(const FileIoRequest& request) {
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  EnterCriticalSection(&crit_);
+#else
+  pthread_mutex_lock(&mutex_);
+#endif
+  const int64_t before = received();
+  disk_cache_capacity_.store(0L);
+  disk_cache_offset_ = 0L;
+  std::atomic_fetch_add(&queued_capacity_, request.result);
+  addDiskData((const char*)request.data, request.result);
+  reportReceived(before);
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+  LeaveCriticalSection(&crit_);
+#else
+  pthread_mutex_unlock(&mutex_);
+#endif
+
+  const bool bret = (request.result == request.size);
+  if (!bret) {
+    OutputVerbose(slice_manager_->options()->verbose_functor,
+                  "Slice[%d] flush to disk failed: %" PRId64 "/%" PRId64 ".\n",
+                  index_, request.result, request.size);
+  }
+  return bret;
+}
+
+bool Slice::waitWritten() {
+  DiskWriteQueue* write_queue = slice_manager_->diskWriteQueue();
+  if (write_queue && pending_writes_.load() > 0)
+    write_queue->waitUntil([this]() { return pending_writes_.load() == 0; });
+
+  if (!write_failed_.load())
+    return true;
+
+  OutputVerbose(slice_manager_->options()->verbose_functor,
+                "Slice[%d] write to disk failed, disk capacity: %" PRId64 ".\n",
+                index_, disk_capacity_.load());
+
+  // Only the data before the failed write is trusted.
+  const int64_t before = received();
+  queued_capacity_.store(disk_capacity_.load());
+  disk_cache_capacity_.store(0L);
+  reportReceived(before);
+  return false;
+}
+
+bool Slice::flushCache(std::shared_ptr<TargetFile> target_file, bool keep_unaligned_tail) {
+  const int64_t capacity = disk_cache_capacity_.load();
+  if (capacity <= 0)
+    return true;
+
+  // Write up to the last block boundary, the next write starts at a block boundary then.
+  int64_t need_write = capacity;
+  if (keep_unaligned_tail && io_alignment_ > 1) {
+    const int64_t pos = begin_ + queued_capacity_.load();
+    const int64_t aligned_end = (pos + capacity) / io_alignment_ * io_alignment_;
+    if (aligned_end > pos)
+      need_write = aligned_end - pos;
+  }
+  int64_t tail = capacity - need_write;
+
+  if (slice_manager_->diskWriteQueue()) {
+    // Hand over the buffer, a new one is used for the following data.
+    char* buffer = disk_cache_buffer_;
+    const int64_t buffer_size = disk_cache_size_;
+    const int64_t offset = disk_cache_offset_;
+    disk_cache_buffer_ = BufferPool::Global()->acquire(disk_cache_size_);
+    if (!disk_cache_buffer_) {
+      disk_cache_size_ = 0L;
+      need_write = capacity;
+      tail = 0L;
+    }
+    else if (tail > 0) {
+      memcpy(disk_cache_buffer_, buffer + offset + need_write, (size_t)tail);
+    }
+    disk_cache_offset_ = 0L;
+
+    submitWrite(target_file, buffer, buffer_size, offset, need_write);
+    disk_cache_capacity_.store(tail);
+    return true;
+  }
+
+  disk_cache_capacity_.store(0L);
+  const int64_t written = target_file->write(begin_ + queued_capacity_.load(), disk_cache_buffer_ + disk_cache_offset_, need_write);
+  std::atomic_fetch_add(&queued_capacity_, written);
+  addDiskData(disk_cache_buffer_ + disk_cache_offset_, written);
+
+  const bool bret = (written == need_write);
+  assert(bret);
+  if (!bret) {
+    OutputVerbose(slice_manager_->options()->verbose_functor,
+                  "Slice[%d] flush to disk failed: %" PRId64 "/%" PRId64 ".\n",
+                  index_, written, need_write);
+    return false;
+  }
+
+  if (tail > 0)
+    memmove(disk_cache_buffer_, disk_cache_buffer_ + disk_cache_offset_ + need_write, (size_t)tail);
+  disk_cache_offset_ = 0L;
+  disk_cache_capacity_.store(tail);
+  return true;
+}
+
+void Slice::alignCacheOffset() {
+  if (disk_cache_capacity_.load() == 0)
+    disk_cache_offset_ = (begin_ + queued_capacity_.load()) % io_alignment_;
+}
+
+bool Slice::writeToDisk(std::shared_ptr<TargetFile> target_file, const char* data, int64_t data_size) {
+  if (slice_manager_->diskWriteQueue() && !target_file->isMapped()) {
+    // Written here if the buffer pool is exhausted.
+    char* buffer = BufferPool::Global()->acquire(data_size);
+    if (buffer) {
+      memcpy(buffer, data, (size_t)data_size);
+      submitWrite(target_file, buffer, data_size, 0L, data_size);
+      return true;
+    }
+  }
+
+  const int64_t written = target_file->write(begin_ + queued_capacity_.load(), data, data_size);
+  if (written != data_size) {
+    OutputVerbose(
+        slice_manager_->options()->verbose_functor,
+        "Warning: only write a part of buffer to file: %" PRId64 "/%" PRId64 ".\n",
+        written, data_size);
+  }
+  std::atomic_fetch_add(&queued_capacity_, written);
+  addDiskData(data, written);
+  return (written == data_size);
+}
+
+void Slice::submitWrite(std::shared_ptr<TargetFile> target_file,
+                        char* buffer,
+                        int64_t buffer_size,
+                        int64_t offset,
+                        int64_t data_size) {
+  const int64_t pos = begin_ + queued_capacity_.load();
+  std::atomic_fetch_add(&queued_capacity_, data_size);
+  pending_writes_++;
+  slice_manager_->diskWriteQueue()->submit(index_, target_file, pos, buffer, buffer_size, offset, data_size, this);
+}
+
+bool Slice::writesPending() const {
+  return (pending_writes_.load() > 0);
+}
+
+void Slice::onDiskWritten(const char* data, int64_t data_size, int64_t written) {
+  // The data after a failed write are not counted, disk_capacity_ stays continuous.
+  if (!write_failed_.load()) {
+    addDiskData(data, written);
+    if (written != data_size)
+      write_failed_.store(true);
+  }
+  pending_writes_--;
+}
+
 void Slice::freeDiskCacheBuffer() {
   if (disk_cache_buffer_) {
-    free(disk_cache_buffer_);
+    BufferPool::Global()->release(disk_cache_buffer_, disk_cache_size_);
     disk_cache_buffer_ = nullptr;
     disk_cache_size_ = 0L;
+
+    const int64_t before = received();
     disk_cache_capacity_.store(0L);
+    reportReceived(before);
   }
 }
 
-bool Slice::onNewData(const char* p, long data_size) {
+int64_t Slice::received() const {
+  return queued_capacity_.load() + disk_cache_capacity_.load();
+}
+
+void Slice::reportReceived(int64_t before) {
+  // Hedge slices are not part of the file, their data is counted once they win.
+  const int64_t delta = received() - before;
+  if (delta != 0 && !primary_)
+    slice_manager_->onSliceReceived(delta);
+}
+
+void Slice::onTransferDone(CURL* curl, CURLcode result) {
+  assert(curl == curl_);
+  assert(observer_);
+  if (observer_)
+    observer_->onSliceDone(shared_from_this(), result);
+}
+
+bool Slice::onNewData(const char* p, long data_size, bool* paused) {
   bool bret = false;
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
@@ -381,6 +837,7 @@ bool Slice::onNewData(const char* p, long data_size) {
 #else
   pthread_mutex_lock(&mutex_);
 #endif
+  const int64_t before = received();
 
   do {
     if (!p || data_size <= 0) {
@@ -388,57 +845,66 @@ bool Slice::onNewData(const char* p, long data_size) {
       break;
     }
 
+    if (write_failed_.load()) {
+      break;
+    }
+
     std::shared_ptr<TargetFile> target_file = slice_manager_->targetFile();
     if (!target_file) {
       break;
     }
 
+    alignCacheOffset();
+    const bool fit_in_cache =
+        (disk_cache_buffer_ && disk_cache_size_ - disk_cache_offset_ - disk_cache_capacity_ >= data_size);
+
+    // Backpressure, nothing is consumed.
+    DiskWriteQueue* write_queue = slice_manager_->diskWriteQueue();
+    if (!fit_in_cache && ((write_queue && write_queue->full()) ||
+                          !target_file->writable(begin_ + received(), data_size))) {
+      write_paused_ = true;
+      *paused = true;
+      bret = true;
+      break;
+    }
+
     // no cache buffer, directly write to file.
     if (!disk_cache_buffer_) {
-      int64_t written = target_file->write(begin_ + disk_capacity_.load(), p, data_size);
-      std::atomic_fetch_add(&disk_capacity_, written);
-
-      bret = (written == data_size);
+      bret = writeToDisk(target_file, p, data_size);
       break;
     }
 
-    if (disk_cache_size_ - disk_cache_capacity_ >= data_size) {
-      memcpy((char*)(disk_cache_buffer_ + disk_cache_capacity_.load()), p, data_size);
+    if (fit_in_cache) {
+      memcpy((char*)(disk_cache_buffer_ + disk_cache_offset_ + disk_cache_capacity_.load()), p, data_size);
       disk_cache_capacity_ += data_size;
       bret = true;
       break;
     }
 
-    const int64_t need_write = disk_cache_capacity_.load();
-
-    disk_cache_capacity_.store(0L);
-
-    int64_t written = target_file->write(begin_ + disk_capacity_, disk_cache_buffer_, need_write);
-    std::atomic_fetch_add(&disk_capacity_, written);
-    if (written != need_write) {
+    if (!flushCache(target_file, true)) {
       bret = false;
       break;
     }
 
-    if (disk_cache_size_ - disk_cache_capacity_ >= data_size) {
-      memcpy((char*)(disk_cache_buffer_ + disk_cache_capacity_.load()), p, data_size);
+    alignCacheOffset();
+    if (disk_cache_buffer_ && disk_cache_size_ - disk_cache_offset_ - disk_cache_capacity_ >= data_size) {
+      memcpy((char*)(disk_cache_buffer_ + disk_cache_offset_ + disk_cache_capacity_.load()), p, data_size);
       std::atomic_fetch_add(&disk_cache_capacity_, data_size);
       bret = true;
       break;
     }
 
-    written = target_file->write(begin_ + disk_capacity_.load(), p, data_size);
-    if (written != data_size) {
-      OutputVerbose(
-          slice_manager_->options()->verbose_functor,
-          "Warning: only write a part of buffer to file: %" PRId64 "/%" PRId64 ".\n",
-          written, data_size);
+    // Larger than the cache, the kept tail goes first.
+    if (!flushCache(target_file, false)) {
+      bret = false;
+      break;
     }
-    std::atomic_fetch_add(&disk_capacity_, written);
 
-    bret = (written == data_size);
+    bret = writeToDisk(target_file, p, data_size);
   } while (false);
 
+  reportReceived(before);
+
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
   LeaveCriticalSection(&crit_);
 #else
@@ -24,6 +24,10 @@
 #include <memory>
 #include <atomic>
 #include "target_file.h"
+#include "disk_writer.h"
+#include "curl_utils.h"
+#include "time_meter.hpp"
+#include "intrusive_list.hpp"
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
 #include <windows.h>
 #else
@@ -33,7 +37,24 @@
 struct curl_slist;
 namespace zoe {
 class SliceManager;
-class Slice {
+class Slice;
+
+// Receives the completion of slice transfers from the event loop.
+class SliceObserver {
+ public:
+  virtual ~SliceObserver() {}
+  virtual void onSliceDone(std::shared_ptr<Slice> slice, CURLcode result) = 0;
+};
+
+// The easy handle of a running slice carries the slice itself as CURLOPT_PRIVATE, so the
+// completion is resolved without searching.
+// SliceManager keeps slices in per-status queues through IntrusiveListNode.
+// With a DiskWriter the received data is written on the I/O threads, the transfer is paused by
+// its write callback while the write queue is full.
+class Slice : public TransferObserver,
+              public DiskWriteObserver,
+              public IntrusiveListNode<Slice>,
+              public std::enable_shared_from_this<Slice> {
  public:
   enum class SliceStatus {
     UNFETCH = 0,
@@ -56,35 +77,152 @@ class Slice {
   int64_t size() const;
   int64_t capacity() const;
 
+  // Bytes in disk file that have been made durable under Options::durability_policy.
+  int64_t durableCapacity() const;
+  void setDurableCapacity(int64_t capacity, const utf8string& checksum);
+
+  // CRC32 of the data in disk file, lowercase hex. Empty if unknown, e.g. the data has been
+  // received by a hedge slice, or loaded from an index file without checksums.
+  utf8string checksum() const;
+  // Same as checksum(), but of the durable data, see durableCapacity().
+  utf8string durableChecksum() const;
+  // The checksum of the |init_capacity| bytes, set before the slice starts.
+  void setChecksum(const utf8string& checksum);
+
+  // Capacity and checksum of the data in disk file, taken together.
+  void diskState(int64_t* capacity, utf8string* checksum) const;
+
+  // Drop all downloaded data, the range is downloaded again.
+  void reset();
+
+  // Bytes of the range that have not been received yet, -1 if end_ is -1.
+  int64_t remaining() const;
+
+  // File position of the next received data.
+  int64_t writePosition() const;
+
+  // Shrink the range to [begin_, new_end], the data after |new_end| is left to another slice.
+  // Return false if |new_end| is out of the range or the data has been received.
+  bool truncateEnd(int64_t new_end);
+
   int64_t diskCacheSize() const;
   int64_t diskCacheCapacity() const;
 
   int32_t index() const;
   void* curlHandle();
 
-  ZoeResult start(void* multi, int64_t disk_cache_size, int64_t max_speed);
+  // |observer| receives the completion of this slice from the event loop.
+  ZoeResult start(void* multi, SliceObserver* observer, int64_t disk_cache_size, int64_t max_speed);
   ZoeResult stop(void* multi);  // must setStatus first
 
+  // Remove the transfer and queue the data in cache for writing, without waiting for the writes.
+  // The slice is left DOWNLOADING, stop() finishes it once writesPending() is false.
+  void stopTransfer(void* multi);
+
+  // Remove the easy handle from |multi|, stop() can be called later without the multi handle.
+  void detach(void* multi);
+
+  void pause(bool paused);
+
+  // Paused by the write callback because the write queue of DiskWriter is full, or the data is
+  // beyond the reorder window of a stream.
+  bool writePaused() const;
+  void resumeWrite();
+
+  // Change the max receive speed of the running transfer, -1 means unlimited.
+  void setMaxSpeed(int64_t max_speed);
+
   void setStatus(SliceStatus s);
   SliceStatus status() const;
 
   void increaseFailedTimes();
   int32_t failedTimes() const;
 
+  void increaseHedgeTimes();
+  int32_t hedgeTimes() const;
+
+  // The slice that a hedge slice duplicates, nullptr for normal slices.
+  void setPrimary(Slice* primary);
+  Slice* primary() const;
+
+  // Average receiving rate of the last transfer in bytes per second, -1 if not sampled yet.
+  int64_t rate() const;
+  void updateRate(bool finished);
+
+  // Stop the transfer and drop the data in cache, used by the loser of hedging. The queued writes
+  // are not waited, the slice must be kept until writesPending() is false.
+  void abandon(void* multi);
+
+  // The remaining range has been received by the hedge slice, stop the transfer and mark
+  // the whole range as downloaded. The writes of both slices must have been done.
+  ZoeResult completeByHedge(void* multi);
+
   // if end_ is -1, this function will return false.
   bool isDataCompletedClearly() const;
 
-  bool onNewData(const char* p, long size);
+  // |paused| is set to true if the data is not accepted because the write queue is full.
+  bool onNewData(const char* p, long size, bool* paused);
+
+  // Write the data in cache to disk file, it may be queued by DiskWriter, see waitWritten().
   bool flushToDisk();
 
+  // Same as flushToDisk() without DiskWriter, but the write is done by the caller, so the
+  // caches of several slices are written by one batch. No data can be received in between.
+  // Return false if the cache is empty.
+  bool prepareFlush(FileIoRequest* request);
+  bool finishFlush(const FileIoRequest& request);
+
+  // Wait for the queued writes, return false if any of them failed.
+  bool waitWritten();
+
+  // Some writes queued by DiskWriteQueue are not done yet.
+  bool writesPending() const;
+
+  // TransferObserver
+  virtual void onTransferDone(CURL* curl, CURLcode result);
+
+  // DiskWriteObserver
+  virtual void onDiskWritten(const char* data, int64_t data_size, int64_t written);
+
  protected:
+  // Write the cached data, the unaligned tail is kept in the cache if |keep_unaligned_tail|.
+  bool flushCache(std::shared_ptr<TargetFile> target_file, bool keep_unaligned_tail);
+  // Place the data of an empty cache at the same offset in a block as its file position, so the
+  // cache is written without copying by the backends that need aligned buffers.
+  void alignCacheOffset();
+  bool writeToDisk(std::shared_ptr<TargetFile> target_file, const char* data, int64_t data_size);
+  void submitWrite(std::shared_ptr<TargetFile> target_file,
+                   char* buffer,
+                   int64_t buffer_size,
+                   int64_t offset,
+                   int64_t data_size);
+
   void freeDiskCacheBuffer();
+  void cleanupCurl(void* multi);
+
+  // Count |written| bytes of |data| into disk_capacity_ and the checksum.
+  void addDiskData(const char* data, int64_t written);
+  static utf8string FormatChecksum(uint32_t crc32);
+
+  // Bytes in disk file, write queue and cache.
+  int64_t received() const;
+  // Report the change of received bytes since |before| to SliceManager.
+  void reportReceived(int64_t before);
 
  protected:
   int32_t index_;
   int64_t begin_;  // data range is [begin_, end_]
   int64_t end_;
   std::atomic<int64_t> disk_capacity_;  // data size in disk file
+  std::atomic<int64_t> durable_capacity_;
+  uint32_t disk_crc32_;  // running CRC32 of the data in disk file, valid if crc32_known_
+  bool crc32_known_;
+  utf8string durable_checksum_;
+  mutable std::mutex checksum_mutex_;  // disk_capacity_ and disk_crc32_ change together
+  std::atomic<int64_t> queued_capacity_;  // data size in disk file and write queue
+  std::atomic<int32_t> pending_writes_;
+  std::atomic<bool> write_failed_;
+  bool write_paused_;
 
   void* curl_;
   struct curl_slist* header_chunk_;
@@ -92,9 +230,18 @@ class Slice {
   int64_t disk_cache_size_;                   // byte
   std::atomic<int64_t> disk_cache_capacity_;  // data size in cache.
   char* disk_cache_buffer_;
+  int64_t disk_cache_offset_;  // the cached data begins at this offset of the buffer
+  int64_t io_alignment_;       // TargetFile::ioAlignment()
 
   SliceStatus status_;
   int32_t failed_times_;
+  int32_t hedge_times_;
+  Slice* primary_;
+  SliceObserver* observer_;
+
+  int64_t rate_;
+  int64_t start_received_;
+  TimeMeter rate_time_meter_;
 
   std::shared_ptr<SliceManager> slice_manager_;
 
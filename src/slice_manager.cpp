@@ -29,6 +29,7 @@
 #include "options.h"
 #include "string_encode.h"
 #include "verbose.h"
+#include "hasher.h"
 
 using json = nlohmann::json;
 
@@ -40,29 +41,339 @@ SliceManager::SliceManager(Options* options, const utf8string& redirect_url)
     : options_(options)
     , redirect_url_(redirect_url)
     , origin_file_size_(0L)
+    , max_index_(0)
+    , synced_bytes_(0L)
     , target_file_(nullptr) {
-  index_file_path_ = makeIndexFilePath();
+  if (!isStream())
+    index_file_path_ = makeIndexFilePath();
+  downloaded_bytes_.store(0L);
+
+  if (options_->disk_writer_thread_num > 0)
+    disk_write_queue_.reset(new DiskWriteQueue(options_->disk_writer_thread_num, options_->disk_writer_queue_size));
 }
 
 SliceManager::~SliceManager() {
   target_file_.reset();
 }
 
-std::shared_ptr<Slice> SliceManager::getSlice(void* curlHandle) {
-  for (auto& s : slices_) {
-    if (s->curlHandle() == curlHandle)
-      return s;
+std::shared_ptr<Slice> SliceManager::getSlice(Slice::SliceStatus status) const {
+  Slice* slice = queues_[(int)status].front();
+  return (slice ? slice->shared_from_this() : nullptr);
+}
+
+bool SliceManager::hasSlice(Slice::SliceStatus status) const {
+  return !queues_[(int)status].empty();
+}
+
+std::shared_ptr<Slice> SliceManager::getRetryableFailedSlice() const {
+  return getSlice(Slice::SliceStatus::DOWNLOAD_FAILED);
+}
+
+bool SliceManager::isStream() const {
+  return (options_->stream_functor != nullptr);
+}
+
+std::shared_ptr<Slice> SliceManager::getFirstPendingSlice() const {
+  return (pending_slices_.empty() ? nullptr : (*pending_slices_.begin())->shared_from_this());
+}
+
+Slice* SliceManager::firstUncompletedSlice() const {
+  return (uncompleted_slices_.empty() ? nullptr : *uncompleted_slices_.begin());
+}
+
+std::shared_ptr<Slice> SliceManager::parkBlockedSlice(void* multi) {
+  const Slice* first = firstUncompletedSlice();
+  if (!first || queueIndexOf(first) == EXHAUSTED_QUEUE)
+    return nullptr;
+
+  if (first->status() != Slice::SliceStatus::UNFETCH &&
+      first->status() != Slice::SliceStatus::DOWNLOAD_FAILED)
+    return nullptr;
+
+  Slice* last = nullptr;
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  for (Slice* s = downloading.front(); s; s = downloading.next(s)) {
+    if (!s->writePaused() || hedges_.count(s))
+      continue;
+    if (!last || s->begin() > last->begin())
+      last = s;
   }
-  return nullptr;
+
+  if (!last)
+    return nullptr;
+
+  OutputVerbose(options_->verbose_functor,
+                "Park slice<%d> at %" PRId64 ", slice<%d> is waiting for a connection.\n",
+                last->index(), last->writePosition(), first->index());
+
+  // Not a failure, the received data is kept.
+  last->stopTransfer(multi);
+  return last->shared_from_this();
 }
 
-std::shared_ptr<Slice> SliceManager::getSlice(Slice::SliceStatus status) {
-  for (auto& s : slices_) {
-    if (s && s->status() == status) {
-      return s;
+bool SliceManager::streamStalled() const {
+  const Slice* first = firstUncompletedSlice();
+  return (first && queueIndexOf(first) == EXHAUSTED_QUEUE);
+}
+
+bool SliceManager::streamCanceled() const {
+  return (target_file_ && target_file_->streamCanceled());
+}
+
+int32_t SliceManager::queueIndexOf(const Slice* slice) const {
+  if (slice->status() == Slice::SliceStatus::DOWNLOAD_FAILED &&
+      slice->failedTimes() >= options_->slice_max_failed_times)
+    return EXHAUSTED_QUEUE;
+  return (int32_t)slice->status();
+}
+
+void SliceManager::onSliceChanged(Slice* slice) {
+  // Hedge slices are not queued.
+  int32_t cur = -1;
+  for (int32_t i = 0; i < QUEUE_NUM; i++) {
+    if (queues_[i].contains(slice)) {
+      cur = i;
+      break;
+    }
+  }
+
+  if (cur == -1)
+    return;
+
+  const int32_t target = queueIndexOf(slice);
+  if (target == cur)
+    return;
+
+  if (cur == (int32_t)Slice::SliceStatus::DOWNLOADING && slice->rate() >= 0) {
+    finished_rates_.push_back(slice->rate());
+    if (finished_rates_.size() > 64)
+      finished_rates_.pop_front();
+  }
+
+  queues_[cur].remove(slice);
+  queues_[target].pushBack(slice);
+  updateOrderedSlices(slice, target);
+}
+
+void SliceManager::updateOrderedSlices(Slice* slice, int32_t queue_index) {
+  if (queue_index == (int32_t)Slice::SliceStatus::DOWNLOAD_COMPLETED)
+    uncompleted_slices_.erase(slice);
+  else
+    uncompleted_slices_.insert(slice);
+
+  if (queue_index == (int32_t)Slice::SliceStatus::UNFETCH ||
+      queue_index == (int32_t)Slice::SliceStatus::DOWNLOAD_FAILED)
+    pending_slices_.insert(slice);
+  else
+    pending_slices_.erase(slice);
+}
+
+void SliceManager::addSlice(std::shared_ptr<Slice> slice) {
+  slices_.push_back(slice);
+  const int32_t queue_index = queueIndexOf(slice.get());
+  queues_[queue_index].pushBack(slice.get());
+  updateOrderedSlices(slice.get(), queue_index);
+  downloaded_bytes_ += (slice->capacity() + slice->diskCacheCapacity());
+  max_index_ = std::max(max_index_, slice->index());
+}
+
+void SliceManager::clearSlices() {
+  for (auto& q : queues_)
+    q.clear();
+  uncompleted_slices_.clear();
+  pending_slices_.clear();
+  slices_.clear();
+  finished_rates_.clear();
+  max_index_ = 0;
+  downloaded_bytes_.store(0L);
+}
+
+int64_t SliceManager::downloadedBytes() const {
+  return downloaded_bytes_.load();
+}
+
+void SliceManager::onSliceReceived(int64_t delta) {
+  downloaded_bytes_ += delta;
+}
+
+std::shared_ptr<Slice> SliceManager::splitSlice(int64_t min_split_size) {
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  Slice* largest = nullptr;
+  for (Slice* s = downloading.front(); s; s = downloading.next(s)) {
+    if (s->end() == -1)
+      continue;
+
+    // Stopped, waiting for its queued writes.
+    if (!s->curlHandle())
+      continue;
+
+    // The remaining range of a hedged slice is downloaded twice already.
+    if (hedges_.count(s))
+      continue;
+
+    if (!largest || s->remaining() > largest->remaining())
+      largest = s;
+  }
+
+  if (!largest)
+    return nullptr;
+
+  const int64_t remaining = largest->remaining();
+  if (remaining < min_split_size * 2)
+    return nullptr;
+
+  const int64_t old_end = largest->end();
+  const int64_t new_begin = old_end + 1 - remaining / 2;
+  if (!largest->truncateEnd(new_begin - 1))
+    return nullptr;
+
+  std::shared_ptr<Slice> slice = std::make_shared<Slice>(max_index_ + 1, new_begin, old_end, 0L, shared_from_this());
+  addSlice(slice);
+
+  OutputVerbose(options_->verbose_functor,
+                "Split slice<%d> at %" PRId64 ", new slice<%d> [%" PRId64 "~%" PRId64 "].\n",
+                largest->index(), new_begin, slice->index(), new_begin, old_end);
+
+  // Record the new boundaries, the resumed download must not use the old range of |largest|.
+  if (!flushIndexFile())
+    OutputVerbose(options_->verbose_functor, "Flush index file failed.\n");
+
+  return slice;
+}
+
+void SliceManager::updateSliceRates() {
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  for (Slice* s = downloading.front(); s; s = downloading.next(s))
+    s->updateRate(false);
+}
+
+std::shared_ptr<Slice> SliceManager::makeHedgeSlice(int32_t rate_percent) {
+  // A hedge slice that could not get a connection last time.
+  for (auto& it : hedges_) {
+    if (it.second->status() == Slice::SliceStatus::UNFETCH)
+      return it.second;
+  }
+
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  std::vector<int64_t> rates(finished_rates_.begin(), finished_rates_.end());
+  for (Slice* s = downloading.front(); s; s = downloading.next(s)) {
+    if (s->rate() >= 0)
+      rates.push_back(s->rate());
+  }
+
+  if (rates.size() < 2)
+    return nullptr;
+
+  std::nth_element(rates.begin(), rates.begin() + rates.size() / 2, rates.end());
+  const int64_t median = rates[rates.size() / 2];
+
+  Slice* slowest = nullptr;
+  for (Slice* s = downloading.front(); s; s = downloading.next(s)) {
+    if (s->rate() < 0 || s->end() == -1 || !s->curlHandle())
+      continue;
+
+    if (s->hedgeTimes() > 0 || s->remaining() <= 0)
+      continue;
+
+    // Slow because it is paused by the write queue or the reorder window, not by the network.
+    if (s->writePaused())
+      continue;
+
+    if (s->rate() * 100 >= median * rate_percent)
+      continue;
+
+    if (!slowest || s->rate() < slowest->rate())
+      slowest = s;
+  }
+
+  if (!slowest)
+    return nullptr;
+
+  const int64_t begin = slowest->end() + 1 - slowest->remaining();
+  std::shared_ptr<Slice> hedge = std::make_shared<Slice>(slowest->index(), begin, slowest->end(), 0L, shared_from_this());
+  hedge->setPrimary(slowest);
+  slowest->increaseHedgeTimes();
+  hedges_[slowest] = hedge;
+
+  OutputVerbose(options_->verbose_functor,
+                "Hedge slice<%d> [%" PRId64 "~%" PRId64 "], rate: %" PRId64 ", median: %" PRId64 ".\n",
+                slowest->index(), begin, slowest->end(), slowest->rate(), median);
+  return hedge;
+}
+
+std::shared_ptr<Slice> SliceManager::hedgeOf(const Slice* primary) const {
+  const auto it = hedges_.find(primary);
+  return (it != hedges_.end() ? it->second : nullptr);
+}
+
+std::shared_ptr<Slice> SliceManager::primaryOf(const Slice* hedge) const {
+  return (hedge->primary() ? hedge->primary()->shared_from_this() : nullptr);
+}
+
+void SliceManager::removeHedge(const Slice* primary) {
+  hedges_.erase(primary);
+}
+
+void SliceManager::detachAllSlices(void* multi) {
+  // Only downloading slices own easy handles.
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  for (Slice* s = downloading.front(); s; s = downloading.next(s))
+    s->detach(multi);
+
+  for (auto& it : hedges_)
+    it.second->detach(multi);
+}
+
+void SliceManager::pauseAllSlices(bool paused) {
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  for (Slice* s = downloading.front(); s; s = downloading.next(s))
+    s->pause(paused);
+
+  for (auto& it : hedges_) {
+    if (it.second->status() == Slice::SliceStatus::DOWNLOADING)
+      it.second->pause(paused);
+  }
+}
+
+bool SliceManager::canResumeWrite(const Slice* slice) const {
+  if (disk_write_queue_ && disk_write_queue_->full())
+    return false;
+  return (!target_file_ || target_file_->writable(slice->writePosition(), 1));
+}
+
+bool SliceManager::resumeWritePausedSlices() {
+  if (!disk_write_queue_ && !isStream())
+    return false;
+
+  bool still_paused = false;
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  for (Slice* s = downloading.front(); s; s = downloading.next(s)) {
+    if (s->writePaused()) {
+      if (canResumeWrite(s))
+        s->resumeWrite();
+      still_paused = still_paused || s->writePaused();
     }
   }
-  return nullptr;
+
+  for (auto& it : hedges_) {
+    if (it.second->writePaused()) {
+      if (canResumeWrite(it.second.get()))
+        it.second->resumeWrite();
+      still_paused = still_paused || it.second->writePaused();
+    }
+  }
+  return still_paused;
+}
+
+void SliceManager::setSlicesMaxSpeed(int64_t max_speed) {
+  const IntrusiveList<Slice>& downloading = queues_[(int)Slice::SliceStatus::DOWNLOADING];
+  for (Slice* s = downloading.front(); s; s = downloading.next(s))
+    s->setMaxSpeed(max_speed);
+
+  for (auto& it : hedges_) {
+    if (it.second->status() == Slice::SliceStatus::DOWNLOADING)
+      it.second->setMaxSpeed(max_speed);
+  }
 }
 
 const Options* SliceManager::options() const {
@@ -126,7 +437,7 @@ ZoeResult SliceManager::loadExistSlice(int64_t cur_file_size,
       return ZoeResult::TMP_FILE_CANNOT_RW;
 
     std::shared_ptr<TargetFile> target_file =
-        std::make_shared<TargetFile>(tmp_file_path);
+        std::make_shared<TargetFile>(tmp_file_path, options_->file_io_engine);
 
     if (!target_file->open())
       return ZoeResult::OPEN_TMP_FILE_FAILED;
@@ -144,7 +455,7 @@ ZoeResult SliceManager::loadExistSlice(int64_t cur_file_size,
     if (options_->url.length() == 0)
       options_->url = j["url"].get<utf8string>();
 
-    slices_.clear();
+    clearSlices();
 
     for (auto& it : j["slices"]) {
       std::shared_ptr<Slice> slice = std::make_shared<Slice>(
@@ -153,7 +464,10 @@ ZoeResult SliceManager::loadExistSlice(int64_t cur_file_size,
           it["end"].get<int64_t>(),
           it["capacity"].get<int64_t>(),
           shared_from_this());
-      slices_.push_back(slice);
+      // Not recorded by the older versions.
+      if (it.count("checksum"))
+        slice->setChecksum(it["checksum"].get<utf8string>());
+      addSlice(slice);
     }
 
     target_file_ = target_file;
@@ -161,24 +475,65 @@ ZoeResult SliceManager::loadExistSlice(int64_t cur_file_size,
     OutputVerbose(options_->verbose_functor,
                   "Load exist slice exception: %s.\n",
                   e.what() ? e.what() : "");
-    slices_.clear();
+    clearSlices();
     return ZoeResult::INVALID_INDEX_FORMAT;
   }
 
   content_md5_ = cur_content_md5;
   origin_file_size_ = cur_file_size;
+
   OutputVerbose(options_->verbose_functor, "Load exist slice success.\n");
   dumpSlice();
   return ZoeResult::SUCCESSED;
 }
 
+int32_t SliceManager::validateExistSlices() {
+  // The data in the temporary file may have been changed or lost after the index was written.
+  // The data read for the checksums is hashed into the prefix too, the rest is read back once the
+  // hashed prefix reaches it.
+  enablePrefixHash();
+  const int32_t reset_num = resetCorruptedSlices(false);
+  if (reset_num > 0)
+    OutputVerbose(options_->verbose_functor, "%d slices do not match the checksums.\n", reset_num);
+  return reset_num;
+}
+
 bool SliceManager::flushAllSlices() {
+  // In file order, the caches of adjacent slices are merged by the backend.
+  std::vector<Slice*> sorted;
+  sorted.reserve(slices_.size());
+  for (auto& s : slices_)
+    sorted.push_back(s.get());
+  std::sort(sorted.begin(), sorted.end(), [](const Slice* a, const Slice* b) { return a->begin() < b->begin(); });
+
   bool bret = true;
-  for (auto& s : slices_) {
-    if (!s->flushToDisk()) {
-      bret = false;  // not break
+  if (disk_write_queue_ || !target_file_) {
+    for (Slice* s : sorted) {
+      if (!s->flushToDisk()) {
+        bret = false;  // not break
+      }
+    }
+    return bret;
+  }
+
+  // Written by one batch instead of one write per slice.
+  std::vector<FileIoRequest> requests;
+  std::vector<Slice*> owners;
+  for (Slice* s : sorted) {
+    FileIoRequest request;
+    if (s->prepareFlush(&request)) {
+      requests.push_back(request);
+      owners.push_back(s);
     }
   }
+
+  if (!requests.empty())
+    target_file_->performBatch(requests.data(), (int32_t)requests.size());
+
+  for (size_t i = 0; i < requests.size(); i++) {
+    if (!owners[i]->finishFlush(requests[i]))
+      bret = false;
+  }
   return bret;
 }
 
@@ -202,14 +557,41 @@ std::shared_ptr<TargetFile> SliceManager::targetFile() const {
   return target_file_;
 }
 
+DiskWriteQueue* SliceManager::diskWriteQueue() const {
+  return disk_write_queue_.get();
+}
+
 ZoeResult SliceManager::makeSlices(bool accept_ranges) {
-  slices_.clear();
+  clearSlices();
+  if (isStream()) {
+    if (target_file_)
+      target_file_.reset();
+    target_file_ = std::make_shared<TargetFile>(utf8string(), options_->file_io_engine);
+
+    // The hash is calculated on delivering, the data can not be read back.
+    std::unique_ptr<Hasher> hasher;
+    if (needVerifyHash())
+      hasher.reset(Hasher::Create(options_->hash_type));
+    if (!target_file_->openStream(options_->stream_functor, options_->stream_window_size, std::move(hasher), options_->hash_type)) {
+      OutputVerbose(options_->verbose_functor, "Open stream failed.\n");
+      return ZoeResult::CREATE_TARGET_FILE_FAILED;
+    }
+    return makeSliceRanges(accept_ranges);
+  }
+
   utf8string tmp_file_path = options_->target_file_path + TMP_FILE_EXTENSION;
   if (target_file_)
     target_file_.reset();
-  target_file_ = std::make_shared<TargetFile>(tmp_file_path);
-
-  if (!target_file_->createNew(origin_file_size_)) {
+  target_file_ = std::make_shared<TargetFile>(tmp_file_path, options_->file_io_engine);
+
+  bool no_space = false;
+  if (!target_file_->createNew(origin_file_size_, options_->preallocate_policy, &no_space)) {
+    if (no_space) {
+      OutputVerbose(options_->verbose_functor,
+                    "No enough disk space for %" PRId64 " bytes.\n", origin_file_size_);
+      FileUtil::RemoveFile(tmp_file_path);
+      return ZoeResult::INSUFFICIENT_DISK_SPACE;
+    }
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
     OutputVerbose(options_->verbose_functor,
                   "Create target file failed, GLE: %d.\n", GetLastError());
@@ -219,12 +601,64 @@ ZoeResult SliceManager::makeSlices(bool accept_ranges) {
     return ZoeResult::CREATE_TARGET_FILE_FAILED;
   }
 
+  enablePrefixHash();
+  return makeSliceRanges(accept_ranges);
+}
+
+int32_t SliceManager::resetCorruptedSlices(bool reset_unknown) {
+  if (!target_file_ || isStream())
+    return 0;
+
+  // In file order, so that the checked data continues the hashed prefix.
+  std::vector<Slice*> sorted;
+  sorted.reserve(slices_.size());
+  for (auto& s : slices_)
+    sorted.push_back(s.get());
+  std::sort(sorted.begin(), sorted.end(), [](const Slice* a, const Slice* b) { return a->begin() < b->begin(); });
+
+  int32_t reset_num = 0;
+  for (Slice* s : sorted) {
+    if (s->capacity() <= 0)
+      continue;
+
+    const utf8string expected = s->checksum();
+    if (expected.empty() && !reset_unknown) {
+      target_file_->markWritten(s->begin(), s->capacity());
+      continue;
+    }
+
+    if (!expected.empty()) {
+      const ZoeResult ret = target_file_->checkWrittenRange(
+          HashType::CRC32, s->begin(), s->begin() + s->capacity(), expected, options_);
+      if (ret == ZoeResult::CANCELED)
+        break;
+      if (ret == ZoeResult::SUCCESSED)
+        continue;
+    }
+
+    OutputVerbose(options_->verbose_functor,
+                  "Slice<%d> checksum not match, %" PRId64 " bytes are discarded.\n",
+                  s->index(), s->capacity());
+    s->reset();
+    if (s->status() != Slice::SliceStatus::DOWNLOADING)
+      s->setStatus(Slice::SliceStatus::UNFETCH);
+    reset_num++;
+  }
+  return reset_num;
+}
+
+void SliceManager::enablePrefixHash() {
+  if (target_file_ && needVerifyHash())
+    target_file_->enablePrefixHash(options_->hash_type);
+}
+
+ZoeResult SliceManager::makeSliceRanges(bool accept_ranges) {
   assert(origin_file_size_ > 0L || origin_file_size_ == -1L);
 
   if (!accept_ranges || origin_file_size_ == -1L) {
     std::shared_ptr<Slice> slice =
         std::make_shared<Slice>(0L, 0L, origin_file_size_ == -1L ? origin_file_size_ : origin_file_size_ - 1, 0L, shared_from_this());
-    slices_.push_back(slice);
+    addSlice(slice);
   }
   else {
     int64_t slice_size = 0L;
@@ -246,6 +680,13 @@ ZoeResult SliceManager::makeSlices(bool accept_ranges) {
       else {
         slice_size = ZOE_DEFAULT_FIXED_SLICE_SIZE_BYTE;
       }
+
+      // Slices of all connections fit in the reorder window of a stream.
+      if (isStream()) {
+        const int64_t window_slice_size = std::max(
+            options_->stream_window_size / std::max(options_->thread_num, 1), (int64_t)ZOE_MIN_SPLIT_SLICE_SIZE_BYTE);
+        slice_size = std::min(slice_size, window_slice_size);
+      }
     }
 
     if (slice_size > 0L) {
@@ -268,7 +709,7 @@ ZoeResult SliceManager::makeSlices(bool accept_ranges) {
 
         std::shared_ptr<Slice> slice = std::make_shared<Slice>(
             slice_index, cur_begin, cur_end, 0L, shared_from_this());
-        slices_.push_back(slice);
+        addSlice(slice);
 
         cur_begin = cur_end + 1L;
       } while (!is_last);
@@ -333,7 +774,8 @@ ZoeResult SliceManager::checkAllSliceCompletedByHash() const {
   if (!expectHash.empty()) {
     if (target_file_) {
       utf8string str_hash;
-      OutputVerbose(options_->verbose_functor, "Start calculate temp file hash.\n");
+      OutputVerbose(options_->verbose_functor, "Start calculate temp file hash, %" PRId64 " bytes hashed while downloading.\n",
+                    target_file_->hashedBytes());
 
       if (target_file_->calculateFileHash(options_, str_hash) == ZoeResult::SUCCESSED) {
         OutputVerbose(options_->verbose_functor, "Temp file hash: %s.\n", str_hash.c_str());
@@ -360,6 +802,14 @@ ZoeResult SliceManager::checkAllSliceCompletedByHash() const {
 ZoeResult SliceManager::finishDownloadProgress(bool need_check_completed, void* mult) {
   // first of all, flush buffer to disk
   OutputVerbose(options_->verbose_functor, "Start flushing cache to disk.\n");
+
+  // Unfinished hedge slices lose, their primary slices keep the downloaded data.
+  for (auto& it : hedges_) {
+    it.second->abandon(mult);
+    it.second->waitWritten();
+  }
+  hedges_.clear();
+
   ZoeResult stop_ret = ZoeResult::SUCCESSED;
   for (auto& s : slices_) {
     assert(s);
@@ -371,6 +821,11 @@ ZoeResult SliceManager::finishDownloadProgress(bool need_check_completed, void*
   }
 
   // then flush index file.
+  if (options_->durability_policy == DurabilityPolicy::Periodic) {
+    if (!syncSlices(true))
+      OutputVerbose(options_->verbose_functor, "Sync temporary file failed.\n");
+  }
+
   if (!flushIndexFile()) {
     OutputVerbose(options_->verbose_functor, "Flush index file failed.\n");
   }
@@ -386,15 +841,35 @@ ZoeResult SliceManager::finishDownloadProgress(bool need_check_completed, void*
       ZoeResult r = checkAllSliceCompletedByFileSize();
       if (r != ZoeResult::SUCCESSED)
         return r;
+
+      // Received data may still wait for a gap before it.
+      if (isStream() && target_file_->fileSize() != origin_file_size_) {
+        OutputVerbose(options_->verbose_functor, "Stream delivered size(%" PRId64 ") not qualified(%" PRId64 ").\n",
+                      target_file_->fileSize(), origin_file_size_);
+        return ZoeResult::SLICE_DOWNLOAD_FAILED;
+      }
     }
 
     if (needVerifyHash()) {
       ZoeResult r = checkAllSliceCompletedByHash();
+      if (r == ZoeResult::HASH_VERIFY_NOT_PASS) {
+        // Only the corrupted slices are downloaded again, by the caller or the next start.
+        const int32_t reset_num = resetCorruptedSlices(true);
+        OutputVerbose(options_->verbose_functor, "%d slices are reset by checksums.\n", reset_num);
+        if (reset_num > 0 && !flushIndexFile())
+          OutputVerbose(options_->verbose_functor, "Flush index file failed.\n");
+      }
       if (r != ZoeResult::SUCCESSED)
         return r;
     }
   }
 
+  // Nothing to rename, the data has been delivered.
+  if (isStream()) {
+    OutputVerbose(options_->verbose_functor, "Stream delivered %" PRId64 " bytes.\n", target_file_->fileSize());
+    return ZoeResult::SUCCESSED;
+  }
+
   if (!target_file_->renameTo(options_, options_->target_file_path, false)) {
     unsigned int error_code = 0;
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
@@ -418,17 +893,62 @@ ZoeResult SliceManager::finishDownloadProgress(bool need_check_completed, void*
 }
 
 int32_t SliceManager::getUnfetchAndUncompletedSliceNum() const {
-  int32_t num = 0;
-  for (auto& it : slices_) {
-    if (it && !it->isDataCompletedClearly() && it->status() == Slice::SliceStatus::UNFETCH)
-      num++;
+  // Completed slices never stay in UNFETCH status.
+  return (int32_t)queues_[(int)Slice::SliceStatus::UNFETCH].size();
+}
+
+bool SliceManager::syncSlices(bool to_disk) {
+  if (!target_file_)
+    return false;
+
+  // Data written after the snapshot may not be synced.
+  std::vector<int64_t> capacities(slices_.size());
+  std::vector<utf8string> checksums(slices_.size());
+  for (size_t i = 0; i < slices_.size(); i++)
+    slices_[i]->diskState(&capacities[i], &checksums[i]);
+  const int64_t written = target_file_->writtenBytes();
+
+  if (!target_file_->sync(to_disk))
+    return false;
+
+  for (size_t i = 0; i < slices_.size(); i++)
+    slices_[i]->setDurableCapacity(capacities[i], checksums[i]);
+
+  if (to_disk) {
+    synced_bytes_ = written;
+    sync_time_meter_.Restart();
   }
-  return num;
+  return true;
+}
+
+bool SliceManager::needSync() const {
+  if (options_->durability_policy != DurabilityPolicy::Periodic || !target_file_ || isStream())
+    return false;
+
+  if (options_->durability_sync_interval_ms > 0 &&
+      sync_time_meter_.Elapsed() >= options_->durability_sync_interval_ms)
+    return true;
+
+  if (options_->durability_sync_bytes > 0 &&
+      target_file_->writtenBytes() - synced_bytes_ >= options_->durability_sync_bytes)
+    return true;
+
+  return false;
 }
 
 bool SliceManager::flushIndexFile() {
+  // A stream can not be resumed.
+  if (isStream())
+    return true;
+
   if (index_file_path_.length() == 0)
     return false;
+
+  // Periodic policy records the capacities of the last sync.
+  if (options_->durability_policy != DurabilityPolicy::Periodic) {
+    if (!syncSlices(options_->durability_policy == DurabilityPolicy::Checkpoint))
+      OutputVerbose(options_->verbose_functor, "Sync temporary file failed.\n");
+  }
   FILE* f = FileUtil::Open(index_file_path_, "wb");
   if (!f)
     return false;
@@ -443,10 +963,12 @@ bool SliceManager::flushIndexFile() {
 
   json s;
   for (auto& slice : slices_) {
+    // CRC32 of the capacity, empty if unknown.
     s.push_back({{"index", slice->index()},
                  {"begin", slice->begin()},
                  {"end", slice->end()},
-                 {"capacity", slice->capacity()}});
+                 {"capacity", slice->durableCapacity()},
+                 {"checksum", slice->durableChecksum()}});
   }
   j["slices"] = s;
 
@@ -485,7 +1007,10 @@ void SliceManager::dumpSlice() const {
 }
 
 void SliceManager::cleanup() {
-  slices_.clear();
+  // The slices are notified by the queued writes.
+  disk_write_queue_.reset();
+  hedges_.clear();
+  clearSlices();
   target_file_.reset();
 }
 
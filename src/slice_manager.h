@@ -20,10 +20,15 @@
 #pragma once
 
 #include <vector>
+#include <map>
+#include <set>
+#include <deque>
 #include <atomic>
 #include "zoe/zoe.h"
 #include "target_file.h"
 #include "slice.h"
+#include "time_meter.hpp"
+#include "intrusive_list.hpp"
 
 namespace zoe {
 typedef struct _Options Options;
@@ -36,9 +41,21 @@ class SliceManager : public std::enable_shared_from_this<SliceManager> {
   ZoeResult loadExistSlice(int64_t cur_file_size,
                         const utf8string& cur_content_md5);
 
+  // Check the slices loaded by loadExistSlice against their checksums, see resetCorruptedSlices.
+  // Reads the loaded data, do not call it on the event loop. Return the number of the reset slices.
+  int32_t validateExistSlices();
+
   bool flushAllSlices();
+
+  // Write the index file, slices are recorded with their durable capacity.
   bool flushIndexFile();
 
+  // Sync the temporary file, then the capacity of each slice before the sync becomes durable.
+  bool syncSlices(bool to_disk);
+
+  // Whether the sync interval or bytes of DurabilityPolicy::Periodic has been reached.
+  bool needSync() const;
+
   void setOriginFileSize(int64_t file_size);
   int64_t originFileSize() const;
 
@@ -47,10 +64,20 @@ class SliceManager : public std::enable_shared_from_this<SliceManager> {
 
   std::shared_ptr<TargetFile> targetFile() const;
 
+  // nullptr if the data is written in the write callbacks.
+  DiskWriteQueue* diskWriteQueue() const;
+
   ZoeResult makeSlices(bool accept_ranges);
 
+  // Sum of the data of all slices, scans every slice.
   int64_t totalDownloaded() const;
 
+  // Same as totalDownloaded() but kept up to date by the byte deltas of slices, O(1).
+  int64_t downloadedBytes() const;
+
+  // Called by Slice when the bytes in its disk file and cache changed.
+  void onSliceReceived(int64_t delta);
+
   bool needVerifyHash() const;
 
   ZoeResult checkAllSliceCompletedByFileSize() const;
@@ -61,9 +88,58 @@ class SliceManager : public std::enable_shared_from_this<SliceManager> {
 
   int32_t getUnfetchAndUncompletedSliceNum() const;
 
-  std::shared_ptr<Slice> getSlice(Slice::SliceStatus status);
+  // Lookups by status are O(1).
+  std::shared_ptr<Slice> getSlice(Slice::SliceStatus status) const;
+  bool hasSlice(Slice::SliceStatus status) const;
+
+  // Get a failed slice that has been tried less than Options::slice_max_failed_times.
+  std::shared_ptr<Slice> getRetryableFailedSlice() const;
+
+  // The data is delivered by Zoe::startStream, there is no temporary file or index file.
+  bool isStream() const;
+
+  // The UNFETCH or retryable failed slice that has the lowest begin, streams fetch in order.
+  std::shared_ptr<Slice> getFirstPendingSlice() const;
+
+  // The first uncompleted slice of a stream is waiting for a connection while the connections
+  // are held by the slices paused beyond the reorder window. Stop the transfer of the last of the
+  // paused slices and return it, the caller puts it back as UNFETCH once its writes are done.
+  std::shared_ptr<Slice> parkBlockedSlice(void* multi);
+
+  // The first uncompleted slice of a stream has failed too many times, no more data can be
+  // delivered.
+  bool streamStalled() const;
 
-  std::shared_ptr<Slice> getSlice(void* curlHandle);
+  // The StreamFunctor returned false.
+  bool streamCanceled() const;
+
+  // Called by Slice when its status or failed times changed, move it to the matched queue.
+  void onSliceChanged(Slice* slice);
+
+  // Split the downloading slice that has the largest remaining range, the back half of the range
+  // becomes a new UNFETCH slice. Each half keeps at least |min_split_size| bytes.
+  std::shared_ptr<Slice> splitSlice(int64_t min_split_size);
+
+  void updateSliceRates();
+
+  // Make a hedge slice for the remaining range of the downloading slice whose rate is lower
+  // than |rate_percent| percent of the median rate of all slices, including the finished ones.
+  // Each slice is hedged once at most.
+  std::shared_ptr<Slice> makeHedgeSlice(int32_t rate_percent);
+
+  std::shared_ptr<Slice> hedgeOf(const Slice* primary) const;
+  std::shared_ptr<Slice> primaryOf(const Slice* hedge) const;
+  void removeHedge(const Slice* primary);
+
+  void detachAllSlices(void* multi);
+
+  void pauseAllSlices(bool paused);
+
+  // Resume the slices paused by a full write queue or by the reorder window of a stream, return
+  // true if any slice is still paused.
+  bool resumeWritePausedSlices();
+
+  void setSlicesMaxSpeed(int64_t max_speed);
 
   const Options* options() const;
 
@@ -73,8 +149,35 @@ class SliceManager : public std::enable_shared_from_this<SliceManager> {
 
   void cleanup();
  protected:
+  enum {
+    // Failed slices that have been tried Options::slice_max_failed_times times.
+    EXHAUSTED_QUEUE = (int)Slice::SliceStatus::CURL_OK_BUT_COMPLETED_NOT_SURE + 1,
+    QUEUE_NUM
+  };
+
   utf8string makeIndexFilePath() const;
+  // Split [0, origin_file_size_) by Options::slice_policy.
+  ZoeResult makeSliceRanges(bool accept_ranges);
+  Slice* firstUncompletedSlice() const;
+  // See TargetFile::enablePrefixHash.
+  void enablePrefixHash();
+
+  // Read back the data of each slice and compare it with the checksum of the slice, the slices
+  // that do not match are reset to be downloaded again. So are the slices without a checksum if
+  // |reset_unknown| is true. Return the number of the reset slices.
+  int32_t resetCorruptedSlices(bool reset_unknown);
+  bool canResumeWrite(const Slice* slice) const;
   void dumpSlice() const;
+
+  void addSlice(std::shared_ptr<Slice> slice);
+  void clearSlices();
+  int32_t queueIndexOf(const Slice* slice) const;
+  // Keep |slice| in the ordered sets that match queue |queue_index|.
+  void updateOrderedSlices(Slice* slice, int32_t queue_index);
+
+  struct SliceBeginLess {
+    bool operator()(const Slice* a, const Slice* b) const { return a->begin() < b->begin(); }
+  };
  protected:
   utf8string redirect_url_;
   int64_t origin_file_size_;
@@ -83,7 +186,19 @@ class SliceManager : public std::enable_shared_from_this<SliceManager> {
   utf8string index_file_path_;
 
   std::vector<std::shared_ptr<Slice>> slices_;
+  IntrusiveList<Slice> queues_[QUEUE_NUM];  // must be destroyed before slices_
+  // Ordered by begin, streams look for the first of them on every tick. The begin of a slice
+  // never changes, only its end is truncated by splitting.
+  std::set<Slice*, SliceBeginLess> uncompleted_slices_;
+  std::set<Slice*, SliceBeginLess> pending_slices_;  // UNFETCH and retryable DOWNLOAD_FAILED
+  int32_t max_index_;
+  std::map<const Slice*, std::shared_ptr<Slice>> hedges_;  // primary -> hedge
+  std::deque<int64_t> finished_rates_;  // rates of the recently finished transfers
+  std::atomic<int64_t> downloaded_bytes_;
+  int64_t synced_bytes_;  // TargetFile::writtenBytes() at the last sync
+  TimeMeter sync_time_meter_;
   std::shared_ptr<TargetFile> target_file_;
+  std::unique_ptr<DiskWriteQueue> disk_write_queue_;
 
   Options* options_;
 };
@@ -16,7 +16,6 @@
 ******************************************************************************/
 
 #include "speed_handler.h"
-#include <functional>
 #include "options.h"
 
 namespace zoe {
@@ -24,36 +23,30 @@ SpeedHandler::SpeedHandler(int64_t already_download,
                            Options* options,
                            std::shared_ptr<SliceManager> slice_manager)
     : already_download_(already_download)
-    , last_download_(0L)
+    , last_download_(already_download)
+    , speed_(-1L)
     , options_(options)
-    , slice_manager_(slice_manager) {
-  if (options_ && slice_manager_) {
-    async_task_ = std::async(std::launch::async,
-                             std::bind(&SpeedHandler::asyncTaskProcess, this));
-  }
-}
+    , slice_manager_(slice_manager) {}
 
-SpeedHandler::~SpeedHandler() {
-  if (async_task_.valid())
-    async_task_.get();
-}
+SpeedHandler::~SpeedHandler() {}
+
+void SpeedHandler::onTick() {
+  const long elapsed = time_meter_.Elapsed();
+  if (!options_ || elapsed < options_->speed_interval_ms)
+    return;
+  time_meter_.Restart();
 
-void SpeedHandler::asyncTaskProcess() {
-  last_download_ = already_download_;
-  while (true) {
-    if (options_->internal_stop_event.wait(1000))
-      break;
-    if (options_->user_stop_event && options_->user_stop_event->isSetted())
-      break;
-    if (options_ && slice_manager_) {
-      const int64_t now = slice_manager_->totalDownloaded();
+  if (options_->speed_functor && slice_manager_) {
+    const int64_t now = slice_manager_->downloadedBytes();
 
-      if (now >= last_download_) {
-        const int64_t downloaded = now - last_download_;
-        last_download_ = now;
-        options_->speed_functor(downloaded);
-      }
+    if (now >= last_download_) {
+      // The loop may tick a little later than the interval, report bytes per second.
+      const int64_t sample = (now - last_download_) * 1000 / elapsed;
+      const int64_t weight = options_->speed_smoothing_percent;
+      speed_ = (speed_ < 0 ? sample : (sample * weight + speed_ * (100 - weight)) / 100);
+      options_->speed_functor(speed_);
     }
+    last_download_ = now;
   }
 }
 
@@ -21,10 +21,13 @@
 
 #include "zoe/zoe.h"
 #include "slice_manager.h"
+#include "time_meter.hpp"
 
 namespace zoe {
 typedef struct _Options Options;
 
+// Report realtime download speed, driven by the event loop and the byte deltas of slices.
+// Speed samples are smoothed by exponentially weighted moving average.
 class SpeedHandler {
  public:
   SpeedHandler(int64_t already_download,
@@ -32,13 +35,13 @@ class SpeedHandler {
                std::shared_ptr<SliceManager> slice_manager);
   virtual ~SpeedHandler();
 
- protected:
-  void asyncTaskProcess();
+  void onTick();
 
  protected:
-  std::shared_future<void> async_task_;
+  TimeMeter time_meter_;
   const int64_t already_download_;
   int64_t last_download_;
+  int64_t speed_;  // smoothed, -1 before the first sample
   const Options* options_;
   std::shared_ptr<SliceManager> slice_manager_;
 };
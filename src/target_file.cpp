@@ -18,65 +18,118 @@
 #include "target_file.h"
 #include "file_util.h"
 #include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <iterator>
 #include "options.h"
 #include "md5.h"
 #include "crc32.h"
+#include "hash_reader.h"
 #include "sha256.h"
+#include "hasher.h"
 #include "filesystem.hpp"
 
+// Blocks read together for hash verifying.
+#define HASH_READ_BLOCK_SIZE 1048576  // 1MB
+#define HASH_READ_QUEUE_DEPTH 8
+
 namespace zoe {
+namespace {
+// Feeds the same data to two hashers, |second| may be nullptr.
+class TeeHasher : public Hasher {
+ public:
+  TeeHasher(Hasher* first, Hasher* second) : first_(first), second_(second) {}
+
+  virtual void update(const void* data, size_t size) {
+    first_->update(data, size);
+    if (second_)
+      second_->update(data, size);
+  }
 
-TargetFile::TargetFile(const utf8string& file_path)
-    : file_path_(file_path), f_(nullptr), fixed_size_(0L), file_seek_pos_(0L) {}
+  virtual utf8string final() { return first_->final(); }
+
+ protected:
+  Hasher* first_;
+  Hasher* second_;
+};
+}  // namespace
+
+TargetFile::TargetFile(const utf8string& file_path, FileIoEngine io_engine)
+    : file_path_(file_path)
+    , fixed_size_(0L)
+    , io_engine_(io_engine)
+    , stream_(nullptr)
+    , prefix_hash_type_(HashType::MD5)
+    , hashed_bytes_(0L)
+    , hash_busy_(false) {
+  written_bytes_.store(0L);
+  hash_quit_.store(false);
+}
 
 TargetFile::~TargetFile() {
   close();
 }
 
-bool TargetFile::createNew(int64_t fixed_size) {
+bool TargetFile::openBackend() {
+  backend_.reset(FileBackend::Create(io_engine_));
+  if (backend_->open(file_path_))
+    return true;
+
+  // Fall back to stdio, which is available on all platforms.
+  backend_.reset(new StdioFileBackend());
+  if (backend_->open(file_path_))
+    return true;
+
+  backend_.reset();
+  return false;
+}
+
+bool TargetFile::createNew(int64_t fixed_size, PreallocatePolicy policy, bool* no_space) {
   std::lock_guard<std::recursive_mutex> lg(file_mutex_);
-  assert(f_ == nullptr);
-  if (f_)
+  assert(!isOpened());
+  if (isOpened())
     return false;
 
   if (fixed_size < 0)
     fixed_size = 0;
 
-  if (!FileUtil::CreateFixedSizeFile(file_path_, fixed_size))
-    return false;
-  f_ = FileUtil::Open(file_path_, "rb+");
-  if (!f_)
+  if (!FileUtil::CreateFixedSizeFile(file_path_, fixed_size, policy, no_space))
     return false;
 
-  if (f_) {
-    file_seek_pos_ = 0L;
-    FileUtil::Seek(f_, 0L, SEEK_SET);
-  }
-
-  return (f_ != nullptr);
+  return openBackend();
 }
 
 bool TargetFile::open() {
   std::lock_guard<std::recursive_mutex> lg(file_mutex_);
-  assert(f_ == nullptr);
-  if (f_)
+  assert(!isOpened());
+  if (isOpened())
     return false;
 
-  f_ = FileUtil::Open(file_path_, "rb+");
-  if (f_) {
-    file_seek_pos_ = 0L;
-    FileUtil::Seek(f_, 0L, SEEK_SET);
-  }
-  return (f_ != nullptr);
+  return openBackend();
+}
+
+bool TargetFile::openStream(StreamFunctor functor,
+                            int64_t window_size,
+                            std::unique_ptr<Hasher> hasher,
+                            HashType hash_type) {
+  std::lock_guard<std::recursive_mutex> lg(file_mutex_);
+  assert(!isOpened());
+  if (isOpened())
+    return false;
+
+  stream_ = new StreamFileBackend(functor, window_size, std::move(hasher), hash_type);
+  backend_.reset(stream_);
+  return backend_->open(file_path_);
 }
 
 void TargetFile::close() {
   std::lock_guard<std::recursive_mutex> lg(file_mutex_);
-  if (f_) {
-    fflush(f_);
-    FileUtil::Close(f_);
-    f_ = nullptr;
+  stopHashThread();
+  if (backend_) {
+    backend_->close();
+    backend_.reset();
   }
+  stream_ = nullptr;
 }
 
 bool TargetFile::renameTo(Options* opt,
@@ -91,84 +144,425 @@ bool TargetFile::renameTo(Options* opt,
 
   bool ret = FileUtil::Rename(file_path_, new_file_path);
 
-  if (reopen && open()) {
-    FileUtil::Seek(f_, file_seek_pos_, SEEK_SET);
-  }
+  if (reopen)
+    open();
 
   return ret;
 }
 
 ZoeResult TargetFile::calculateFileHash(Options* opt, utf8string& str_hash) {
+  return calculateHash(opt->hash_type, opt, str_hash);
+}
+
+ZoeResult TargetFile::calculateFileMd5(Options* opt, utf8string& str_hash) {
+  return calculateHash(HashType::MD5, opt, str_hash);
+}
+
+ZoeResult TargetFile::calculateRangeHash(HashType type, int64_t pos, int64_t end, Options* opt, utf8string& str_hash) {
   std::lock_guard<std::recursive_mutex> lg(file_mutex_);
+  std::unique_ptr<Hasher> hasher(Hasher::Create(type));
+  if (!hasher || !isOpened() || stream_)
+    return ZoeResult::CALCULATE_HASH_FAILED;
 
-  ZoeResult ret = ZoeResult::CALCULATE_HASH_FAILED;
-  if (opt->hash_type == HashType::MD5) {
-    ret = f_ ? CalculateFileMd5(f_, opt, str_hash)
-             : CalculateFileMd5(file_path_, opt, str_hash);
-  }
-  else if (opt->hash_type == HashType::CRC32) {
-    ret = f_ ? CalculateFileCRC32(f_, opt, str_hash)
-             : CalculateFileCRC32(file_path_, opt, str_hash);
-  }
-  else if (opt->hash_type == HashType::SHA256) {
-    ret = f_ ? CalculateFileSHA256(f_, opt, str_hash)
-             : CalculateFileSHA256(file_path_, opt, str_hash);
-  }
+  const ZoeResult ret = hashRange(hasher.get(), pos, end, opt);
+  if (ret == ZoeResult::SUCCESSED)
+    str_hash = hasher->final();
   return ret;
 }
 
-ZoeResult TargetFile::calculateFileMd5(Options* opt, utf8string& str_hash) {
+ZoeResult TargetFile::checkWrittenRange(HashType type, int64_t pos, int64_t end, const utf8string& expected, Options* opt) {
   std::lock_guard<std::recursive_mutex> lg(file_mutex_);
-  ZoeResult ret = ZoeResult::CALCULATE_HASH_FAILED;
+  std::unique_ptr<Hasher> hasher(Hasher::Create(type));
+  if (!hasher || !isOpened() || stream_)
+    return ZoeResult::CALCULATE_HASH_FAILED;
+
+  // Claim the range as hashThreadProc does if it continues the prefix.
+  Hasher* prefix_hasher = nullptr;
+  {
+    std::unique_lock<std::mutex> hash_ul(hash_mutex_);
+    hash_cond_.wait(hash_ul, [this]() { return !hash_busy_; });
+    if (prefix_hasher_ && pos == hashed_bytes_ && pos < end) {
+      prefix_hasher = prefix_hasher_.get();
+      hashed_bytes_ = end;
+      hash_busy_ = true;
+    }
+  }
 
-  ret = f_ ? CalculateFileMd5(f_, opt, str_hash)
-           : CalculateFileMd5(file_path_, opt, str_hash);
+  TeeHasher tee(hasher.get(), prefix_hasher);
+  ZoeResult ret = hashRange(&tee, pos, end, opt);
+  if (ret == ZoeResult::SUCCESSED && hasher->final() != expected)
+    ret = ZoeResult::HASH_VERIFY_NOT_PASS;
 
+  {
+    std::lock_guard<std::mutex> hash_lg(hash_mutex_);
+    if (prefix_hasher) {
+      hash_busy_ = false;
+      if (dropped_hasher_.get() == prefix_hasher) {
+        dropped_hasher_.reset();
+      }
+      else if (ret != ZoeResult::SUCCESSED) {
+        // Fed partly, or with the data to be downloaded again.
+        prefix_hasher_.reset();
+        unhashed_ranges_.clear();
+      }
+    }
+    else if (ret == ZoeResult::SUCCESSED && prefix_hasher_) {
+      markWrittenLocked(pos, end - pos);
+    }
+
+    if (readBackReady())
+      notifyHashThread();
+  }
+  hash_cond_.notify_all();
   return ret;
 }
 
-int64_t TargetFile::fileSize() {
+ZoeResult TargetFile::calculateHash(HashType type, Options* opt, utf8string& str_hash) {
   std::lock_guard<std::recursive_mutex> lg(file_mutex_);
-  int64_t ret = 0L;
-  if (isOpened()) {
-    ret = FileUtil::GetFileSize(f_);
-    FileUtil::Seek(f_, file_seek_pos_, SEEK_SET);
+  // The delivered data can not be read back, it has been hashed on delivering.
+  if (stream_)
+    return (stream_->hash(type, str_hash) ? ZoeResult::SUCCESSED : ZoeResult::CALCULATE_HASH_FAILED);
+
+  if (!isOpened()) {
+    if (type == HashType::MD5)
+      return CalculateFileMd5(file_path_, opt, str_hash);
+    if (type == HashType::CRC32)
+      return CalculateFileCRC32(file_path_, opt, str_hash);
+    if (type == HashType::SHA256)
+      return CalculateFileSHA256(file_path_, opt, str_hash);
+    return ZoeResult::CALCULATE_HASH_FAILED;
   }
-  else {
-    ret = FileUtil::GetFileSize(file_path_);
+
+  const int64_t file_size = backend_->fileSize();
+  if (file_size < 0)
+    return ZoeResult::CALCULATE_HASH_FAILED;
+
+  // Only the rest of the prefix hashed while downloading is read.
+  {
+    std::unique_lock<std::mutex> hash_ul(hash_mutex_);
+    hash_cond_.wait(hash_ul, [this]() { return !hash_busy_; });
+    if (!prefix_hash_.empty() && type == prefix_hash_type_) {
+      str_hash = prefix_hash_;
+      return ZoeResult::SUCCESSED;
+    }
+
+    if (prefix_hasher_ && type == prefix_hash_type_ && hashed_bytes_ <= file_size) {
+      const ZoeResult ret = hashRange(prefix_hasher_.get(), hashed_bytes_, file_size, opt);
+      if (ret != ZoeResult::SUCCESSED) {
+        prefix_hasher_.reset();  // fed partly
+        return ret;
+      }
+
+      hashed_bytes_ = file_size;
+      unhashed_ranges_.clear();
+      prefix_hash_ = prefix_hasher_->final();
+      prefix_hasher_.reset();
+      str_hash = prefix_hash_;
+      return ZoeResult::SUCCESSED;
+    }
   }
+
+  std::unique_ptr<Hasher> hasher(Hasher::Create(type));
+  if (!hasher)
+    return ZoeResult::CALCULATE_HASH_FAILED;
+
+  const ZoeResult ret = hashRange(hasher.get(), 0L, file_size, opt);
+  if (ret == ZoeResult::SUCCESSED)
+    str_hash = hasher->final();
   return ret;
 }
 
-int64_t TargetFile::write(int64_t pos, const void* data, int64_t data_size) {
-  std::lock_guard<std::recursive_mutex> lg(file_mutex_);
-  assert(f_);
-  int64_t written = 0L;
-  do {
-    if (!f_)
-      break;
-    if (!data || data_size == 0)
+ZoeResult TargetFile::hashRange(Hasher* hasher, int64_t pos, int64_t end, Options* opt) {
+  if (pos >= end)
+    return ZoeResult::SUCCESSED;
+
+  // Each block of the reader is read by one batch of requests, one request per sub-buffer.
+  // The buffers are aligned for the backends that read without copying, see ioAlignment().
+  const int64_t depth = std::min((int64_t)HASH_READ_QUEUE_DEPTH, (end - pos + HASH_READ_BLOCK_SIZE - 1) / HASH_READ_BLOCK_SIZE);
+  HashReader reader(HASH_READ_BLOCK_SIZE * depth, backend_->ioAlignment(), end - pos);
+  std::vector<void*> buffers;
+  for (int32_t i = 0; i < reader.bufferCount(); i++) {
+    for (int64_t j = 0; j < depth; j++)
+      buffers.push_back((char*)reader.buffer(i) + j * HASH_READ_BLOCK_SIZE);
+  }
+  const bool registered = backend_->registerBuffers(buffers.data(), HASH_READ_BLOCK_SIZE, (int32_t)buffers.size());
+  backend_->adviseSequentialRead(pos, end - pos);
+
+  const ZoeResult ret = reader.run(
+      [this, &buffers, depth, registered](int64_t block_pos, int64_t block_size, int32_t index) {
+        FileIoRequest requests[HASH_READ_QUEUE_DEPTH];
+        int32_t count = 0;
+        for (int64_t offset = 0; offset < block_size; offset += HASH_READ_BLOCK_SIZE, count++) {
+          const int32_t buffer_index = (int32_t)(index * depth + count);
+          const int64_t size = std::min((int64_t)HASH_READ_BLOCK_SIZE, block_size - offset);
+          FileIoRequest request = {false, block_pos + offset, buffers[buffer_index], size, (registered ? buffer_index : -1), 0L};
+          requests[count] = request;
+        }
+
+        backend_->performBatch(requests, count);
+        for (int32_t i = 0; i < count; i++) {
+          if (requests[i].result != requests[i].size)
+            return false;
+        }
+        return true;
+      },
+      pos, end, hasher, opt);
+
+  if (registered)
+    backend_->unregisterBuffers();
+
+  return ret;
+}
+
+void TargetFile::enablePrefixHash(HashType type) {
+  std::unique_lock<std::mutex> ul(hash_mutex_);
+  hash_cond_.wait(ul, [this]() { return !hash_busy_; });
+  prefix_hasher_.reset(Hasher::Create(type));
+  prefix_hash_type_ = type;
+  hashed_bytes_ = 0L;
+  unhashed_ranges_.clear();
+  prefix_hash_.clear();
+}
+
+void TargetFile::markWritten(int64_t pos, int64_t data_size) {
+  if (data_size <= 0)
+    return;
+
+  std::lock_guard<std::mutex> lg(hash_mutex_);
+  if (!prefix_hasher_)
+    return;
+
+  markWrittenLocked(pos, data_size);
+  if (readBackReady())
+    notifyHashThread();
+}
+
+void TargetFile::markWrittenLocked(int64_t pos, int64_t data_size) {
+  if (pos + data_size <= hashed_bytes_)
+    return;
+
+  // Merged with the touching ranges.
+  int64_t begin = pos;
+  int64_t end = pos + data_size;
+  auto it = unhashed_ranges_.upper_bound(begin);
+  if (it != unhashed_ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second >= begin) {
+      begin = prev->first;
+      end = std::max(end, prev->second);
+      it = unhashed_ranges_.erase(prev);
+    }
+  }
+  while (it != unhashed_ranges_.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    it = unhashed_ranges_.erase(it);
+  }
+  unhashed_ranges_[begin] = end;
+}
+
+void TargetFile::discardWritten(int64_t pos, int64_t data_size) {
+  if (data_size <= 0)
+    return;
+
+  std::lock_guard<std::mutex> lg(hash_mutex_);
+  if ((prefix_hasher_ || !prefix_hash_.empty()) && pos < hashed_bytes_) {
+    // calculateFileHash reads the whole file then.
+    if (hash_busy_)
+      dropped_hasher_ = std::move(prefix_hasher_);
+    prefix_hasher_.reset();
+    unhashed_ranges_.clear();
+    prefix_hash_.clear();
+    return;
+  }
+
+  // Not hashed yet, just forget it. The ranges overlapping [pos, end) are trimmed.
+  const int64_t end = pos + data_size;
+  auto it = unhashed_ranges_.upper_bound(pos);
+  if (it != unhashed_ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second > pos) {
+      const int64_t prev_end = prev->second;
+      prev->second = pos;
+      if (prev->first == pos)
+        unhashed_ranges_.erase(prev);
+      if (prev_end > end)
+        unhashed_ranges_[end] = prev_end;
+    }
+  }
+  while (it != unhashed_ranges_.end() && it->first < end) {
+    const int64_t range_end = it->second;
+    it = unhashed_ranges_.erase(it);
+    if (range_end > end) {
+      unhashed_ranges_[end] = range_end;
       break;
-    if (pos < 0)
+    }
+  }
+}
+
+int64_t TargetFile::hashedBytes() {
+  std::lock_guard<std::mutex> lg(hash_mutex_);
+  return (prefix_hasher_ || !prefix_hash_.empty() ? hashed_bytes_ : 0L);
+}
+
+void TargetFile::onWritten(int64_t pos, const void* data, int64_t data_size) {
+  if (data_size <= 0)
+    return;
+
+  std::lock_guard<std::mutex> lg(hash_mutex_);
+  if (!prefix_hasher_)
+    return;
+
+  // Hashed before the buffer is released. While a range is being read back, the following
+  // writes are read back later too.
+  if (!hash_busy_ && pos <= hashed_bytes_ && pos + data_size > hashed_bytes_) {
+    const int64_t skip = hashed_bytes_ - pos;
+    prefix_hasher_->update((const char*)data + skip, (size_t)(data_size - skip));
+    hashed_bytes_ = pos + data_size;
+  }
+  else {
+    markWrittenLocked(pos, data_size);
+  }
+
+  if (readBackReady())
+    notifyHashThread();
+}
+
+bool TargetFile::readBackReady() const {
+  return (prefix_hasher_ && !hash_busy_ && !unhashed_ranges_.empty() &&
+          unhashed_ranges_.begin()->first <= hashed_bytes_);
+}
+
+void TargetFile::notifyHashThread() {
+  if (!hash_thread_.joinable()) {
+    hash_quit_.store(false);
+    hash_thread_ = std::thread(&TargetFile::hashThreadProc, this);
+    return;
+  }
+  hash_cond_.notify_all();
+}
+
+void TargetFile::hashThreadProc() {
+  std::unique_ptr<char[]> memory;
+  char* buffer = nullptr;
+
+  std::unique_lock<std::mutex> ul(hash_mutex_);
+  while (true) {
+    hash_cond_.wait(ul, [this]() { return hash_quit_.load() || readBackReady(); });
+    if (hash_quit_.load())
       break;
 
-    if (file_seek_pos_ != pos) {
-      if (FileUtil::Seek(f_, pos, SEEK_SET) != 0) {
-        assert(false);
-        break;
+    auto it = unhashed_ranges_.begin();
+    const int64_t end = it->second;
+    unhashed_ranges_.erase(it);
+    if (end <= hashed_bytes_)
+      continue;
+
+    // The range is claimed, the writes after it are recorded as ranges meanwhile.
+    int64_t pos = hashed_bytes_;
+    hashed_bytes_ = end;
+    hash_busy_ = true;
+    Hasher* hasher = prefix_hasher_.get();
+    std::shared_ptr<FileBackend> backend = backend_;
+    ul.unlock();
+
+    if (!buffer && backend) {
+      // Aligned for the backends that read without copying, see ioAlignment().
+      const int64_t alignment = std::max(backend->ioAlignment(), (int64_t)1);
+      memory.reset(new char[(size_t)(HASH_READ_BLOCK_SIZE + alignment)]);
+      buffer = memory.get() + (alignment - (uintptr_t)memory.get() % alignment) % alignment;
+    }
+
+    // Written earlier, it is likely still in the page cache.
+    bool ok = (backend != nullptr);
+    while (ok && pos < end && !hash_quit_.load()) {
+      const int64_t size = std::min((int64_t)HASH_READ_BLOCK_SIZE, end - pos);
+      FileIoRequest request = {false, pos, buffer, size, -1, 0L};
+      backend->performBatch(&request, 1);
+      ok = (request.result == size);
+      if (ok) {
+        hasher->update(buffer, (size_t)size);
+        pos += size;
       }
-      file_seek_pos_ = pos;
     }
 
-    written = fwrite(data, 1, (long)data_size, f_);
-    assert(written == data_size);
-    fflush(f_);
-    file_seek_pos_ += written;
-  } while (false);
+    ul.lock();
+    hash_busy_ = false;
+    if (dropped_hasher_.get() == hasher) {
+      dropped_hasher_.reset();
+    }
+    else if (!ok) {
+      prefix_hasher_.reset();
+      unhashed_ranges_.clear();
+    }
+    else if (pos < end) {
+      // Stopped, the rest is read back if the thread is started again.
+      hashed_bytes_ = pos;
+      markWrittenLocked(pos, end - pos);
+    }
+    hash_cond_.notify_all();
+  }
+}
+
+void TargetFile::stopHashThread() {
+  {
+    std::lock_guard<std::mutex> lg(hash_mutex_);
+    if (!hash_thread_.joinable())
+      return;
+    hash_quit_.store(true);
+  }
+  hash_cond_.notify_all();
+  hash_thread_.join();
+}
+
+int64_t TargetFile::fileSize() {
+  std::lock_guard<std::recursive_mutex> lg(file_mutex_);
+  if (isOpened())
+    return backend_->fileSize();
+  return FileUtil::GetFileSize(file_path_);
+}
+
+int64_t TargetFile::write(int64_t pos, const void* data, int64_t data_size) {
+  assert(backend_);
+  if (!backend_)
+    return 0L;
 
+  const int64_t written = backend_->write(pos, data, data_size);
+  written_bytes_ += written;
+  onWritten(pos, data, written);
   return written;
 }
 
+int64_t TargetFile::performBatch(FileIoRequest* requests, int32_t count) {
+  assert(backend_);
+  if (!backend_)
+    return 0L;
+
+  backend_->performBatch(requests, count);
+
+  int64_t total = 0L;
+  int64_t written = 0L;
+  for (int32_t i = 0; i < count; i++) {
+    total += requests[i].result;
+    if (requests[i].write) {
+      written += requests[i].result;
+      onWritten(requests[i].pos, requests[i].data, requests[i].result);
+    }
+  }
+  written_bytes_ += written;
+  return total;
+}
+
+bool TargetFile::sync(bool to_disk) {
+  std::lock_guard<std::recursive_mutex> lg(file_mutex_);
+  if (!isOpened())
+    return false;
+  return backend_->sync(to_disk);
+}
+
+int64_t TargetFile::writtenBytes() const {
+  return written_bytes_.load();
+}
+
 utf8string TargetFile::filePath() const {
   return file_path_;
 }
@@ -178,7 +572,27 @@ int64_t TargetFile::fixedSize() const {
 }
 
 bool TargetFile::isOpened() const {
-  return f_ != nullptr;
+  return (backend_ && backend_->isOpened());
+}
+
+bool TargetFile::isMapped() const {
+  return (backend_ && backend_->isMapped());
+}
+
+int64_t TargetFile::ioAlignment() const {
+  return (backend_ ? backend_->ioAlignment() : 1L);
+}
+
+bool TargetFile::isStream() const {
+  return (stream_ != nullptr);
+}
+
+bool TargetFile::writable(int64_t pos, int64_t data_size) const {
+  return (backend_ ? backend_->writable(pos, data_size) : true);
+}
+
+bool TargetFile::streamCanceled() const {
+  return (stream_ && stream_->failed());
 }
 
 }  // namespace zoe
\ No newline at end of file
@@ -20,18 +20,33 @@
 #pragma once
 
 #include "zoe/zoe.h"
+#include <map>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include "file_backend.h"
 
 namespace zoe {
 typedef struct _Options Options;
 
 class TargetFile {
  public:
-  TargetFile(const utf8string& file_path);
+  TargetFile(const utf8string& file_path, FileIoEngine io_engine);
   virtual ~TargetFile();
 
-  bool createNew(int64_t fixed_size);
+  // See FileUtil::CreateFixedSizeFile.
+  bool createNew(int64_t fixed_size,
+                 PreallocatePolicy policy = PreallocatePolicy::Auto,
+                 bool* no_space = nullptr);
   bool open();
+
+  // Deliver the data to |functor| instead of a file, see StreamFileBackend.
+  bool openStream(StreamFunctor functor,
+                  int64_t window_size,
+                  std::unique_ptr<Hasher> hasher,
+                  HashType hash_type);
   void close();
   bool renameTo(Options* opt,
                 const utf8string& new_file_path,
@@ -39,21 +54,106 @@ class TargetFile {
   ZoeResult calculateFileHash(Options* opt, utf8string& str_hash);
   ZoeResult calculateFileMd5(Options* opt, utf8string& str_hash);
 
+  // Hash [pos, end) of the opened file.
+  ZoeResult calculateRangeHash(HashType type, int64_t pos, int64_t end, Options* opt, utf8string& str_hash);
+
+  // Check [pos, end), which is in the file already, against |expected| hash. A matched range is
+  // regarded as written, see markWritten. The range that continues the hashed prefix is hashed into
+  // it by the same read, the prefix hash is dropped if the range does not match.
+  // Return HASH_VERIFY_NOT_PASS if not match.
+  ZoeResult checkWrittenRange(HashType type, int64_t pos, int64_t end, const utf8string& expected, Options* opt);
+
   int64_t fileSize();
 
+  // Does not lock, slices write their own ranges in parallel.
   int64_t write(int64_t pos, const void* data, int64_t data_size);
 
+  // Does not lock either, see FileBackend::performBatch. Return the total bytes transferred.
+  int64_t performBatch(FileIoRequest* requests, int32_t count);
+
+  // See FileBackend::sync.
+  bool sync(bool to_disk);
+
+  // Total bytes written since the file was opened.
+  int64_t writtenBytes() const;
+
   utf8string filePath() const;
   int64_t fixedSize() const;
   bool isOpened() const;
 
+  // See FileBackend::isMapped.
+  bool isMapped() const;
+
+  // See FileBackend::ioAlignment, 1 if the file is not opened.
+  int64_t ioAlignment() const;
+
+  // Opened by openStream.
+  bool isStream() const;
+
+  // See FileBackend::writable. Does not lock.
+  bool writable(int64_t pos, int64_t data_size) const;
+
+  // The StreamFunctor returned false.
+  bool streamCanceled() const;
+
+  // Hash the written data while downloading. The data that continues the hashed prefix is hashed
+  // from the buffer being written, the data written ahead is read back by a background thread once
+  // the gap before it is filled, the writers never read. calculateFileHash then only reads the rest.
+  void enablePrefixHash(HashType type);
+
+  // [pos, pos + data_size) is in the file already, e.g. loaded from the index file.
+  void markWritten(int64_t pos, int64_t data_size);
+
+  // [pos, pos + data_size) will be written again, maybe different. The prefix hash is dropped if
+  // it covers |pos|, otherwise the range is no longer regarded as written.
+  void discardWritten(int64_t pos, int64_t data_size);
+
+  // Size of the hashed prefix.
+  int64_t hashedBytes();
+
+ protected:
+  bool openBackend();
+  ZoeResult calculateHash(HashType type, Options* opt, utf8string& str_hash);
+  // Feed |hasher| with [pos, end) of the file.
+  ZoeResult hashRange(Hasher* hasher, int64_t pos, int64_t end, Options* opt);
+
+  void onWritten(int64_t pos, const void* data, int64_t data_size);
+
+  // The following must hold hash_mutex_.
+  void markWrittenLocked(int64_t pos, int64_t data_size);
+  // A written range continues the prefix, and no range is being read back.
+  bool readBackReady() const;
+  // Wake up hash_thread_, it is started on the first read-back.
+  void notifyHashThread();
+
+  // Read back the written ranges that continue the prefix, see enablePrefixHash.
+  void hashThreadProc();
+  void stopHashThread();
+
  protected:
-  int64_t file_seek_pos_;
   int64_t fixed_size_;
+  FileIoEngine io_engine_;
 
   utf8string file_path_;
-  FILE* f_;
-  std::recursive_mutex file_mutex_;
+  std::shared_ptr<FileBackend> backend_;
+  StreamFileBackend* stream_;  // same as backend_ if opened by openStream
+  std::atomic<int64_t> written_bytes_;
+  std::recursive_mutex file_mutex_;  // open, close, rename and hash
+
+  std::unique_ptr<Hasher> prefix_hasher_;  // nullptr if not enabled or dropped
+  HashType prefix_hash_type_;
+  int64_t hashed_bytes_;
+  std::map<int64_t, int64_t> unhashed_ranges_;  // written after the prefix, begin -> end
+  utf8string prefix_hash_;
+  std::mutex hash_mutex_;
+
+  // hashed_bytes_ includes the range being read back by hash_thread_, which feeds prefix_hasher_
+  // without hash_mutex_ while hash_busy_ is true.
+  std::thread hash_thread_;
+  std::condition_variable hash_cond_;
+  bool hash_busy_;
+  std::atomic_bool hash_quit_;
+  std::unique_ptr<Hasher> dropped_hasher_;  // dropped while hash_thread_ is feeding it
 };
 }  // namespace zoe
 #endif
\ No newline at end of file
@@ -19,28 +19,30 @@
 #define ZOE_TIME_METER_H_
 #pragma once
 #include <stdint.h>
-#include <time.h>
-#include <ctime>
+#include <chrono>
 #include <limits>
 
 namespace zoe {
+// Wall clock meter based on steady clock, unaffected by system time changes.
 class TimeMeter {
  public:
-  TimeMeter() { lStartTime_ = std::clock(); }
+  TimeMeter() { lStartTime_ = std::chrono::steady_clock::now(); }
 
-  void Restart() { lStartTime_ = std::clock(); }
+  void Restart() { lStartTime_ = std::chrono::steady_clock::now(); }
 
   // ms
-  long Elapsed() const { return std::clock() - lStartTime_; }
-
-  long ElapsedMax() const {
-    return (std::numeric_limits<std::clock_t>::max)() - lStartTime_;
+  long Elapsed() const {
+    return (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - lStartTime_)
+        .count();
   }
 
+  long ElapsedMax() const { return (std::numeric_limits<long>::max)(); }
+
   long ElapsedMin() const { return 1L; }
 
  private:
-  std::clock_t lStartTime_;
+  std::chrono::steady_clock::time_point lStartTime_;
 };
 }  // namespace zoe
 
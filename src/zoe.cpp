@@ -17,11 +17,16 @@
 
 #include "zoe/zoe.h"
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
 #include "file_util.h"
 #include "curl_utils.h"
+#include "buffer_pool.h"
+#include "disk_writer.h"
 #include "slice_manager.h"
 #include "options.h"
 #include "entry_handler.h"
+#include "external_loop_impl.h"
 #include "string_helper.hpp"
 #include "string_encode.h"
 
@@ -60,7 +65,8 @@ const char* Zoe::GetResultString(ZoeResult enumVal) {
                                       "CALCULATE_HASH_FAILED",
                                       "FETCH_FILE_INFO_FAILED",
                                       "REDIRECT_URL_DIFFERENT",
-                                      "NOT_CLEARLY_RESULT"};
+                                      "NOT_CLEARLY_RESULT",
+                                      "INSUFFICIENT_DISK_SPACE"};
   return EnumStrings[(int)enumVal];
 }
 
@@ -101,6 +107,27 @@ void Zoe::GlobalInit() {
 
 void Zoe::GlobalUnInit() {
   GlobalCurlUnInit();
+  BufferPool::Global()->trim();
+}
+
+void Zoe::SetBufferPoolLimit(int64_t max_bytes) {
+  if (max_bytes <= 0)
+    max_bytes = ZOE_DEFAULT_BUFFER_POOL_LIMIT;
+  BufferPool::Global()->setLimit(max_bytes);
+}
+
+int64_t Zoe::BufferPoolLimit() {
+  return BufferPool::Global()->limit();
+}
+
+void Zoe::SetDiskWriterThreadNum(int32_t thread_num) {
+  if (thread_num <= 0)
+    thread_num = ZOE_DEFAULT_DISK_WRITER_POOL_THREAD_NUM;
+  DiskWriter::Global()->setThreadNum(thread_num);
+}
+
+int32_t Zoe::DiskWriterThreadNum() {
+  return DiskWriter::Global()->threadNum();
 }
 
 void Zoe::setVerboseOutput(VerboseOuputFunctor verbose_functor) noexcept {
@@ -125,6 +152,45 @@ int32_t Zoe::threadNum() const noexcept {
   return impl_->options_.thread_num;
 }
 
+ZoeResult Zoe::setAdaptiveThreadNum(bool enabled, int32_t min_num, int32_t max_num) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (min_num <= 0)
+    min_num = ZOE_DEFAULT_THREAD_NUM;
+  if (max_num > 100 || max_num < min_num)
+    return ZoeResult::INVALID_THREAD_NUM;
+  impl_->options_.adaptive_thread_num = enabled;
+  impl_->options_.min_thread_num = min_num;
+  impl_->options_.max_thread_num = max_num;
+  return ZoeResult::SUCCESSED;
+}
+
+bool Zoe::adaptiveThreadNumEnabled() const noexcept {
+  assert(impl_);
+  return impl_->options_.adaptive_thread_num;
+}
+
+int32_t Zoe::minThreadNum() const noexcept {
+  assert(impl_);
+  return impl_->options_.min_thread_num;
+}
+
+int32_t Zoe::maxThreadNum() const noexcept {
+  assert(impl_);
+  return impl_->options_.max_thread_num;
+}
+
+ConcurrencyStats Zoe::concurrencyStats() const noexcept {
+  assert(impl_);
+  if (impl_ && impl_->entry_handler_)
+    return impl_->entry_handler_->concurrencyStats();
+
+  ConcurrencyStats stats;
+  memset(&stats, 0, sizeof(stats));
+  return stats;
+}
+
 utf8string Zoe::url() const noexcept {
   assert(impl_);
   return impl_->options_.url;
@@ -245,7 +311,7 @@ int32_t Zoe::minDownloadSpeedDuration() const noexcept {
   return impl_->options_.min_speed_duration;
 }
 
-ZoeResult Zoe::setDiskCacheSize(int32_t cache_size) noexcept {
+ZoeResult Zoe::setDiskCacheSize(int64_t cache_size) noexcept {
   assert(impl_);
   if (impl_->isDownloading())
     return ZoeResult::ALREADY_DOWNLOADING;
@@ -255,11 +321,112 @@ ZoeResult Zoe::setDiskCacheSize(int32_t cache_size) noexcept {
   return ZoeResult::SUCCESSED;
 }
 
-int32_t Zoe::diskCacheSize() const noexcept {
+int64_t Zoe::diskCacheSize() const noexcept {
   assert(impl_);
   return impl_->options_.disk_cache_size;
 }
 
+ZoeResult Zoe::setDiskWriterPolicy(int32_t thread_num, int64_t queue_size) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (queue_size <= 0)
+    queue_size = ZOE_DEFAULT_DISK_WRITER_QUEUE_SIZE;
+  impl_->options_.disk_writer_thread_num = std::max(thread_num, 0);
+  impl_->options_.disk_writer_queue_size = queue_size;
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t Zoe::diskWriterThreadNum() const noexcept {
+  assert(impl_);
+  return impl_->options_.disk_writer_thread_num;
+}
+
+int64_t Zoe::diskWriterQueueSize() const noexcept {
+  assert(impl_);
+  return impl_->options_.disk_writer_queue_size;
+}
+
+ZoeResult Zoe::setFileIoEngine(FileIoEngine engine) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  impl_->options_.file_io_engine = engine;
+  return ZoeResult::SUCCESSED;
+}
+
+FileIoEngine Zoe::fileIoEngine() const noexcept {
+  assert(impl_);
+  return impl_->options_.file_io_engine;
+}
+
+ZoeResult Zoe::setPreallocatePolicy(PreallocatePolicy policy) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  impl_->options_.preallocate_policy = policy;
+  return ZoeResult::SUCCESSED;
+}
+
+PreallocatePolicy Zoe::preallocatePolicy() const noexcept {
+  assert(impl_);
+  return impl_->options_.preallocate_policy;
+}
+
+ZoeResult Zoe::setStreamWindowSize(int64_t window_size) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (window_size <= 0)
+    window_size = ZOE_DEFAULT_STREAM_WINDOW_SIZE;
+  impl_->options_.stream_window_size = window_size;
+  return ZoeResult::SUCCESSED;
+}
+
+int64_t Zoe::streamWindowSize() const noexcept {
+  assert(impl_);
+  return impl_->options_.stream_window_size;
+}
+
+ZoeResult Zoe::setEventEngine(EventEngine engine) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  impl_->options_.event_engine = engine;
+  return ZoeResult::SUCCESSED;
+}
+
+EventEngine Zoe::eventEngine() const noexcept {
+  assert(impl_);
+  return impl_->options_.event_engine;
+}
+
+ZoeResult Zoe::setScheduler(ZoeScheduler* scheduler) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  impl_->options_.scheduler = scheduler;
+  return ZoeResult::SUCCESSED;
+}
+
+ZoeScheduler* Zoe::scheduler() const noexcept {
+  assert(impl_);
+  return impl_->options_.scheduler;
+}
+
+ZoeResult Zoe::setExternalLoop(ZoeExternalLoop* loop) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  impl_->options_.external_loop = loop;
+  return ZoeResult::SUCCESSED;
+}
+
+ZoeExternalLoop* Zoe::externalLoop() const noexcept {
+  assert(impl_);
+  return impl_->options_.external_loop;
+}
+
 ZoeResult Zoe::setStopEvent(ZoeEvent* stop_event) noexcept {
   assert(impl_);
   impl_->options_.user_stop_event = stop_event;
@@ -427,6 +594,113 @@ UncompletedSliceSavePolicy Zoe::uncompletedSliceSavePolicy() const noexcept {
   return impl_->options_.uncompleted_slice_save_policy;
 }
 
+ZoeResult Zoe::setHedgePolicy(bool enabled, int32_t rate_percent) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (rate_percent <= 0)
+    rate_percent = ZOE_DEFAULT_HEDGE_RATE_PERCENT;
+  impl_->options_.hedge_enabled = enabled;
+  impl_->options_.hedge_rate_percent = std::min(rate_percent, 100);
+  return ZoeResult::SUCCESSED;
+}
+
+bool Zoe::hedgeEnabled() const noexcept {
+  assert(impl_);
+  return impl_->options_.hedge_enabled;
+}
+
+int32_t Zoe::hedgeRatePercent() const noexcept {
+  assert(impl_);
+  return impl_->options_.hedge_rate_percent;
+}
+
+ZoeResult Zoe::setHttpVersionPolicy(HttpVersionPolicy policy) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  impl_->options_.http_version_policy = policy;
+  return ZoeResult::SUCCESSED;
+}
+
+HttpVersionPolicy Zoe::httpVersionPolicy() const noexcept {
+  assert(impl_);
+  return impl_->options_.http_version_policy;
+}
+
+ZoeResult Zoe::setProgressReportPolicy(int32_t interval_ms, int64_t min_delta_bytes) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (interval_ms <= 0)
+    interval_ms = ZOE_DEFAULT_PROGRESS_INTERVAL_MS;
+  impl_->options_.progress_interval_ms = interval_ms;
+  impl_->options_.progress_min_delta = std::max(min_delta_bytes, (int64_t)0);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t Zoe::progressReportInterval() const noexcept {
+  assert(impl_);
+  return impl_->options_.progress_interval_ms;
+}
+
+int64_t Zoe::progressReportMinDelta() const noexcept {
+  assert(impl_);
+  return impl_->options_.progress_min_delta;
+}
+
+ZoeResult Zoe::setSpeedReportPolicy(int32_t interval_ms, int32_t smoothing_percent) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (interval_ms <= 0)
+    interval_ms = ZOE_DEFAULT_SPEED_INTERVAL_MS;
+  if (smoothing_percent <= 0)
+    smoothing_percent = ZOE_DEFAULT_SPEED_SMOOTHING_PERCENT;
+  impl_->options_.speed_interval_ms = interval_ms;
+  impl_->options_.speed_smoothing_percent = std::min(smoothing_percent, 100);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t Zoe::speedReportInterval() const noexcept {
+  assert(impl_);
+  return impl_->options_.speed_interval_ms;
+}
+
+int32_t Zoe::speedSmoothingPercent() const noexcept {
+  assert(impl_);
+  return impl_->options_.speed_smoothing_percent;
+}
+
+ZoeResult Zoe::setDurabilityPolicy(DurabilityPolicy policy, int32_t interval_ms, int64_t bytes) noexcept {
+  assert(impl_);
+  if (impl_->isDownloading())
+    return ZoeResult::ALREADY_DOWNLOADING;
+  if (interval_ms <= 0 && bytes <= 0) {
+    interval_ms = ZOE_DEFAULT_DURABILITY_SYNC_INTERVAL_MS;
+    bytes = ZOE_DEFAULT_DURABILITY_SYNC_BYTES;
+  }
+  impl_->options_.durability_policy = policy;
+  impl_->options_.durability_sync_interval_ms = std::max(interval_ms, 0);
+  impl_->options_.durability_sync_bytes = std::max(bytes, (int64_t)0);
+  return ZoeResult::SUCCESSED;
+}
+
+DurabilityPolicy Zoe::durabilityPolicy() const noexcept {
+  assert(impl_);
+  return impl_->options_.durability_policy;
+}
+
+int32_t Zoe::durabilitySyncInterval() const noexcept {
+  assert(impl_);
+  return impl_->options_.durability_sync_interval_ms;
+}
+
+int64_t Zoe::durabilitySyncBytes() const noexcept {
+  assert(impl_);
+  return impl_->options_.durability_sync_bytes;
+}
+
 std::shared_future<ZoeResult> Zoe::start(
     const utf8string& url,
     const utf8string& target_file_path,
@@ -462,13 +736,66 @@ std::shared_future<ZoeResult> Zoe::start(
   impl_->options_.result_functor = result_functor;
   impl_->options_.progress_functor = progress_functor;
   impl_->options_.speed_functor = realtime_speed_functor;
+  impl_->options_.stream_functor = nullptr;
+
+  if (impl_->entry_handler_)
+    impl_->entry_handler_.reset();
+
+  impl_->entry_handler_ = std::make_shared<EntryHandler>();
+
+  JobScheduler* job_scheduler = nullptr;
+  if (impl_->options_.external_loop)
+    job_scheduler = impl_->options_.external_loop->impl_;
+  else if (impl_->options_.scheduler)
+    job_scheduler = impl_->options_.scheduler->impl_;
+  return impl_->entry_handler_->start(&impl_->options_, job_scheduler);
+}
+
+std::shared_future<ZoeResult> Zoe::startStream(
+    const utf8string& url,
+    StreamFunctor stream_functor,
+    ResultFunctor result_functor,
+    ProgressFunctor progress_functor,
+    RealtimeSpeedFunctor realtime_speed_functor) noexcept {
+  assert(impl_);
+  ZoeResult ret = ZoeResult::SUCCESSED;
+
+  if (impl_->isDownloading()) {
+    ret = ZoeResult::ALREADY_DOWNLOADING;
+  }
+  else if (url.length() == 0) {
+    ret = ZoeResult::INVALID_URL;
+  }
+  else if (!stream_functor) {
+    ret = ZoeResult::INVALID_TARGET_FILE_PATH;
+  }
+
+  if (ret != ZoeResult::SUCCESSED) {
+    return std::async(std::launch::async, [result_functor, ret]() {
+      if (result_functor)
+        result_functor(ret);
+      return ret;
+    });
+  }
+
+  impl_->options_.url = StringHelper::Trim(url);
+  impl_->options_.target_file_path.clear();
+  impl_->options_.result_functor = result_functor;
+  impl_->options_.progress_functor = progress_functor;
+  impl_->options_.speed_functor = realtime_speed_functor;
+  impl_->options_.stream_functor = stream_functor;
 
   if (impl_->entry_handler_)
     impl_->entry_handler_.reset();
 
   impl_->entry_handler_ = std::make_shared<EntryHandler>();
 
-  return impl_->entry_handler_->start(&impl_->options_);
+  JobScheduler* job_scheduler = nullptr;
+  if (impl_->options_.external_loop)
+    job_scheduler = impl_->options_.external_loop->impl_;
+  else if (impl_->options_.scheduler)
+    job_scheduler = impl_->options_.scheduler->impl_;
+  return impl_->entry_handler_->start(&impl_->options_, job_scheduler);
 }
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
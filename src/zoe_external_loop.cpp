@@ -0,0 +1,187 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "zoe/zoe.h"
+#include <assert.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "external_loop_impl.h"
+
+namespace zoe {
+ZoeExternalLoop::ExternalLoopImpl::ExternalLoopImpl(ZoeExternalLoop::SocketFunctor socket_functor,
+                                                    ZoeExternalLoop::TimerFunctor timer_functor)
+    : EventLoop(EventEngine::External)
+    , socket_functor_(socket_functor)
+    , timer_functor_(timer_functor)
+    , canceled_(false) {}
+
+ZoeExternalLoop::ExternalLoopImpl::~ExternalLoopImpl() {
+  shutdown();
+
+  // libcurl calls the socket callback during curl_multi_cleanup, it must be done while the
+  // functors are still alive.
+  if (multi_) {
+    curl_multi_cleanup(multi_);
+    multi_ = nullptr;
+  }
+}
+
+EventDriver* ZoeExternalLoop::ExternalLoopImpl::createDriver() {
+  return new ExternalEventDriver([this](curl_socket_t s, int what) { onSocketWatch(s, what); });
+}
+
+void ZoeExternalLoop::ExternalLoopImpl::onSocketWatch(curl_socket_t s, int what) {
+  if (!socket_functor_)
+    return;
+
+  int32_t events = ZoeExternalLoop::SOCKET_EVENT_NONE;
+  if (what != CURL_POLL_REMOVE) {
+    if (what & CURL_POLL_IN)
+      events |= ZoeExternalLoop::SOCKET_EVENT_READ;
+    if (what & CURL_POLL_OUT)
+      events |= ZoeExternalLoop::SOCKET_EVENT_WRITE;
+  }
+
+  socket_functor_((int64_t)s, events);
+}
+
+void ZoeExternalLoop::ExternalLoopImpl::scheduleTimer(int32_t wait_ms) {
+  if (!timer_functor_)
+    return;
+
+  int32_t timeout = wait_ms;
+  const int remain = static_cast<ExternalEventDriver*>(event_driver_.get())->remainTimeout();
+  if (remain >= 0)
+    timeout = (timeout < 0 ? remain : std::min(timeout, (int32_t)remain));
+
+  timer_functor_(timeout);
+}
+
+void ZoeExternalLoop::ExternalLoopImpl::step(curl_socket_t s, int ev_bitmask) {
+  if (!multi_)
+    return;
+
+  attachPendingJobs();
+
+  if (quit_.load() && !canceled_) {
+    canceled_ = true;
+    for (auto job : jobs_)
+      job->cancel();
+  }
+
+  int still_running = 0;
+  const CURLMcode mcode = static_cast<ExternalEventDriver*>(event_driver_.get())->action(s, ev_bitmask, &still_running);
+  if (mcode != CURLM_OK)
+    last_error_ = mcode;
+
+  dispatchDoneMessages();
+
+  // Same order as EventLoop::run, the transfers started by the jobs are driven by the timer.
+  const int32_t wait_ms = tickJobs();
+  scheduleTimer(jobs_.empty() ? -1 : wait_ms);
+}
+
+void ZoeExternalLoop::ExternalLoopImpl::shutdown() {
+  quit();
+  while (multi_ && jobCount() > 0) {
+    step(CURL_SOCKET_TIMEOUT, 0);
+    if (jobCount() > 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+bool ZoeExternalLoop::ExternalLoopImpl::submit(LoopJob* job) {
+  if (!multi_ || quit_.load())
+    return false;
+
+  addJob(job);
+  if (timer_functor_)
+    timer_functor_(0);
+  return true;
+}
+
+ConnectionQuota* ZoeExternalLoop::ExternalLoopImpl::quota() {
+  return &quota_;
+}
+
+ZoeExternalLoop::ZoeExternalLoop(SocketFunctor socket_functor, TimerFunctor timer_functor) noexcept {
+  impl_ = new ExternalLoopImpl(socket_functor, timer_functor);
+  impl_->init();
+}
+
+ZoeExternalLoop::~ZoeExternalLoop() noexcept {
+  if (impl_) {
+    delete impl_;
+    impl_ = nullptr;
+  }
+}
+
+bool ZoeExternalLoop::isValid() const noexcept {
+  assert(impl_);
+  return (impl_->multi() != nullptr);
+}
+
+void ZoeExternalLoop::perform(int64_t socket, int32_t readiness) noexcept {
+  assert(impl_);
+  int ev_bitmask = 0;
+  if (readiness & SOCKET_EVENT_READ)
+    ev_bitmask |= CURL_CSELECT_IN;
+  if (readiness & SOCKET_EVENT_WRITE)
+    ev_bitmask |= CURL_CSELECT_OUT;
+  if (readiness & SOCKET_EVENT_ERROR)
+    ev_bitmask |= CURL_CSELECT_ERR;
+  impl_->step((curl_socket_t)socket, ev_bitmask);
+}
+
+void ZoeExternalLoop::onTimeout() noexcept {
+  assert(impl_);
+  impl_->step(CURL_SOCKET_TIMEOUT, 0);
+}
+
+int32_t ZoeExternalLoop::downloadCount() const noexcept {
+  assert(impl_);
+  return impl_->jobCount();
+}
+
+ZoeResult ZoeExternalLoop::setMaxConnections(int32_t num) noexcept {
+  assert(impl_);
+  if (num <= 0)
+    num = -1;
+  impl_->quota()->setMaxConnections(num);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t ZoeExternalLoop::maxConnections() const noexcept {
+  assert(impl_);
+  return impl_->quota()->maxConnections();
+}
+
+ZoeResult ZoeExternalLoop::setMaxDownloadSpeed(int32_t byte_per_seconds) noexcept {
+  assert(impl_);
+  if (byte_per_seconds <= 0)
+    byte_per_seconds = -1;
+  impl_->quota()->setMaxSpeed(byte_per_seconds);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t ZoeExternalLoop::maxDownloadSpeed() const noexcept {
+  assert(impl_);
+  return (int32_t)impl_->quota()->maxSpeed();
+}
+}  // namespace zoe
@@ -0,0 +1,137 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "zoe/zoe.h"
+#include <assert.h>
+#include "scheduler_impl.h"
+
+namespace zoe {
+ZoeScheduler::SchedulerImpl::SchedulerImpl(int32_t loop_num, EventEngine engine)
+    : engine_(engine) {
+  for (int32_t i = 0; i < loop_num; i++) {
+    std::shared_ptr<EventLoop> loop = std::make_shared<EventLoop>(engine);
+    if (!loop->init())
+      continue;
+
+    engine_ = loop->engine();
+    loops_.push_back(loop);
+    loop_tasks_.push_back(std::async(std::launch::async, [loop]() { loop->run(false); }));
+  }
+}
+
+ZoeScheduler::SchedulerImpl::~SchedulerImpl() {
+  // The downloads still running are canceled.
+  for (auto& loop : loops_)
+    loop->quit();
+
+  for (auto& task : loop_tasks_)
+    task.wait();
+}
+
+int32_t ZoeScheduler::SchedulerImpl::loopNum() const {
+  return (int32_t)loops_.size();
+}
+
+EventEngine ZoeScheduler::SchedulerImpl::engine() const {
+  return engine_;
+}
+
+bool ZoeScheduler::SchedulerImpl::submit(LoopJob* job) {
+  std::shared_ptr<EventLoop> target;
+  for (auto& loop : loops_) {
+    if (!target || loop->jobCount() < target->jobCount())
+      target = loop;
+  }
+
+  if (!target)
+    return false;
+
+  target->addJob(job);
+  return true;
+}
+
+ConnectionQuota* ZoeScheduler::SchedulerImpl::quota() {
+  return &quota_;
+}
+
+ZoeScheduler::ZoeScheduler(int32_t loop_num, EventEngine engine) noexcept {
+  if (loop_num <= 0)
+    loop_num = 1;
+  impl_ = new SchedulerImpl(loop_num, engine);
+}
+
+ZoeScheduler::~ZoeScheduler() noexcept {
+  if (impl_) {
+    delete impl_;
+    impl_ = nullptr;
+  }
+}
+
+int32_t ZoeScheduler::loopNum() const noexcept {
+  assert(impl_);
+  return impl_->loopNum();
+}
+
+EventEngine ZoeScheduler::eventEngine() const noexcept {
+  assert(impl_);
+  return impl_->engine();
+}
+
+ZoeResult ZoeScheduler::setMaxConnections(int32_t num) noexcept {
+  assert(impl_);
+  if (num <= 0)
+    num = -1;
+  impl_->quota()->setMaxConnections(num);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t ZoeScheduler::maxConnections() const noexcept {
+  assert(impl_);
+  return impl_->quota()->maxConnections();
+}
+
+ZoeResult ZoeScheduler::setMaxConnectionsPerHost(int32_t num) noexcept {
+  assert(impl_);
+  if (num <= 0)
+    num = -1;
+  impl_->quota()->setMaxConnectionsPerHost(num);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t ZoeScheduler::maxConnectionsPerHost() const noexcept {
+  assert(impl_);
+  return impl_->quota()->maxConnectionsPerHost();
+}
+
+ZoeResult ZoeScheduler::setMaxDownloadSpeed(int32_t byte_per_seconds) noexcept {
+  assert(impl_);
+  if (byte_per_seconds <= 0)
+    byte_per_seconds = -1;
+  impl_->quota()->setMaxSpeed(byte_per_seconds);
+  return ZoeResult::SUCCESSED;
+}
+
+int32_t ZoeScheduler::maxDownloadSpeed() const noexcept {
+  assert(impl_);
+  return (int32_t)impl_->quota()->maxSpeed();
+}
+
+int32_t ZoeScheduler::activeConnections() const noexcept {
+  assert(impl_);
+  return impl_->quota()->activeConnections();
+}
+}  // namespace zoe
@@ -0,0 +1,117 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+// Checks that the CRC32 kernels supported by the CPU give the same results as the table kernel,
+// then measures the throughput of each kernel.
+// Crc32Benchmark [size_mb] [block_kb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "crc32.h"
+
+using namespace zoe;
+using namespace zoe::crc32_internal;
+
+static uint32_t Checksum(Crc32Kernel kernel, const unsigned char* data, size_t size) {
+  uint32_t crc = 0;
+  crc32Init(&crc);
+  crc32UpdateByKernel(kernel, &crc, data, size);
+  crc32Finish(&crc);
+  return crc;
+}
+
+// Every length up to 300 bytes and some larger ones, at every alignment up to 16, and split
+// into two updates.
+static bool CheckKernel(Crc32Kernel kernel, const std::vector<unsigned char>& data) {
+  const unsigned char check[] = "123456789";
+  if (Checksum(kernel, check, 9) != 0xCBF43926) {
+    printf("%s: wrong checksum of the check string.\n", crc32KernelName(kernel));
+    return false;
+  }
+
+  std::vector<size_t> sizes;
+  for (size_t size = 0; size <= 300; size++)
+    sizes.push_back(size);
+  const size_t large_sizes[] = {1023, 1024, 4096, 65535, 65536, 65537, 1048576 - 1};
+  sizes.insert(sizes.end(), large_sizes, large_sizes + sizeof(large_sizes) / sizeof(large_sizes[0]));
+
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t i = 0; i < sizes.size(); i++) {
+      const unsigned char* p = data.data() + offset;
+      const size_t size = sizes[i];
+      const uint32_t expected = Checksum(Crc32Kernel::Table, p, size);
+      if (Checksum(kernel, p, size) != expected) {
+        printf("%s: mismatch, offset %u size %u.\n", crc32KernelName(kernel), (unsigned)offset, (unsigned)size);
+        return false;
+      }
+
+      uint32_t crc = 0;
+      crc32Init(&crc);
+      crc32UpdateByKernel(kernel, &crc, p, size / 3);
+      crc32UpdateByKernel(kernel, &crc, p + size / 3, size - size / 3);
+      crc32Finish(&crc);
+      if (crc != expected) {
+        printf("%s: mismatch of split update, offset %u size %u.\n", crc32KernelName(kernel), (unsigned)offset, (unsigned)size);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const int64_t total_size = (argc > 1 ? atoll(argv[1]) : 1024) * 1048576;
+  const size_t block_size = (size_t)(argc > 2 ? atoll(argv[2]) : 1024) * 1024;
+  if (total_size <= 0 || block_size == 0)
+    return 1;
+
+  std::vector<unsigned char> data(std::max(block_size, (size_t)1048576) + 16);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < data.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (unsigned char)(seed >> 16);
+  }
+
+  printf("Selected kernel: %s\n", crc32KernelName(crc32SelectedKernel()));
+  printf("%12s %12s %10s\n", "kernel", "GB/s", "crc32");
+  for (int32_t i = 0; i < (int32_t)Crc32Kernel::KernelNum; i++) {
+    const Crc32Kernel kernel = (Crc32Kernel)i;
+    if (!crc32KernelSupported(kernel)) {
+      printf("%12s %12s\n", crc32KernelName(kernel), "unsupported");
+      continue;
+    }
+    if (!CheckKernel(kernel, data))
+      return 1;
+
+    uint32_t crc = 0;
+    crc32Init(&crc);
+    const auto begin = std::chrono::steady_clock::now();
+    for (int64_t done = 0; done < total_size; done += (int64_t)block_size)
+      crc32UpdateByKernel(kernel, &crc, data.data(), block_size);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    crc32Finish(&crc);
+    printf("%12s %12.2f %10.8x\n", crc32KernelName(kernel), total_size / 1073741824.0 / seconds, crc);
+  }
+
+  return 0;
+}
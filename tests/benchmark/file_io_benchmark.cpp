@@ -0,0 +1,160 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+// Measures the write and hash read throughput of the file I/O engines.
+// The writes are submitted in batches, the same as DiskWriter does.
+// The page cache used by the written file is measured after the sync, POSIX only.
+// FileIoBenchmark [path] [size_mb] [block_kb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#include "zoe/zoe.h"
+#include "options.h"
+#include "target_file.h"
+#include "file_util.h"
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace zoe;
+
+#define BENCHMARK_BATCH_SIZE 16
+#define BENCHMARK_BUFFER_ALIGNMENT 4096
+
+struct EngineResult {
+  double write_mbps;
+  double hash_mbps;
+  double cached_mb;  // -1 if unknown
+  utf8string hash;
+};
+
+static double Seconds(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Size of the pages of |path| that are in the page cache.
+static double CachedMegabytes(const utf8string& path, int64_t file_size) {
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__) && !defined(__NT__)
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return -1.0;
+  void* addr = mmap(nullptr, (size_t)file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return -1.0;
+
+  const int64_t page_size = sysconf(_SC_PAGESIZE);
+  std::vector<unsigned char> pages((size_t)((file_size + page_size - 1) / page_size));
+  double cached = -1.0;
+  if (mincore(addr, (size_t)file_size, pages.data()) == 0) {
+    int64_t count = 0L;
+    for (size_t i = 0; i < pages.size(); i++)
+      count += (pages[i] & 1);
+    cached = count * page_size / 1048576.0;
+  }
+  munmap(addr, (size_t)file_size);
+  return cached;
+#else
+  return -1.0;
+#endif
+}
+
+static bool RunOnce(const utf8string& path, FileIoEngine engine, int64_t file_size, int64_t block_size, EngineResult* result) {
+  FileUtil::RemoveFile(path);
+  TargetFile target_file(path, engine);
+  if (!target_file.createNew(file_size)) {
+    printf("Create %s failed.\n", path.c_str());
+    return false;
+  }
+
+  // Every block of a batch has its own buffer, as the queued buffers of slices.
+  // The buffers are aligned as the slice caches of FileIoEngine::Direct.
+  const size_t buffer_size = (size_t)(block_size * BENCHMARK_BATCH_SIZE);
+  std::vector<char> memory(buffer_size + BENCHMARK_BUFFER_ALIGNMENT);
+  char* buffer = memory.data() + (BENCHMARK_BUFFER_ALIGNMENT - (uintptr_t)memory.data() % BENCHMARK_BUFFER_ALIGNMENT) % BENCHMARK_BUFFER_ALIGNMENT;
+  for (size_t i = 0; i < buffer_size; i++)
+    buffer[i] = (char)(i * 131 + i / 4099);
+
+  const auto write_begin = std::chrono::steady_clock::now();
+  int64_t pos = 0L;
+  while (pos < file_size) {
+    FileIoRequest requests[BENCHMARK_BATCH_SIZE];
+    int32_t count = 0;
+    for (; count < BENCHMARK_BATCH_SIZE && pos < file_size; count++) {
+      const int64_t size = std::min(block_size, file_size - pos);
+      FileIoRequest request = {true, pos, buffer + count * block_size, size, -1, 0L};
+      requests[count] = request;
+      pos += size;
+    }
+
+    target_file.performBatch(requests, count);
+    for (int32_t i = 0; i < count; i++) {
+      if (requests[i].result != requests[i].size) {
+        printf("Write failed at %lld.\n", (long long)requests[i].pos);
+        return false;
+      }
+    }
+  }
+  target_file.sync(true);
+  result->write_mbps = file_size / 1048576.0 / Seconds(write_begin);
+  result->cached_mb = CachedMegabytes(path, file_size);
+
+  Options options;
+  options.hash_type = HashType::CRC32;
+  options.internal_stop_event.unset();
+  const auto hash_begin = std::chrono::steady_clock::now();
+  if (target_file.calculateFileHash(&options, result->hash) != ZoeResult::SUCCESSED) {
+    printf("Calculate hash failed.\n");
+    return false;
+  }
+  result->hash_mbps = file_size / 1048576.0 / Seconds(hash_begin);
+
+  target_file.close();
+  FileUtil::RemoveFile(path);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const utf8string path = (argc > 1 ? argv[1] : "file_io_benchmark.bin");
+  const int64_t file_size = (argc > 2 ? atoll(argv[2]) : 1024) * 1048576;
+  const int64_t block_size = (argc > 3 ? atoll(argv[3]) : 1024) * 1024;
+  if (file_size <= 0 || block_size <= 0)
+    return 1;
+
+  const FileIoEngine engines[] = {FileIoEngine::Stdio, FileIoEngine::Auto, FileIoEngine::IoUring, FileIoEngine::Mmap, FileIoEngine::Direct};
+  const char* names[] = {"stdio", "auto", "io_uring", "mmap", "direct"};
+
+#if !defined(WITH_IO_URING)
+  printf("Built without io_uring, io_uring falls back to auto.\n");
+#endif
+  printf("%10s %14s %14s %12s %10s\n", "engine", "write MB/s", "hash MB/s", "cached MB", "crc32");
+  for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+    EngineResult result;
+    if (!RunOnce(path, engines[i], file_size, block_size, &result))
+      return 1;
+    printf("%10s %14.1f %14.1f %12.1f %10s\n", names[i], result.write_mbps, result.hash_mbps, result.cached_mb, result.hash.c_str());
+  }
+
+  return 0;
+}
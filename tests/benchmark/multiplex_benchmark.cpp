@@ -0,0 +1,106 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+// Compares the per-connection mode with the HTTP/2 multiplexed mode by downloading the same
+// file with each policy. For cleartext URLs HTTP/2 is used by prior knowledge (h2c).
+//
+// Usage: MultiplexBenchmark <url> [thread num] [rounds] [target path]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include "zoe/zoe.h"
+
+using namespace zoe;
+
+#define BENCHMARK_SLICE_SIZE (1024 * 1024)
+
+struct RoundResult {
+  ZoeResult result;
+  int64_t elapsed_ms;
+  long new_connections;
+};
+
+static RoundResult RunOnce(const utf8string& url,
+                           const utf8string& target_path,
+                           int32_t thread_num,
+                           HttpVersionPolicy policy) {
+  RoundResult round = {ZoeResult::UNKNOWN_ERROR, 0, 0};
+  remove(target_path.c_str());
+
+  Zoe z;
+  z.setThreadNum(thread_num);
+  z.setSlicePolicy(SlicePolicy::FixedSize, BENCHMARK_SLICE_SIZE);
+  z.setHttpVersionPolicy(policy);
+  z.setVerboseOutput([&round](const utf8string& verbose) {
+    const char* key = "new connections: ";
+    const size_t pos = verbose.find(key);
+    if (pos != utf8string::npos)
+      round.new_connections = atol(verbose.c_str() + pos + strlen(key));
+  });
+
+  const auto begin = std::chrono::steady_clock::now();
+  round.result = z.start(url, target_path, nullptr, nullptr, nullptr).get();
+  const auto end = std::chrono::steady_clock::now();
+  round.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+
+  remove(target_path.c_str());
+  return round;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    printf("Usage: %s <url> [thread num] [rounds] [target path]\n", argv[0]);
+    return 1;
+  }
+
+  const utf8string url = argv[1];
+  const int32_t thread_num = (argc > 2 ? atoi(argv[2]) : 16);
+  const int32_t rounds = (argc > 3 ? atoi(argv[3]) : 3);
+  const utf8string target_path = (argc > 4 ? argv[4] : "multiplex_benchmark.bin");
+
+  const bool tls = (url.compare(0, 8, "https://") == 0);
+  const struct {
+    const char* name;
+    HttpVersionPolicy policy;
+  } modes[] = {
+      {"http/1.1", HttpVersionPolicy::Http1},
+      {"http/2", tls ? HttpVersionPolicy::Http2 : HttpVersionPolicy::Http2PriorKnowledge},
+  };
+
+  Zoe::GlobalInit();
+
+  int ret = 0;
+  printf("%10s %8s %12s %16s\n", "mode", "round", "elapsed ms", "new connections");
+  for (const auto& mode : modes) {
+    for (int32_t i = 0; i < rounds; i++) {
+      const RoundResult round = RunOnce(url, target_path, thread_num, mode.policy);
+      if (round.result != ZoeResult::SUCCESSED) {
+        printf("%10s %8d failed: %s\n", mode.name, i, Zoe::GetResultString(round.result));
+        ret = 1;
+        continue;
+      }
+      printf("%10s %8d %12lld %16ld\n", mode.name, i, (long long)round.elapsed_ms, round.new_connections);
+    }
+  }
+
+  Zoe::GlobalUnInit();
+  return ret;
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+// Measures the throughput of the SHA256 kernels supported by the CPU.
+// The known-answer tests are in unit_test/t_sha256.cpp.
+// Sha256Benchmark [size_mb] [block_kb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#include "sha256.h"
+
+using namespace zoe;
+using namespace zoe::sha256_internal;
+
+int main(int argc, char** argv) {
+  const int64_t total_size = (argc > 1 ? atoll(argv[1]) : 1024) * 1048576;
+  const size_t block_size = (size_t)(argc > 2 ? atoll(argv[2]) : 1024) * 1024;
+  if (total_size <= 0 || block_size == 0)
+    return 1;
+
+  std::vector<unsigned char> data(block_size);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < data.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (unsigned char)(seed >> 16);
+  }
+
+  printf("Selected kernel: %s\n", sha256_kernel_name(sha256_selected_kernel()));
+  printf("%14s %12s  %s\n", "kernel", "MB/s", "sha256");
+  for (int32_t i = 0; i < (int32_t)Sha256Kernel::KernelNum; i++) {
+    const Sha256Kernel kernel = (Sha256Kernel)i;
+    if (!sha256_kernel_supported(kernel)) {
+      printf("%14s %12s\n", sha256_kernel_name(kernel), "unsupported");
+      continue;
+    }
+
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    const auto begin = std::chrono::steady_clock::now();
+    for (int64_t done = 0; done < total_size; done += (int64_t)block_size)
+      sha256_update_by_kernel(kernel, &ctx, data.data(), (uint32_t)block_size);
+    sha256_final(&ctx);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%14s %12.1f  %s\n", sha256_kernel_name(kernel), total_size / 1048576.0 / seconds, sha256_digest(&ctx).c_str());
+  }
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+// Measures the scheduling operations of SliceManager with different numbers of slices.
+// Every operation is O(1), so the cost per slice should stay flat as the number grows.
+
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include "zoe/zoe.h"
+#include "options.h"
+#include "slice_manager.h"
+#include "file_util.h"
+
+using namespace zoe;
+
+#define BENCHMARK_SLICE_SIZE 1024
+
+static double RunOnce(const utf8string& target_path, int64_t slice_num) {
+  Options options;
+  options.target_file_path = target_path;
+  options.slice_policy = SlicePolicy::FixedSize;
+  options.slice_policy_value = BENCHMARK_SLICE_SIZE;
+
+  std::shared_ptr<SliceManager> slice_manager = std::make_shared<SliceManager>(&options, "");
+  slice_manager->setOriginFileSize(slice_num * BENCHMARK_SLICE_SIZE);
+  if (slice_manager->makeSlices(true) != ZoeResult::SUCCESSED) {
+    printf("Make slices failed.\n");
+    return -1.0;
+  }
+
+  // The same calls that EntryHandler makes for each slice: pick the next slice, check the
+  // pending slices, fail it once, retry it and complete it.
+  const auto begin = std::chrono::steady_clock::now();
+  int64_t scheduled = 0;
+  while (std::shared_ptr<Slice> slice = slice_manager->getSlice(Slice::SliceStatus::UNFETCH)) {
+    slice->setStatus(Slice::SliceStatus::DOWNLOADING);
+    if (!slice_manager->hasSlice(Slice::SliceStatus::DOWNLOADING))
+      break;
+
+    slice->setStatus(Slice::SliceStatus::DOWNLOAD_FAILED);
+    slice->increaseFailedTimes();
+
+    std::shared_ptr<Slice> failed = slice_manager->getRetryableFailedSlice();
+    if (failed != slice)
+      break;
+
+    failed->setStatus(Slice::SliceStatus::DOWNLOADING);
+    failed->setStatus(Slice::SliceStatus::DOWNLOAD_COMPLETED);
+    scheduled++;
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  slice_manager->cleanup();
+  FileUtil::RemoveFile(target_path + ".zoe");
+
+  if (scheduled != slice_num) {
+    printf("Only %lld of %lld slices are scheduled.\n", (long long)scheduled, (long long)slice_num);
+    return -1.0;
+  }
+
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / slice_num;
+}
+
+int main(int argc, char** argv) {
+  const utf8string target_path = (argc > 1 ? argv[1] : "slice_benchmark.bin");
+  const int64_t slice_nums[] = {1000, 10000, 100000};
+
+  printf("%10s %16s\n", "slices", "ns per slice");
+  for (const int64_t num : slice_nums) {
+    const double ns = RunOnce(target_path, num);
+    if (ns < 0)
+      return 1;
+    printf("%10lld %16.1f\n", (long long)num, ns);
+  }
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "catch.hpp"
+#include "crc32.h"
+#include <vector>
+#include <algorithm>
+using namespace zoe;
+using namespace zoe::crc32_internal;
+
+static uint32_t Crc32(Crc32Kernel kernel, const unsigned char* data, size_t size, size_t step) {
+  uint32_t crc = 0;
+  crc32Init(&crc);
+  for (size_t done = 0; done < size; done += step)
+    crc32UpdateByKernel(kernel, &crc, data + done, std::min(step, size - done));
+  crc32Finish(&crc);
+  return crc;
+}
+
+TEST_CASE("Crc32KnownAnswerTest") {
+  const unsigned char check[] = "123456789";
+  for (int32_t i = 0; i < (int32_t)Crc32Kernel::KernelNum; i++) {
+    const Crc32Kernel kernel = (Crc32Kernel)i;
+    if (!crc32KernelSupported(kernel))
+      continue;
+    printf("\nKernel: %s\n", crc32KernelName(kernel));
+
+    REQUIRE(Crc32(kernel, check, 0, 1) == 0x00000000);
+    REQUIRE(Crc32(kernel, check, 9, 9) == 0xCBF43926);
+
+    const std::vector<unsigned char> million(1000000, 'a');
+    REQUIRE(Crc32(kernel, million.data(), million.size(), million.size()) == 0xDC25BFBC);
+  }
+
+  // The dispatched update.
+  uint32_t crc = 0;
+  crc32Init(&crc);
+  crc32Update(&crc, (unsigned char*)check, 9);
+  crc32Finish(&crc);
+  REQUIRE(crc == 0xCBF43926);
+}
+
+TEST_CASE("Crc32KernelMatchTable") {
+  std::vector<unsigned char> data(65536 + 64);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < data.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = (unsigned char)(seed >> 16);
+  }
+
+  for (int32_t i = 0; i < (int32_t)Crc32Kernel::KernelNum; i++) {
+    const Crc32Kernel kernel = (Crc32Kernel)i;
+    if (!crc32KernelSupported(kernel) || kernel == Crc32Kernel::Table)
+      continue;
+
+    // Every length across the 16 and 64 byte blocks of the kernels, at every misaligned offset,
+    // updated at once and chained by odd pieces.
+    for (size_t offset = 0; offset < 16; offset++) {
+      const unsigned char* p = data.data() + offset;
+      for (size_t size = 0; size <= 1100; size++) {
+        const uint32_t expected = Crc32(Crc32Kernel::Table, p, size, size + 1);
+        REQUIRE(Crc32(kernel, p, size, size + 1) == expected);
+        REQUIRE(Crc32(kernel, p, size, 7) == expected);
+        REQUIRE(Crc32(kernel, p, size, 67) == expected);
+      }
+    }
+
+    const size_t large_sizes[] = {4095, 4096, 65535, 65536};
+    for (size_t j = 0; j < sizeof(large_sizes) / sizeof(large_sizes[0]); j++) {
+      const uint32_t expected = Crc32(Crc32Kernel::Table, data.data() + 3, large_sizes[j], large_sizes[j]);
+      REQUIRE(Crc32(kernel, data.data() + 3, large_sizes[j], large_sizes[j]) == expected);
+      REQUIRE(Crc32(kernel, data.data() + 3, large_sizes[j], 1000) == expected);
+    }
+  }
+}
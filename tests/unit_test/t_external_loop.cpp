@@ -0,0 +1,170 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#endif
+#include <chrono>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <future>
+#include "catch.hpp"
+#include "zoe/zoe.h"
+#include "test_data.h"
+using namespace zoe;
+
+namespace {
+// A minimal select() based reactor that drives ZoeExternalLoop on the calling thread.
+class SelectReactor {
+ public:
+  SelectReactor() : deadline_(-1) {}
+
+  void watch(int64_t socket, int32_t events) {
+    if (events == ZoeExternalLoop::SOCKET_EVENT_NONE)
+      sockets_.erase(socket);
+    else
+      sockets_[socket] = events;
+  }
+
+  void setTimer(int32_t timeout_ms) { deadline_ = (timeout_ms < 0 ? -1 : nowMs() + timeout_ms); }
+
+  void run(ZoeExternalLoop& loop) {
+    while (loop.downloadCount() > 0) {
+      fd_set read_set, write_set, error_set;
+      FD_ZERO(&read_set);
+      FD_ZERO(&write_set);
+      FD_ZERO(&error_set);
+
+      int max_fd = -1;
+      for (const auto& it : sockets_) {
+        const int fd = (int)it.first;
+        if (it.second & ZoeExternalLoop::SOCKET_EVENT_READ)
+          FD_SET(fd, &read_set);
+        if (it.second & ZoeExternalLoop::SOCKET_EVENT_WRITE)
+          FD_SET(fd, &write_set);
+        FD_SET(fd, &error_set);
+        if (fd > max_fd)
+          max_fd = fd;
+      }
+
+      int64_t wait_ms = 100;
+      if (deadline_ >= 0)
+        wait_ms = std::max((int64_t)0, std::min(wait_ms, deadline_ - nowMs()));
+
+      timeval tv;
+      tv.tv_sec = (long)(wait_ms / 1000);
+      tv.tv_usec = (long)((wait_ms % 1000) * 1000);
+
+      int rc = 0;
+      if (max_fd >= 0) {
+        rc = select(max_fd + 1, &read_set, &write_set, &error_set, &tv);
+      }
+      else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+      }
+
+      if (rc > 0) {
+        // perform may change the watched sockets.
+        std::vector<std::pair<int64_t, int32_t>> ready;
+        for (const auto& it : sockets_) {
+          const int fd = (int)it.first;
+          int32_t readiness = 0;
+          if (FD_ISSET(fd, &read_set))
+            readiness |= ZoeExternalLoop::SOCKET_EVENT_READ;
+          if (FD_ISSET(fd, &write_set))
+            readiness |= ZoeExternalLoop::SOCKET_EVENT_WRITE;
+          if (FD_ISSET(fd, &error_set))
+            readiness |= ZoeExternalLoop::SOCKET_EVENT_ERROR;
+          if (readiness != 0)
+            ready.push_back(std::make_pair(it.first, readiness));
+        }
+
+        for (const auto& it : ready)
+          loop.perform(it.first, it.second);
+      }
+
+      if (deadline_ >= 0 && nowMs() >= deadline_) {
+        deadline_ = -1;
+        loop.onTimeout();
+      }
+    }
+  }
+
+ private:
+  static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  std::map<int64_t, int32_t> sockets_;
+  int64_t deadline_;
+};
+}  // namespace
+
+static void DoExternalLoopTest(size_t job_num) {
+  Zoe::GlobalInit();
+  {
+    SelectReactor reactor;
+    ZoeExternalLoop loop([&reactor](int64_t socket, int32_t events) { reactor.watch(socket, events); },
+                         [&reactor](int32_t timeout_ms) { reactor.setTimer(timeout_ms); });
+    REQUIRE(loop.isValid());
+
+    std::vector<std::shared_ptr<Zoe>> efds;
+    std::vector<std::shared_future<ZoeResult>> results;
+    for (size_t i = 0; i < job_num; i++) {
+      const TestData test_data = GetHttpTestData();
+      printf("\n[%zu] Url: %s\n", i, test_data.url.c_str());
+
+      std::shared_ptr<Zoe> t = std::make_shared<Zoe>();
+      efds.push_back(t);
+      REQUIRE(t->setExternalLoop(&loop) == ZoeResult::SUCCESSED);
+      t->setHttpHeaders({{"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/130.0.0.0 Safari/537.36"}});
+      t->setThreadNum(3);
+      if (test_data.md5.length() > 0)
+        t->setHashVerifyPolicy(HashVerifyPolicy::AlwaysVerify, HashType::MD5, test_data.md5);
+
+      results.push_back(t->start(
+          test_data.url, test_data.target_file_path,
+          [i](ZoeResult result) {
+            printf("\n[%zu] ZoeResult: %s\n", i, Zoe::GetResultString(result));
+          },
+          nullptr,
+          nullptr));
+    }
+
+    REQUIRE(loop.downloadCount() == (int32_t)job_num);
+    reactor.run(loop);
+
+    for (auto& r : results) {
+      REQUIRE(r.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+      REQUIRE(r.get() == ZoeResult::SUCCESSED);
+    }
+  }
+  Zoe::GlobalUnInit();
+}
+
+TEST_CASE("ExternalLoopTest-OneJob") {
+  DoExternalLoopTest(1);
+}
+
+TEST_CASE("ExternalLoopTest-ThreeJobs") {
+  DoExternalLoopTest(3);
+}
@@ -0,0 +1,147 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "catch.hpp"
+#include "hash_reader.h"
+#include "hasher.h"
+#include "options.h"
+#include "file_util.h"
+#include <vector>
+#include <memory>
+#include <string.h>
+using namespace zoe;
+
+static const HashType kHashTypes[] = {HashType::MD5, HashType::CRC32, HashType::SHA256};
+
+static std::vector<unsigned char> TestData(size_t size) {
+  std::vector<unsigned char> data(size);
+  uint32_t x = 12345;
+  for (size_t i = 0; i < data.size(); i++) {
+    x = x * 1664525 + 1013904223;
+    data[i] = (unsigned char)(x >> 24);
+  }
+  return data;
+}
+
+static utf8string MemoryHash(HashType type, const unsigned char* data, size_t size) {
+  std::unique_ptr<Hasher> hasher(Hasher::Create(type));
+  hasher->update(data, size);
+  return hasher->final();
+}
+
+static ZoeResult ReadHash(HashReader& reader,
+                          const std::vector<unsigned char>& data,
+                          int64_t pos,
+                          int64_t end,
+                          HashType type,
+                          Options* opt,
+                          utf8string& str_hash) {
+  std::unique_ptr<Hasher> hasher(Hasher::Create(type));
+  const ZoeResult ret = reader.run(
+      [&reader, &data](int64_t block_pos, int64_t block_size, int32_t index) {
+        memcpy(reader.buffer(index), data.data() + block_pos, (size_t)block_size);
+        return true;
+      },
+      pos, end, hasher.get(), opt);
+  if (ret == ZoeResult::SUCCESSED)
+    str_hash = hasher->final();
+  return ret;
+}
+
+TEST_CASE("HashReaderMatchMemoryHash") {
+  const std::vector<unsigned char> data = TestData(300007);
+  const int64_t size = (int64_t)data.size();
+  const int64_t block_sizes[] = {1000, 4096, 65543, size, size * 2};
+  const int64_t alignments[] = {1, 4096};
+
+  Options opt;
+  opt.internal_stop_event.unset();
+  for (HashType type : kHashTypes) {
+    for (int64_t block_size : block_sizes) {
+      for (int64_t alignment : alignments) {
+        // The whole data, a range in the middle and a range shorter than one block.
+        const int64_t ranges[][2] = {{0, size}, {777, size - 1234}, {size - 999, size}};
+        for (const auto& range : ranges) {
+          HashReader reader(block_size, alignment, range[1] - range[0]);
+          REQUIRE((uintptr_t)reader.buffer(0) % alignment == 0);
+
+          utf8string str_hash;
+          REQUIRE(ReadHash(reader, data, range[0], range[1], type, &opt, str_hash) == ZoeResult::SUCCESSED);
+          REQUIRE(str_hash == MemoryHash(type, data.data() + range[0], (size_t)(range[1] - range[0])));
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("HashReaderReadFailed") {
+  const std::vector<unsigned char> data = TestData(100003);
+  Options opt;
+  opt.internal_stop_event.unset();
+
+  // One buffer read on the calling thread, and two buffers read ahead.
+  const int64_t block_sizes[] = {(int64_t)data.size(), 4096};
+  for (int64_t block_size : block_sizes) {
+    HashReader reader(block_size, 1, (int64_t)data.size());
+    std::unique_ptr<Hasher> hasher(Hasher::Create(HashType::MD5));
+    const ZoeResult ret = reader.run(
+        [&reader, &data](int64_t pos, int64_t size, int32_t index) {
+          if (pos + size > 50000)
+            return false;
+          memcpy(reader.buffer(index), data.data() + pos, (size_t)size);
+          return true;
+        },
+        0L, (int64_t)data.size(), hasher.get(), &opt);
+    REQUIRE(ret == ZoeResult::CALCULATE_HASH_FAILED);
+  }
+}
+
+TEST_CASE("HashReaderCanceled") {
+  const std::vector<unsigned char> data = TestData(100003);
+  Options opt;
+  opt.internal_stop_event.set();
+
+  const int64_t block_sizes[] = {(int64_t)data.size(), 4096};
+  for (int64_t block_size : block_sizes) {
+    HashReader reader(block_size, 1, (int64_t)data.size());
+    utf8string str_hash;
+    REQUIRE(ReadHash(reader, data, 0L, (int64_t)data.size(), HashType::MD5, &opt, str_hash) == ZoeResult::CANCELED);
+  }
+}
+
+TEST_CASE("HashReaderHashFile") {
+  // More than two blocks of HashFile, not aligned.
+  const std::vector<unsigned char> data = TestData(9 * 1024 * 1024 + 5);
+  const utf8string file_path = "hash_reader_test.dat";
+  FILE* f = FileUtil::Open(file_path, "wb");
+  REQUIRE(f);
+  REQUIRE(fwrite(data.data(), 1, data.size(), f) == data.size());
+  fclose(f);
+
+  Options opt;
+  opt.internal_stop_event.unset();
+
+  utf8string str_hash;
+  REQUIRE(CalculateFileMd5(file_path, &opt, str_hash) == ZoeResult::SUCCESSED);
+  REQUIRE(str_hash == MemoryHash(HashType::MD5, data.data(), data.size()));
+  REQUIRE(CalculateFileCRC32(file_path, &opt, str_hash) == ZoeResult::SUCCESSED);
+  REQUIRE(str_hash == MemoryHash(HashType::CRC32, data.data(), data.size()));
+  REQUIRE(CalculateFileSHA256(file_path, &opt, str_hash) == ZoeResult::SUCCESSED);
+  REQUIRE(str_hash == MemoryHash(HashType::SHA256, data.data(), data.size()));
+
+  FileUtil::RemoveFile(file_path);
+}
@@ -0,0 +1,287 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "catch.hpp"
+#include "target_file.h"
+#include "options.h"
+#include "file_util.h"
+#include "md5.h"
+#include "sha256.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+using namespace zoe;
+
+static const char* kTestFile = "prefix_hash_test.dat";
+static const int64_t kChunkSize = 262144;                // 256KB
+static const int64_t kFileSize = 13 * kChunkSize + 1234;  // more than one read back block, not aligned
+
+static const FileIoEngine kEngines[] = {FileIoEngine::Auto, FileIoEngine::Stdio, FileIoEngine::Mmap};
+static const HashType kHashTypes[] = {HashType::MD5, HashType::SHA256};
+
+static std::vector<unsigned char> TestData(uint32_t seed) {
+  std::vector<unsigned char> data((size_t)kFileSize);
+  uint32_t x = seed;
+  for (size_t i = 0; i < data.size(); i++) {
+    x = x * 1664525 + 1013904223;
+    data[i] = (unsigned char)(x >> 24);
+  }
+  return data;
+}
+
+static void WriteRange(TargetFile& file, const std::vector<unsigned char>& data, int64_t pos, int64_t size) {
+  REQUIRE(file.write(pos, data.data() + pos, size) == size);
+}
+
+static void WriteChunk(TargetFile& file, const std::vector<unsigned char>& data, int64_t index) {
+  const int64_t pos = index * kChunkSize;
+  WriteRange(file, data, pos, std::min(kChunkSize, kFileSize - pos));
+}
+
+// The ranges written ahead are read back by a background thread.
+static int64_t WaitHashed(TargetFile& file, int64_t bytes) {
+  for (int32_t i = 0; i < 5000 && file.hashedBytes() < bytes; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return file.hashedBytes();
+}
+
+static utf8string FullReadHash(HashType type) {
+  Options opt;
+  opt.internal_stop_event.unset();
+  utf8string str_hash;
+  if (type == HashType::MD5)
+    REQUIRE(CalculateFileMd5(kTestFile, &opt, str_hash) == ZoeResult::SUCCESSED);
+  else
+    REQUIRE(CalculateFileSHA256(kTestFile, &opt, str_hash) == ZoeResult::SUCCESSED);
+  REQUIRE(!str_hash.empty());
+  return str_hash;
+}
+
+static utf8string TargetFileHash(TargetFile& file, HashType type) {
+  Options opt;
+  opt.internal_stop_event.unset();
+  opt.hash_type = type;
+  utf8string str_hash;
+  REQUIRE(file.calculateFileHash(&opt, str_hash) == ZoeResult::SUCCESSED);
+  return str_hash;
+}
+
+TEST_CASE("PrefixHashOutOfOrderWrite") {
+  const std::vector<unsigned char> data = TestData(1);
+  const int64_t order[] = {2, 5, 4, 0, 1, 3, 13, 12, 6, 9, 8, 7, 10, 11};
+  for (FileIoEngine engine : kEngines) {
+    for (HashType type : kHashTypes) {
+      TargetFile file(kTestFile, engine);
+      REQUIRE(file.createNew(kFileSize));
+      file.enablePrefixHash(type);
+
+      for (int64_t index : order)
+        WriteChunk(file, data, index);
+
+      REQUIRE(WaitHashed(file, kFileSize) == kFileSize);
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+      file.close();
+    }
+  }
+  FileUtil::RemoveFile(kTestFile);
+}
+
+TEST_CASE("PrefixHashPartialPrefix") {
+  // calculateFileHash reads the rest of the file after the prefix, including the gaps never written.
+  const std::vector<unsigned char> data = TestData(2);
+  for (FileIoEngine engine : kEngines) {
+    for (HashType type : kHashTypes) {
+      TargetFile file(kTestFile, engine);
+      REQUIRE(file.createNew(kFileSize));
+      file.enablePrefixHash(type);
+
+      WriteChunk(file, data, 1);
+      WriteChunk(file, data, 0);
+      WriteChunk(file, data, 7);
+      REQUIRE(WaitHashed(file, 2 * kChunkSize) == 2 * kChunkSize);
+
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+      REQUIRE(file.hashedBytes() == kFileSize);
+      file.close();
+    }
+  }
+  FileUtil::RemoveFile(kTestFile);
+}
+
+TEST_CASE("PrefixHashDiscardInsidePrefix") {
+  const std::vector<unsigned char> data = TestData(3);
+  const std::vector<unsigned char> other = TestData(4);
+  for (FileIoEngine engine : kEngines) {
+    for (HashType type : kHashTypes) {
+      TargetFile file(kTestFile, engine);
+      REQUIRE(file.createNew(kFileSize));
+      file.enablePrefixHash(type);
+
+      for (int64_t index = 0; index < 4; index++)
+        WriteChunk(file, data, index);
+      WriteChunk(file, data, 6);
+      REQUIRE(WaitHashed(file, 4 * kChunkSize) == 4 * kChunkSize);
+
+      // The hashed data is written again, the prefix hash has to be dropped.
+      file.discardWritten(2 * kChunkSize, kChunkSize);
+      REQUIRE(file.hashedBytes() == 0);
+      WriteChunk(file, other, 2);
+      for (int64_t index = 4; index <= 13; index++)
+        WriteChunk(file, data, index);
+
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+      file.close();
+    }
+  }
+  FileUtil::RemoveFile(kTestFile);
+}
+
+TEST_CASE("PrefixHashDiscardAheadOfPrefix") {
+  const std::vector<unsigned char> data = TestData(5);
+  const std::vector<unsigned char> other = TestData(6);
+  for (FileIoEngine engine : kEngines) {
+    for (HashType type : kHashTypes) {
+      TargetFile file(kTestFile, engine);
+      REQUIRE(file.createNew(kFileSize));
+      file.enablePrefixHash(type);
+
+      WriteChunk(file, data, 0);
+      for (int64_t index = 3; index < 8; index++)
+        WriteChunk(file, other, index);
+      REQUIRE(WaitHashed(file, kChunkSize) == kChunkSize);
+
+      // Whole range, part of a range and the ranges across the boundary of two writes.
+      file.discardWritten(3 * kChunkSize, kChunkSize);
+      file.discardWritten(5 * kChunkSize + kChunkSize / 2, kChunkSize / 4);
+      file.discardWritten(6 * kChunkSize + kChunkSize / 2, kChunkSize);
+      REQUIRE(file.hashedBytes() == kChunkSize);
+
+      // The prefix stops at the discarded range.
+      WriteChunk(file, data, 1);
+      WriteChunk(file, data, 2);
+      REQUIRE(WaitHashed(file, 3 * kChunkSize) == 3 * kChunkSize);
+
+      // Only the discarded ranges are written again, the others are kept.
+      WriteChunk(file, data, 3);
+      WriteRange(file, data, 5 * kChunkSize + kChunkSize / 2, kChunkSize / 4);
+      WriteRange(file, data, 6 * kChunkSize + kChunkSize / 2, kChunkSize);
+      for (int64_t index = 8; index <= 13; index++)
+        WriteChunk(file, data, index);
+
+      REQUIRE(WaitHashed(file, kFileSize) == kFileSize);
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+      file.close();
+    }
+  }
+  FileUtil::RemoveFile(kTestFile);
+}
+
+TEST_CASE("PrefixHashResume") {
+  const std::vector<unsigned char> data = TestData(7);
+  for (FileIoEngine engine : kEngines) {
+    for (HashType type : kHashTypes) {
+      {
+        TargetFile file(kTestFile, engine);
+        REQUIRE(file.createNew(kFileSize));
+        WriteChunk(file, data, 0);
+        WriteChunk(file, data, 1);
+        WriteChunk(file, data, 5);
+        WriteChunk(file, data, 6);
+        file.close();
+      }
+
+      // Like loading the completed slices from the index file.
+      TargetFile file(kTestFile, engine);
+      REQUIRE(file.open());
+      file.enablePrefixHash(type);
+      file.markWritten(5 * kChunkSize, 2 * kChunkSize);
+      file.markWritten(0, 2 * kChunkSize);
+      REQUIRE(WaitHashed(file, 2 * kChunkSize) == 2 * kChunkSize);
+
+      for (int64_t index = 2; index <= 13; index++) {
+        if (index != 5 && index != 6)
+          WriteChunk(file, data, index);
+      }
+
+      REQUIRE(WaitHashed(file, kFileSize) == kFileSize);
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+      file.close();
+    }
+  }
+  FileUtil::RemoveFile(kTestFile);
+}
+
+static utf8string RangeCrc32(TargetFile& file, int64_t pos, int64_t end) {
+  Options opt;
+  opt.internal_stop_event.unset();
+  utf8string str_hash;
+  REQUIRE(file.calculateRangeHash(HashType::CRC32, pos, end, &opt, str_hash) == ZoeResult::SUCCESSED);
+  return str_hash;
+}
+
+TEST_CASE("PrefixHashCheckWrittenRange") {
+  const std::vector<unsigned char> data = TestData(8);
+  for (FileIoEngine engine : kEngines) {
+    for (HashType type : kHashTypes) {
+      {
+        TargetFile file(kTestFile, engine);
+        REQUIRE(file.createNew(kFileSize));
+        for (int64_t index = 0; index < 8; index++)
+          WriteChunk(file, data, index);
+        file.close();
+      }
+
+      // Like validating the completed slices loaded from the index file.
+      TargetFile file(kTestFile, engine);
+      REQUIRE(file.open());
+      const utf8string crc0 = RangeCrc32(file, 0, 2 * kChunkSize);
+      const utf8string crc1 = RangeCrc32(file, 2 * kChunkSize, 4 * kChunkSize);
+      const utf8string crc2 = RangeCrc32(file, 5 * kChunkSize, 6 * kChunkSize);
+      file.enablePrefixHash(type);
+
+      Options opt;
+      opt.internal_stop_event.unset();
+
+      // Continues the prefix, hashed into it by the same read.
+      REQUIRE(file.checkWrittenRange(HashType::CRC32, 0, 2 * kChunkSize, crc0, &opt) == ZoeResult::SUCCESSED);
+      REQUIRE(file.hashedBytes() == 2 * kChunkSize);
+
+      // Ahead of the prefix, not regarded as written if not match.
+      REQUIRE(file.checkWrittenRange(HashType::CRC32, 5 * kChunkSize, 6 * kChunkSize, crc1, &opt) == ZoeResult::HASH_VERIFY_NOT_PASS);
+      REQUIRE(file.checkWrittenRange(HashType::CRC32, 2 * kChunkSize, 4 * kChunkSize, crc1, &opt) == ZoeResult::SUCCESSED);
+      REQUIRE(file.hashedBytes() == 4 * kChunkSize);
+
+      // Ahead of the prefix, read back once the gap is filled.
+      REQUIRE(file.checkWrittenRange(HashType::CRC32, 5 * kChunkSize, 6 * kChunkSize, crc2, &opt) == ZoeResult::SUCCESSED);
+      WriteChunk(file, data, 4);
+      REQUIRE(WaitHashed(file, 6 * kChunkSize) == 6 * kChunkSize);
+      for (int64_t index = 6; index <= 13; index++)
+        WriteChunk(file, data, index);
+      REQUIRE(WaitHashed(file, kFileSize) == kFileSize);
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+
+      // The prefix is fed with the data not matched, it is dropped.
+      file.enablePrefixHash(type);
+      REQUIRE(file.checkWrittenRange(HashType::CRC32, 0, 2 * kChunkSize, crc1, &opt) == ZoeResult::HASH_VERIFY_NOT_PASS);
+      REQUIRE(file.hashedBytes() == 0);
+      REQUIRE(TargetFileHash(file, type) == FullReadHash(type));
+      file.close();
+    }
+  }
+  FileUtil::RemoveFile(kTestFile);
+}
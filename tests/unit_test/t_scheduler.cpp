@@ -0,0 +1,100 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "catch.hpp"
+#include "zoe/zoe.h"
+#include "test_data.h"
+#include <future>
+#include <vector>
+using namespace zoe;
+
+// Run |job_num| downloads on |scheduler|, return the most connections seen in use.
+static int32_t RunSchedulerJobs(ZoeScheduler& scheduler, size_t job_num, bool same_url) {
+  std::vector<std::shared_ptr<Zoe>> efds;
+  std::vector<std::shared_future<ZoeResult>> results;
+  const TestData first = GetHttpTestData();
+  for (size_t i = 0; i < job_num; i++) {
+    TestData test_data = (same_url ? first : GetHttpTestData());
+    if (same_url)
+      test_data.target_file_path += std::to_string(i);
+    printf("\n[%zu] Url: %s\n", i, test_data.url.c_str());
+
+    std::shared_ptr<Zoe> t = std::make_shared<Zoe>();
+    efds.push_back(t);
+    REQUIRE(t->setScheduler(&scheduler) == ZoeResult::SUCCESSED);
+    t->setHttpHeaders({{"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/130.0.0.0 Safari/537.36"}});
+    t->setThreadNum(4);
+    t->setSlicePolicy(SlicePolicy::FixedNum, 10);
+    if (test_data.md5.length() > 0)
+      t->setHashVerifyPolicy(HashVerifyPolicy::AlwaysVerify, HashType::MD5, test_data.md5);
+
+    results.push_back(t->start(
+        test_data.url, test_data.target_file_path,
+        [i](ZoeResult result) {
+          printf("\n[%zu] ZoeResult: %s\n", i, Zoe::GetResultString(result));
+        },
+        nullptr,
+        nullptr));
+  }
+
+  int32_t max_active = 0;
+  for (auto& r : results) {
+    while (r.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready)
+      max_active = std::max(max_active, scheduler.activeConnections());
+  }
+
+  for (auto& r : results)
+    REQUIRE(r.get() == ZoeResult::SUCCESSED);
+  REQUIRE(scheduler.activeConnections() == 0);
+  return max_active;
+}
+
+TEST_CASE("SchedulerTest-MaxConnections") {
+  Zoe::GlobalInit();
+  {
+    ZoeScheduler scheduler(2);
+    REQUIRE(scheduler.loopNum() == 2);
+    REQUIRE(scheduler.setMaxConnections(5) == ZoeResult::SUCCESSED);
+    REQUIRE(scheduler.maxConnections() == 5);
+
+    // 3 downloads want 12 connections.
+    const int32_t max_active = RunSchedulerJobs(scheduler, 3, false);
+    printf("\nMax active connections: %d\n", max_active);
+    REQUIRE(max_active > 0);
+    REQUIRE(max_active <= 5);
+  }
+  Zoe::GlobalUnInit();
+}
+
+TEST_CASE("SchedulerTest-MaxConnectionsPerHost") {
+  Zoe::GlobalInit();
+  {
+    ZoeScheduler scheduler(1, EventEngine::Epoll);
+    REQUIRE(scheduler.setMaxConnectionsPerHost(2) == ZoeResult::SUCCESSED);
+    REQUIRE(scheduler.maxConnectionsPerHost() == 2);
+
+    // All of the downloads are from the same host.
+    const int32_t max_active = RunSchedulerJobs(scheduler, 3, true);
+    printf("\nMax active connections: %d\n", max_active);
+    REQUIRE(max_active > 0);
+    REQUIRE(max_active <= 2);
+  }
+  Zoe::GlobalUnInit();
+}
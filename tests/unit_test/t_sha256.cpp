@@ -0,0 +1,81 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "catch.hpp"
+#include "sha256.h"
+#include <string.h>
+#include <string>
+#include <vector>
+using namespace zoe;
+using namespace zoe::sha256_internal;
+
+static std::string Sha256(Sha256Kernel kernel, const unsigned char* data, size_t size, size_t step) {
+  SHA256_CTX ctx;
+  sha256_init(&ctx);
+  for (size_t done = 0; done < size; done += step)
+    sha256_update_by_kernel(kernel, &ctx, data + done, (uint32_t)std::min(step, size - done));
+  sha256_final(&ctx);
+  return sha256_digest(&ctx);
+}
+
+static std::string Sha256(Sha256Kernel kernel, const std::string& str) {
+  return Sha256(kernel, (const unsigned char*)str.data(), str.size(), str.size() + 1);
+}
+
+TEST_CASE("Sha256KnownAnswerTest") {
+  for (int32_t i = 0; i < (int32_t)Sha256Kernel::KernelNum; i++) {
+    const Sha256Kernel kernel = (Sha256Kernel)i;
+    if (!sha256_kernel_supported(kernel))
+      continue;
+    printf("\nKernel: %s\n", sha256_kernel_name(kernel));
+
+    // FIPS 180-2 examples.
+    REQUIRE(Sha256(kernel, "") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    REQUIRE(Sha256(kernel, "abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    REQUIRE(Sha256(kernel, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    REQUIRE(Sha256(kernel,
+                   "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrs"
+                   "tnopqrstu") == "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1");
+
+    const std::vector<unsigned char> million(1000000, 'a');
+    REQUIRE(Sha256(kernel, million.data(), million.size(), 4096) ==
+            "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+  }
+}
+
+TEST_CASE("Sha256KernelMatchScalar") {
+  std::vector<unsigned char> data(4096 + 16);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (unsigned char)(i * 131 + i / 7);
+
+  for (int32_t i = 0; i < (int32_t)Sha256Kernel::KernelNum; i++) {
+    const Sha256Kernel kernel = (Sha256Kernel)i;
+    if (!sha256_kernel_supported(kernel))
+      continue;
+
+    // Every length around the block and padding boundaries, updated at once and by odd steps.
+    for (size_t offset = 0; offset < 4; offset++) {
+      for (size_t size = 0; size <= 300; size++) {
+        const std::string expected = Sha256(Sha256Kernel::Scalar, data.data() + offset, size, size + 1);
+        REQUIRE(Sha256(kernel, data.data() + offset, size, size + 1) == expected);
+        REQUIRE(Sha256(kernel, data.data() + offset, size, 37) == expected);
+      }
+    }
+    REQUIRE(Sha256(kernel, data.data(), 4096, 4096) == Sha256(Sha256Kernel::Scalar, data.data(), 4096, 4096));
+  }
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "catch.hpp"
+#include "zoe/zoe.h"
+#include "file_util.h"
+#include "md5.h"
+#include "options.h"
+#include "test_data.h"
+#include <future>
+using namespace zoe;
+
+// Start the download with more connections than slices so the idle ones split the slices in flight,
+// stop it in the tail, then resume it from the index file.
+static void DoStopResumeTest(const TestData& test_data, bool hedge) {
+  printf("\nUrl: %s\n", test_data.url.c_str());
+
+  const utf8string index_path = test_data.target_file_path + ".efdindex";
+  FileUtil::RemoveFile(test_data.target_file_path);
+  FileUtil::RemoveFile(index_path);
+
+  Zoe::GlobalInit();
+  for (int round = 0; round < 2; round++) {
+    Zoe z;
+    z.setThreadNum(6);
+    z.setSlicePolicy(SlicePolicy::FixedNum, 3);
+    z.setUncompletedSliceSavePolicy(UncompletedSliceSavePolicy::SaveExceptFailed);
+    z.setHedgePolicy(hedge, 100);
+    if (test_data.md5.length() > 0)
+      z.setHashVerifyPolicy(HashVerifyPolicy::AlwaysVerify, HashType::MD5, test_data.md5);
+    z.setHttpHeaders({{"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/130.0.0.0 Safari/537.36"}});
+
+    std::atomic<bool> in_tail(false);
+    std::shared_future<ZoeResult> future_result = z.start(
+        test_data.url, test_data.target_file_path,
+        [round](ZoeResult result) {
+          printf("\n[%d] Result: %s\n", round, Zoe::GetResultString(result));
+        },
+        [&in_tail](int64_t total, int64_t downloaded) {
+          if (total > 0 && downloaded * 10 >= total * 8)
+            in_tail.store(true);
+        },
+        nullptr);
+
+    if (round == 0) {
+      while (!in_tail.load() && future_result.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+      }
+      z.stop();
+
+      // The download may have finished before it is stopped.
+      const ZoeResult result = future_result.get();
+      REQUIRE((result == ZoeResult::SUCCESSED || result == ZoeResult::CANCELED));
+      if (result == ZoeResult::CANCELED)
+        REQUIRE(FileUtil::IsExist(index_path));
+    }
+    else {
+      REQUIRE(future_result.get() == ZoeResult::SUCCESSED);
+    }
+  }
+  Zoe::GlobalUnInit();
+
+  if (test_data.md5.length() > 0) {
+    Options opt;
+    opt.internal_stop_event.unset();
+    utf8string str_hash;
+    REQUIRE(CalculateFileMd5(test_data.target_file_path, &opt, str_hash) == ZoeResult::SUCCESSED);
+    REQUIRE(str_hash == test_data.md5);
+  }
+}
+
+TEST_CASE("SplitSliceTest-StopResume") {
+  DoStopResumeTest(GetHttpTestData(), false);
+}
+
+TEST_CASE("SplitSliceTest-HedgeStopResume") {
+  DoStopResumeTest(GetHttpTestData(), true);
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+*    Copyright (C) <2019-2024>, winsoft666, <winsoft666@outlook.com>.
+*
+*    This program is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    This program is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include "catch.hpp"
+#include "zoe/zoe.h"
+#include "hasher.h"
+#include "test_data.h"
+#include <future>
+using namespace zoe;
+
+static void DoStreamTest(const TestData& test_data, int thread_num, int64_t window_size) {
+  printf("\nUrl: %s\n", test_data.url.c_str());
+
+  Zoe::GlobalInit();
+  {
+    Zoe z;
+    z.setThreadNum(thread_num);
+    z.setSlicePolicy(SlicePolicy::FixedNum, 10);
+    z.setStreamWindowSize(window_size);
+    if (test_data.md5.length() > 0)
+      z.setHashVerifyPolicy(HashVerifyPolicy::AlwaysVerify, HashType::MD5, test_data.md5);
+    z.setHttpHeaders({{"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/130.0.0.0 Safari/537.36"}});
+
+    // The data is delivered in file order, so its hash is the hash of the file.
+    std::unique_ptr<Hasher> hasher(Hasher::Create(HashType::MD5));
+    int64_t delivered = 0;
+    int32_t empty_calls = 0;
+    int64_t total_size = -1;
+    std::shared_future<ZoeResult> future_result = z.startStream(
+        test_data.url,
+        [&hasher, &delivered, &empty_calls](const char* data, int64_t size) {
+          if (size <= 0)
+            empty_calls++;
+          hasher->update(data, (size_t)size);
+          delivered += size;
+          return true;
+        },
+        [](ZoeResult result) {
+          printf("\nResult: %s\n", Zoe::GetResultString(result));
+        },
+        [&total_size](int64_t total, int64_t downloaded) {
+          total_size = total;
+          if (total > 0)
+            printf("%3d%%\b\b\b\b", (int)((double)downloaded * 100.f / (double)total));
+        },
+        nullptr);
+
+    REQUIRE(future_result.get() == ZoeResult::SUCCESSED);
+    REQUIRE(empty_calls == 0);
+    REQUIRE(delivered == total_size);
+    if (test_data.md5.length() > 0)
+      REQUIRE(hasher->final() == test_data.md5);
+  }
+  Zoe::GlobalUnInit();
+}
+
+TEST_CASE("StreamTest-ThreadNum1") {
+  DoStreamTest(GetHttpTestData(), 1, -1);
+}
+
+TEST_CASE("StreamTest-ThreadNum5") {
+  DoStreamTest(GetHttpTestData(), 5, -1);
+}
+
+TEST_CASE("StreamTest-ThreadNum5-Window1MB") {
+  // The slices far ahead of the delivered position wait for the window.
+  DoStreamTest(GetHttpTestData(), 5, 1024 * 1024);
+}
+
+TEST_CASE("StreamTest-Cancel") {
+  TestData test_data = GetHttpTestData();
+  printf("\nUrl: %s\n", test_data.url.c_str());
+
+  Zoe::GlobalInit();
+  {
+    Zoe z;
+    z.setThreadNum(5);
+    z.setSlicePolicy(SlicePolicy::FixedNum, 10);
+    z.setHttpHeaders({{"User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/130.0.0.0 Safari/537.36"}});
+
+    // The receiver refuses the data after 100KB, nothing is delivered after that.
+    const int64_t cancel_size = 100 * 1024;
+    std::atomic<int64_t> delivered(0);
+    std::atomic<int32_t> calls_after_cancel(0);
+    std::shared_future<ZoeResult> future_result = z.startStream(
+        test_data.url,
+        [&delivered, &calls_after_cancel, cancel_size](const char* data, int64_t size) {
+          if (delivered.load() >= cancel_size) {
+            calls_after_cancel++;
+            return false;
+          }
+          delivered += size;
+          return (delivered.load() < cancel_size);
+        },
+        [](ZoeResult result) {
+          printf("\nResult: %s\n", Zoe::GetResultString(result));
+        },
+        nullptr,
+        nullptr);
+
+    REQUIRE(future_result.get() == ZoeResult::CANCELED);
+    REQUIRE(delivered.load() >= cancel_size);
+    REQUIRE(calls_after_cancel.load() == 0);
+  }
+  Zoe::GlobalUnInit();
+}
@@ -105,7 +105,7 @@ int main(int argc, char** argv) {
   if (argc >= 4)
     z.setThreadNum(atoi(argv[3]));
   if (argc >= 5)
-    z.setDiskCacheSize(atoi(argv[4]) * 1024 * 1024);
+    z.setDiskCacheSize((int64_t)atoi(argv[4]) * 1024 * 1024);
   if (argc >= 6) {
     if (strlen(argv[5]) > 0) {
       z.setHashVerifyPolicy(HashVerifyPolicy::AlwaysVerify, HashType::MD5, argv[5]);